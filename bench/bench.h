@@ -0,0 +1,60 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+
+/*
+ * 基准程序直接链接引擎: 把 db.c 整个包含进来, 它的 main 改名, 不经过标准输入
+ */
+#define main db_main
+#include "../db.c"
+#undef main
+
+// 单调时钟, 纳秒
+uint64_t
+bench_now_ns(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// 删除旧的数据库文件和 WAL, 按给定的页大小新建一个空表; pager 是 cache、mmap 或者 direct
+Table*
+bench_open_table(const char *filename, uint32_t cache_pages, Durability durability, const char *pager,
+                 uint32_t page_size){
+    char wal_filename[512];
+    snprintf(wal_filename, sizeof(wal_filename), "%s-wal", filename);
+    unlink(filename);
+    unlink(wal_filename);
+
+    DbConfig config = {cache_pages, durability, true};
+    config.mmap = !strcmp(pager, "mmap");
+    config.direct = !strcmp(pager, "direct");
+    config.page_size = page_size;
+    return db_open(filename, &config);
+}
+
+// 第 i 个测试行: username 是 user<id>, email 是给定长度的填充
+void
+bench_make_row(Row *row, uint64_t id, uint32_t email_length){
+    row->id = id;
+    snprintf(row->username, sizeof(row->username), "user%lu", id);
+    if (email_length > COLUMN_EMAIL_SIZE) {
+        email_length = COLUMN_EMAIL_SIZE;
+    }
+    for (uint32_t i = 0; i < email_length; i++) {
+        row->email[i] = 'a' + (id + i) % 26;
+    }
+    row->email[email_length] = '\0';
+}
+
+// xorshift64*, 基准中所有的随机数都来自它, 同样的种子得到同样的结果
+uint64_t
+bench_random(uint64_t *state){
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+#endif
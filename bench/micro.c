@@ -0,0 +1,210 @@
+/*
+ * 引擎内部函数的微基准, 每个结果输出一行 JSON:
+ * {"bench": 名称, "ops": 次数, "ns_per_op": 每次的纳秒数}
+ * 用法: bench/micro [rows]
+ */
+#include "bench.h"
+
+#define MICRO_DB "/tmp/acdb-micro.db"
+#define MICRO_OPS 1000000
+#define MICRO_EMAIL_LENGTH 24
+
+void
+report(const char *name, uint64_t ops, uint64_t elapsed_ns){
+    printf("{\"bench\": \"%s\", \"ops\": %lu, \"ns_per_op\": %.1f}\n", name, ops, (double)elapsed_ns / ops);
+}
+
+void
+bench_serialize(){
+    Row row;
+    uint8_t cell[ROW_MAX_SIZE];
+    uint64_t sink = 0;
+    bench_make_row(&row, 12345, MICRO_EMAIL_LENGTH);
+
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < MICRO_OPS; i++) {
+        row.username[4] = '0' + i % 10;
+        sink += serialize_row(&row, cell);
+    }
+    report("serialize_row", MICRO_OPS, bench_now_ns() - start);
+
+    Row output;
+    start = bench_now_ns();
+    for (uint32_t i = 0; i < MICRO_OPS; i++) {
+        cell[ROW_STRINGS_OFFSET] = 'a' + i % 26;
+        deserialize_row(cell, &output);
+        sink += output.username[0];
+    }
+    report("deserialize_row", MICRO_OPS, bench_now_ns() - start);
+    if (sink == 0) {
+        printf("\n");
+    }
+}
+
+// 在所有叶节点中随机选一个叶节点和其中的一个键查找
+void
+bench_leaf_find(Table *table, uint32_t rows){
+    Pager *pager = table->pager;
+    uint32_t *leaves = malloc(rows * sizeof(uint32_t));
+    uint32_t num_leaves = 0;
+    Cursor *cursor = table_start(table);
+    while (!cursor->end_of_table) {
+        leaves[num_leaves++] = cursor->page_num;
+        void *node = get_page(pager, cursor->page_num);
+        cursor->cell_num = *leaf_node_num_cells(node) - 1;
+        pager_unpin(pager, cursor->page_num);
+        cursor_advance(cursor);
+    }
+    free(cursor);
+    pager_unpin_all(pager);
+
+    uint64_t state = 1;
+    uint64_t sink = 0;
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < MICRO_OPS; i++) {
+        uint32_t page_num = leaves[bench_random(&state) % num_leaves];
+        void *node = get_page(pager, page_num);
+        uint32_t key = *leaf_node_key(node, bench_random(&state) % *leaf_node_num_cells(node));
+        cursor = leaf_node_find(table, page_num, key);
+        sink += cursor->cell_num;
+        free(cursor);
+        pager_unpin(pager, page_num);
+        pager_unpin(pager, page_num);
+    }
+    report("leaf_node_find", MICRO_OPS, bench_now_ns() - start);
+    free(leaves);
+    if (sink == 0) {
+        printf("\n");
+    }
+}
+
+// 从根节点下降到叶节点
+void
+bench_internal_find(Table *table, uint32_t rows){
+    Pager *pager = table->pager;
+    uint64_t state = 2;
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < MICRO_OPS; i++) {
+        uint32_t key = bench_random(&state) % rows + 1;
+        Cursor *cursor = internal_node_find(table, table->root_page_num, key);
+        free(cursor);
+        pager_unpin_all(pager);
+    }
+    report("internal_node_find", MICRO_OPS, bench_now_ns() - start);
+}
+
+void
+bench_get_page_hit(Table *table){
+    Pager *pager = table->pager;
+    uint32_t num_pages = pager->num_pages < pager->num_frames ? pager->num_pages : pager->num_frames;
+    uint64_t state = 3;
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < MICRO_OPS; i++) {
+        uint32_t page_num = bench_random(&state) % num_pages;
+        get_page(pager, page_num);
+        pager_unpin(pager, page_num);
+    }
+    report("get_page_hit", MICRO_OPS, bench_now_ns() - start);
+}
+
+// 只有最小的缓冲池, 随机访问整个文件, 几乎每次都要淘汰一个页面并从文件读入
+void
+bench_get_page_miss(){
+    DbConfig config = {PAGER_MIN_FRAMES, DURABILITY_OFF, true};
+    Table *table = db_open(MICRO_DB, &config);
+    Pager *pager = table->pager;
+    uint32_t ops = MICRO_OPS / 10;
+    uint64_t state = 4;
+    uint64_t misses = pager->stats.misses;
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < ops; i++) {
+        uint32_t page_num = bench_random(&state) % pager->num_pages;
+        get_page(pager, page_num);
+        pager_unpin(pager, page_num);
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    report("get_page_miss", ops, elapsed);
+    printf("{\"bench\": \"get_page_miss_ratio\", \"ops\": %u, \"ratio\": %.3f}\n",
+           ops, (double)(pager->stats.misses - misses) / ops);
+    db_close(table);
+}
+
+// 反复把一个满的根叶节点恢复原样再分裂, 分裂产生的两个页面放回空闲页链表
+void
+bench_leaf_split(){
+    Table *table = bench_open_table(MICRO_DB "-split", PAGER_DEFAULT_FRAMES, DURABILITY_OFF, "cache", DEFAULT_PAGE_SIZE);
+    Pager *pager = table->pager;
+    uint32_t root_page_num = table->root_page_num;
+
+    void *image = malloc(PAGE_SIZE);
+    initialize_leaf_node(image);
+    set_node_root(image, true);
+    uint8_t cell[ROW_MAX_SIZE];
+    Row row;
+    uint32_t num_cells = 0;
+    while (true) {
+        bench_make_row(&row, (num_cells + 1) * 2, MICRO_EMAIL_LENGTH);
+        uint32_t cell_size = serialize_row(&row, cell);
+        if (!leaf_node_reserve(image, cell_size)) {
+            break;
+        }
+        leaf_node_insert_cell(image, num_cells++, row.id, cell, cell_size);
+    }
+
+    uint32_t ops = MICRO_OPS / 10;
+    uint64_t elapsed = 0;
+    for (uint32_t i = 0; i < ops; i++) {
+        void *root = get_page(pager, root_page_num);
+        memcpy(root, image, PAGE_SIZE);
+        pager_mark_dirty(pager, root_page_num);
+
+        // 新的键插在中间, 两边各一半
+        bench_make_row(&row, num_cells + 1, MICRO_EMAIL_LENGTH);
+        Cursor *cursor = leaf_node_find(table, root_page_num, row.id);
+        uint64_t start = bench_now_ns();
+        leaf_node_split_and_insert(cursor, row.id, &row);
+        elapsed += bench_now_ns() - start;
+        free(cursor);
+
+        uint32_t left = *internal_node_child(root, 0);
+        uint32_t right = *internal_node_right_child(root);
+        pager_unpin_all(pager);
+        free_page(table, left);
+        free_page(table, right);
+    }
+    report("leaf_node_split_and_insert", ops, elapsed);
+    free(image);
+    db_close(table);
+    unlink(MICRO_DB "-split");
+}
+
+int
+main(int argc, char *argv[]){
+    uint32_t rows = argc > 1 ? strtoul(argv[1], NULL, 10) : 200000;
+    if (rows == 0) {
+        printf("Usage: %s [rows]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    key_search_init();
+    bench_serialize();
+
+    Table *table = bench_open_table(MICRO_DB, PAGER_DEFAULT_FRAMES * 8, DURABILITY_OFF, "cache", DEFAULT_PAGE_SIZE);
+    Row row;
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 1; i <= rows; i++) {
+        bench_make_row(&row, i, MICRO_EMAIL_LENGTH);
+        table_insert(table, &row);
+        pager_unpin_all(table->pager);
+    }
+    report("table_insert_sequential", rows, bench_now_ns() - start);
+
+    bench_leaf_find(table, rows);
+    bench_internal_find(table, rows);
+    bench_get_page_hit(table);
+    db_close(table);
+
+    bench_get_page_miss();
+    bench_leaf_split();
+    unlink(MICRO_DB);
+    return 0;
+}
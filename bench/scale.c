@@ -0,0 +1,238 @@
+/*
+ * 大表的基准: 用自底向上的构建器按键的顺序装载 rows 行(默认 10 亿), 键是 64 位的 snowflake 风格 id
+ * (毫秒时间戳 << 22 | 序号), 然后随机查找。结果是一行 JSON: 每一层的节点数、内部节点的平均扇出、
+ * 文件大小, 查找的吞吐量和延迟分位, 以及平均每层的开销和每次查找读入的页数
+ *
+ * 用法: bench/scale [--rows N] [--lookups N] [--value-length N] [--cache-pages N]
+ *                   [--pager cache|mmap|direct] [--page-size N] [--db FILE] [--reuse 0|1] [--seed N]
+ * --reuse 1 时直接打开上次装载好的文件, 只做查找
+ */
+#include "bench.h"
+
+#define SCALE_EPOCH_MS 1700000000000ULL // 第 0 行的时间戳
+#define SCALE_IDS_PER_MS 4096          // snowflake 的序号占 12 位
+
+typedef struct {
+    const char *filename;
+    uint64_t rows;
+    uint32_t lookups;
+    uint32_t value_length;
+    uint32_t cache_pages;
+    uint32_t page_size;
+    const char *pager;
+    bool reuse;
+    uint64_t seed;
+} ScaleConfig;
+
+// 第 i 行的键, 随 i 严格递增
+uint64_t
+scale_key(uint64_t i){
+    return (SCALE_EPOCH_MS + i / SCALE_IDS_PER_MS) << 22 | (i % SCALE_IDS_PER_MS);
+}
+
+void
+parse_scale_args(int argc, char *argv[], ScaleConfig *config){
+    config->filename = "/tmp/acdb-scale.db";
+    config->rows = 1000000000;
+    config->lookups = 1000000;
+    config->value_length = 8;
+    config->cache_pages = 65536;
+    config->page_size = DEFAULT_PAGE_SIZE;
+    config->pager = "cache";
+    config->reuse = false;
+    config->seed = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            printf("Missing value for '%s'\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+        char *option = argv[i];
+        char *value = argv[++i];
+        if (!strcmp(option, "--rows")) {
+            config->rows = strtoull(value, NULL, 10);
+        }else if (!strcmp(option, "--lookups")) {
+            config->lookups = strtoul(value, NULL, 10);
+        }else if (!strcmp(option, "--value-length")) {
+            config->value_length = strtoul(value, NULL, 10);
+        }else if (!strcmp(option, "--cache-pages")) {
+            config->cache_pages = strtoul(value, NULL, 10);
+        }else if (!strcmp(option, "--page-size")) {
+            config->page_size = strtoul(value, NULL, 10);
+            if (!page_size_valid(config->page_size)) {
+                printf("Page size must be a power of two between %d and %d.\n", MIN_PAGE_SIZE, MAX_PAGE_SIZE);
+                exit(EXIT_FAILURE);
+            }
+        }else if (!strcmp(option, "--pager")) {
+            if (!strcmp(value, "cache") || !strcmp(value, "mmap") || !strcmp(value, "direct")) {
+                config->pager = value;
+            }else {
+                printf("Unknown pager '%s'\n", value);
+                exit(EXIT_FAILURE);
+            }
+        }else if (!strcmp(option, "--db")) {
+            config->filename = value;
+        }else if (!strcmp(option, "--reuse")) {
+            config->reuse = strtoul(value, NULL, 10) != 0;
+        }else if (!strcmp(option, "--seed")) {
+            config->seed = strtoull(value, NULL, 10);
+        }else {
+            printf("Unknown option '%s'\n", option);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (config->rows == 0 || config->lookups == 0 || config->seed == 0) {
+        printf("rows, lookups and seed must be positive\n");
+        exit(EXIT_FAILURE);
+    }
+    if (config->value_length > COLUMN_EMAIL_SIZE) {
+        config->value_length = COLUMN_EMAIL_SIZE;
+    }
+    if (config->cache_pages < PAGER_MIN_FRAMES) {
+        config->cache_pages = PAGER_MIN_FRAMES;
+    }
+}
+
+// 按键的顺序装载所有的行, 行很短, 让 10 亿行的文件保持在几十 GB
+void
+scale_load(Table *table, ScaleConfig *config){
+    TreeBuilder builder;
+    builder_init(&builder, table, IMPORT_DEFAULT_FILL);
+    Row row;
+    strcpy(row.username, "u");
+    memset(row.email, 'e', config->value_length);
+    row.email[config->value_length] = '\0';
+    for (uint64_t i = 0; i < config->rows; i++) {
+        row.id = scale_key(i);
+        builder_add_row(&builder, &row);
+    }
+    builder_finish(&builder);
+    pager_unpin_all(table->pager);
+}
+
+// 从根节点逐层向下数出每一层的节点数和内部节点的孩子总数, 只读内部节点, 不读叶节点
+uint32_t
+scale_levels(Table *table, uint64_t *nodes, uint64_t *children){
+    Pager *pager = table->pager;
+    uint32_t *level = malloc(sizeof(uint32_t));
+    uint64_t count = 1;
+    level[0] = table->root_page_num;
+    uint32_t height = 0;
+    while (true) {
+        nodes[height] = count;
+        children[height] = 0;
+        void *first = get_page(pager, level[0]);
+        bool leaf = get_node_type(first) == NODE_LEAF;
+        pager_unpin(pager, level[0]);
+        if (leaf) {
+            break;
+        }
+
+        for (uint64_t i = 0; i < count; i++) {
+            void *node = get_page(pager, level[i]);
+            children[height] += *internal_node_num_keys(node) + 1;
+            pager_unpin(pager, level[i]);
+        }
+        uint32_t *next = malloc(children[height] * sizeof(uint32_t));
+        uint64_t next_count = 0;
+        for (uint64_t i = 0; i < count; i++) {
+            void *node = get_page(pager, level[i]);
+            for (uint32_t j = 0; j <= *internal_node_num_keys(node); j++) {
+                next[next_count++] = *internal_node_child(node, j);
+            }
+            pager_unpin(pager, level[i]);
+        }
+        free(level);
+        level = next;
+        count = next_count;
+        height++;
+    }
+    free(level);
+    return height + 1;
+}
+
+int
+compare_uint32(const void *a, const void *b){
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+int
+main(int argc, char *argv[]){
+    ScaleConfig config;
+    parse_scale_args(argc, argv, &config);
+    key_search_init();
+
+    Table *table;
+    double load_seconds = 0;
+    if (config.reuse) {
+        DbConfig db_config = {config.cache_pages, DURABILITY_OFF, true};
+        db_config.mmap = !strcmp(config.pager, "mmap");
+        db_config.direct = !strcmp(config.pager, "direct");
+        db_config.page_size = config.page_size;
+        table = db_open(config.filename, &db_config);
+    }else {
+        table = bench_open_table(config.filename, config.cache_pages, DURABILITY_OFF, config.pager,
+                                 config.page_size);
+        uint64_t start = bench_now_ns();
+        scale_load(table, &config);
+        pager_flush_all(table->pager);
+        load_seconds = (bench_now_ns() - start) / 1e9;
+    }
+    Pager *pager = table->pager;
+
+    uint64_t nodes[MAX_TREE_HEIGHT], children[MAX_TREE_HEIGHT];
+    uint32_t height = scale_levels(table, nodes, children);
+    uint64_t internal_nodes = 0, internal_children = 0;
+    for (uint32_t i = 0; i + 1 < height; i++) {
+        internal_nodes += nodes[i];
+        internal_children += children[i];
+    }
+
+    // 随机查找已经装载的键; 内部节点在上面数层数时已经读入缓冲池, 和长时间运行的服务一样
+    uint32_t *samples = malloc(config.lookups * sizeof(uint32_t));
+    uint64_t state = config.seed;
+    uint64_t misses = pager->stats.misses;
+    uint64_t found = 0;
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < config.lookups; i++) {
+        uint64_t key = scale_key(bench_random(&state) % config.rows);
+        uint64_t op_start = bench_now_ns();
+        Cursor *cursor = table_find(table, key);
+        void *node = get_page(pager, cursor->page_num);
+        found += cursor->cell_num < *leaf_node_num_cells(node) && *leaf_node_key(node, cursor->cell_num) == key;
+        free(cursor);
+        pager_unpin_all(pager);
+        uint64_t elapsed = bench_now_ns() - op_start;
+        samples[i] = elapsed < UINT32_MAX ? elapsed : UINT32_MAX;
+    }
+    double lookup_seconds = (bench_now_ns() - start) / 1e9;
+    misses = pager->stats.misses - misses;
+    off_t file_bytes = (off_t)pager->num_pages * PAGE_SIZE;
+    db_close(table);
+
+    if (found != config.lookups) {
+        printf("%lu of %u lookups missed\n", config.lookups - found, config.lookups);
+        exit(EXIT_FAILURE);
+    }
+    qsort(samples, config.lookups, sizeof(uint32_t), compare_uint32);
+    double mean_ns = lookup_seconds * 1e9 / config.lookups;
+    printf("{\"rows\": %lu, \"pager\": \"%s\", \"page_size\": %u, \"key_search\": \"%s\", \"file_gb\": %.2f, "
+           "\"load_seconds\": %.1f, \"height\": %u, \"levels\": [",
+           config.rows, config.pager, PAGE_SIZE, key_search_name(), file_bytes / 1e9, load_seconds, height);
+    for (uint32_t i = 0; i < height; i++) {
+        printf("%s%lu", i > 0 ? ", " : "", nodes[i]);
+    }
+    printf("], \"max_fanout\": %u, \"avg_fanout\": %.1f, \"rows_per_leaf\": %.1f, "
+           "\"lookups\": %u, \"lookups_per_sec\": %.0f, \"mean_ns\": %.0f, \"ns_per_level\": %.0f, "
+           "\"pages_read_per_lookup\": %.2f, \"p50_us\": %.2f, \"p99_us\": %.2f, \"p999_us\": %.2f}\n",
+           INTERNAL_NODE_MAX_KEYS + 1, internal_nodes ? (double)internal_children / internal_nodes : 0,
+           (double)config.rows / nodes[height - 1], config.lookups, config.lookups / lookup_seconds, mean_ns,
+           mean_ns / height, (double)misses / config.lookups, samples[config.lookups / 2] / 1000.0,
+           samples[(uint64_t)config.lookups * 99 / 100] / 1000.0,
+           samples[(uint64_t)config.lookups * 999 / 1000] / 1000.0);
+    free(samples);
+    return 0;
+}
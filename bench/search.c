@@ -0,0 +1,97 @@
+/*
+ * 键查找的微基准: 比较旧的交错布局上的二分查找和连续键数组上的各个查找内核
+ * make bench/search && bench/search
+ */
+#include "bench.h"
+
+#include <x86intrin.h>
+
+#define BENCH_NODES 4096      // 冷数据: 所有节点远大于缓存, 和真实的树一样每次查找都可能缺失
+#define BENCH_LOOKUPS 2000000
+
+// 旧布局: 键和子指针交错存放, 每个键之间隔着一个子指针
+uint32_t
+interleaved_lower_bound(const uint64_t *cells, uint32_t num_keys, uint64_t key){
+    uint32_t left = 0, right = num_keys;
+    while (left < right) {
+        uint32_t index = (left + right) / 2;
+        if (key > cells[index * 2 + 1]) {
+            left = index + 1;
+        }else {
+            right = index;
+        }
+    }
+    return left;
+}
+
+// 以交错布局的数组作为参数, 和其他内核一样通过函数指针调用
+uint32_t
+interleaved_search(const uint64_t *cells, uint32_t num_keys, uint64_t key){
+    return interleaved_lower_bound(cells, num_keys, key);
+}
+
+// nodes 个节点中依次查找 probes, stride 是相邻两个节点之间的键的个数
+void
+bench_kernel(const char *name, KeySearch search, uint64_t *pages, uint32_t stride, uint32_t nodes,
+             uint32_t num_keys, uint64_t *probes, uint32_t *expected){
+    uint64_t start = __rdtsc();
+    for (uint32_t i = 0; i < BENCH_LOOKUPS; i++) {
+        uint64_t *keys = pages + (size_t)(i * 2654435761u % nodes) * stride;
+        if (search(keys, num_keys, probes[i]) != expected[i]) {
+            printf("%s: wrong result for key %lu\n", name, probes[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    uint64_t cycles = __rdtsc() - start;
+    printf("  %-12s %7.1f cycles/lookup\n", name, (double)cycles / BENCH_LOOKUPS);
+}
+
+void
+bench_keys(uint32_t num_keys, uint32_t nodes){
+    uint32_t words = PAGE_SIZE / sizeof(uint64_t);
+    uint64_t *contiguous = aligned_alloc(PAGE_SIZE, (size_t)nodes * PAGE_SIZE);
+    uint64_t *interleaved = aligned_alloc(PAGE_SIZE, (size_t)nodes * PAGE_SIZE * 2);
+    uint64_t *probes = malloc(BENCH_LOOKUPS * sizeof(uint64_t));
+    uint32_t *expected = malloc(BENCH_LOOKUPS * sizeof(uint32_t));
+
+    // 每个节点的键都是 3 的倍数, 查找的键有的命中、有的落在两个键之间, 也有超过最大键的
+    for (uint32_t n = 0; n < nodes; n++) {
+        for (uint32_t i = 0; i < num_keys; i++) {
+            contiguous[(size_t)n * words + i] = (i + 1) * 3;
+            interleaved[(size_t)n * words * 2 + i * 2] = n;
+            interleaved[(size_t)n * words * 2 + i * 2 + 1] = (i + 1) * 3;
+        }
+    }
+    srand(42);
+    for (uint32_t i = 0; i < BENCH_LOOKUPS; i++) {
+        probes[i] = rand() % (num_keys * 3 + 4);
+        expected[i] = key_lower_bound_scalar(contiguous, num_keys, probes[i]);
+    }
+
+    printf("%d keys per node, %d nodes:\n", num_keys, nodes);
+    bench_kernel("interleaved", interleaved_search, interleaved, words * 2, nodes, num_keys, probes, expected);
+    bench_kernel("scalar", key_lower_bound_scalar, contiguous, words, nodes, num_keys, probes, expected);
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        bench_kernel("sse4.2", key_lower_bound_sse42, contiguous, words, nodes, num_keys, probes, expected);
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        bench_kernel("avx2", key_lower_bound_avx2, contiguous, words, nodes, num_keys, probes, expected);
+    }
+
+    free(contiguous);
+    free(interleaved);
+    free(probes);
+    free(expected);
+}
+
+int
+main(){
+    // 典型的叶节点(约 35 字节的行)和满的内部节点, 分别在缓存中和不在缓存中
+    uint32_t sizes[] = {100, INTERNAL_NODE_MAX_KEYS};
+    for (uint32_t i = 0; i < 2; i++) {
+        bench_keys(sizes[i], 1);
+        bench_keys(sizes[i], BENCH_NODES);
+    }
+    return 0;
+}
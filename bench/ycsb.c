@@ -0,0 +1,449 @@
+/*
+ * YCSB 风格的负载驱动: 先装载 records 行, 再按给定比例执行 ops 次
+ * read / update / insert / scan / read-modify-write, 每次操作和 REPL 中的一条语句一样
+ * 结束时释放固定的页面并提交。结果是一行 JSON, 包括吞吐量和每种操作的 p50/p99/p999 延迟
+ *
+ * 用法: bench/ycsb [--workload a|b|c|d|e|f|load] [--records N | --data-mb N] [--ops N]
+ *                  [--read P] [--update P] [--insert P] [--scan P] [--rmw P]
+ *                  [--distribution uniform|zipfian|latest] [--theta T]
+ *                  [--keys sequential|random] [--scan-length N] [--value-length N]
+ *                  [--cache-pages N] [--pager cache|mmap|direct] [--durability off|normal|full]
+ *                  [--page-size N] [--db FILE] [--seed N]
+ */
+#include "bench.h"
+#include <math.h>
+
+typedef enum {
+    OP_READ,
+    OP_UPDATE,
+    OP_INSERT,
+    OP_SCAN,
+    OP_RMW,
+    OP_COUNT
+} OpType;
+
+const char *op_names[OP_COUNT] = {"read", "update", "insert", "scan", "rmw"};
+
+typedef enum {
+    DIST_UNIFORM,
+    DIST_ZIPFIAN, // 热点被散列到整个键空间
+    DIST_LATEST   // 越新插入的行越热
+} Distribution;
+
+typedef struct {
+    const char *filename;
+    const char *workload;
+    uint32_t records;
+    uint32_t data_mb;
+    uint32_t ops;
+    uint32_t mix[OP_COUNT]; // 每种操作的百分比
+    Distribution distribution;
+    double theta;
+    bool random_keys;       // 装载和插入的键是否打乱, 否则按顺序递增
+    uint32_t scan_length;   // scan 最多读取的行数, 每次在 [1, scan_length] 中均匀选择
+    uint32_t value_length;  // email 列的长度
+    uint32_t cache_pages;
+    uint32_t page_size;
+    const char *pager;      // cache、mmap 或者 direct
+    Durability durability;
+    uint64_t seed;
+} YcsbConfig;
+
+// Gray 等人的 Zipfian 生成器, 与 YCSB 相同: 返回 [0, items) 中的排名, 0 最热
+typedef struct {
+    uint64_t items;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+} Zipfian;
+
+// 每种操作的延迟, 纳秒
+typedef struct {
+    uint32_t *samples;
+    uint32_t count;
+} Latencies;
+
+void
+zipfian_init(Zipfian *zipfian, uint64_t items, double theta){
+    double zeta2 = 1 + pow(0.5, theta);
+    double zetan = 0;
+    for (uint64_t i = 1; i <= items; i++) {
+        zetan += 1 / pow((double)i, theta);
+    }
+    zipfian->items = items;
+    zipfian->theta = theta;
+    zipfian->alpha = 1 / (1 - theta);
+    zipfian->zetan = zetan;
+    zipfian->eta = (1 - pow(2.0 / items, 1 - theta)) / (1 - zeta2 / zetan);
+}
+
+uint64_t
+zipfian_next(Zipfian *zipfian, uint64_t *state){
+    double u = (double)(bench_random(state) >> 11) / (1ULL << 53);
+    double uz = u * zipfian->zetan;
+    if (uz < 1) {
+        return 0;
+    }
+    if (uz < 1 + pow(0.5, zipfian->theta)) {
+        return 1;
+    }
+    uint64_t rank = zipfian->items * pow(zipfian->eta * u - zipfian->eta + 1, zipfian->alpha);
+    return rank < zipfian->items ? rank : zipfian->items - 1;
+}
+
+// 第 index 个插入的行的键; 打乱时用一个 32 位的双射, 所以不会重复, 也不会是 0
+uint32_t
+record_key(YcsbConfig *config, uint32_t index){
+    if (!config->random_keys) {
+        return index + 1;
+    }
+    uint32_t x = index + 1;
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+// 按分布选择一个已经插入的行
+uint32_t
+choose_record(YcsbConfig *config, Zipfian *zipfian, uint32_t inserted, uint64_t *state){
+    switch (config->distribution) {
+        case DIST_UNIFORM:
+            return bench_random(state) % inserted;
+        case DIST_ZIPFIAN: {
+            // 和 YCSB 的 ScrambledZipfian 一样, 用 FNV 散列把排名打散
+            uint64_t rank = zipfian_next(zipfian, state);
+            uint64_t hash = 0xCBF29CE484222325ULL;
+            for (int i = 0; i < 8; i++) {
+                hash = (hash ^ (rank & 0xff)) * 0x100000001B3ULL;
+                rank >>= 8;
+            }
+            return hash % inserted;
+        }
+        case DIST_LATEST: {
+            uint64_t rank = zipfian_next(zipfian, state) % inserted;
+            return inserted - 1 - rank;
+        }
+    }
+    return 0;
+}
+
+void
+set_workload(YcsbConfig *config, const char *name){
+    config->workload = name;
+    memset(config->mix, 0, sizeof(config->mix));
+    if (!strcmp(name, "a")) {
+        config->mix[OP_READ] = 50;
+        config->mix[OP_UPDATE] = 50;
+    }else if (!strcmp(name, "b")) {
+        config->mix[OP_READ] = 95;
+        config->mix[OP_UPDATE] = 5;
+    }else if (!strcmp(name, "c")) {
+        config->mix[OP_READ] = 100;
+    }else if (!strcmp(name, "d")) {
+        config->mix[OP_READ] = 95;
+        config->mix[OP_INSERT] = 5;
+        config->distribution = DIST_LATEST;
+    }else if (!strcmp(name, "e")) {
+        config->mix[OP_SCAN] = 95;
+        config->mix[OP_INSERT] = 5;
+    }else if (!strcmp(name, "f")) {
+        config->mix[OP_READ] = 50;
+        config->mix[OP_RMW] = 50;
+    }else if (!strcmp(name, "load")) {
+        config->mix[OP_INSERT] = 100;
+    }else {
+        printf("Unknown workload '%s'\n", name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void
+parse_ycsb_args(int argc, char *argv[], YcsbConfig *config){
+    config->filename = "/tmp/acdb-ycsb.db";
+    config->records = 100000;
+    config->data_mb = 0;
+    config->ops = 100000;
+    config->distribution = DIST_ZIPFIAN;
+    config->theta = 0.99;
+    config->random_keys = true;
+    config->scan_length = 100;
+    config->value_length = 100;
+    config->cache_pages = PAGER_DEFAULT_FRAMES;
+    config->page_size = DEFAULT_PAGE_SIZE;
+    config->pager = "cache";
+    config->durability = DURABILITY_NORMAL;
+    config->seed = 1;
+    set_workload(config, "a");
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            printf("Missing value for '%s'\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+        char *option = argv[i];
+        char *value = argv[++i];
+        if (!strcmp(option, "--workload")) {
+            set_workload(config, value);
+        }else if (!strcmp(option, "--records")) {
+            config->records = strtoul(value, NULL, 10);
+        }else if (!strcmp(option, "--data-mb")) {
+            config->data_mb = strtoul(value, NULL, 10);
+        }else if (!strcmp(option, "--ops")) {
+            config->ops = strtoul(value, NULL, 10);
+        }else if (!strcmp(option, "--read")) {
+            config->mix[OP_READ] = strtoul(value, NULL, 10);
+        }else if (!strcmp(option, "--update")) {
+            config->mix[OP_UPDATE] = strtoul(value, NULL, 10);
+        }else if (!strcmp(option, "--insert")) {
+            config->mix[OP_INSERT] = strtoul(value, NULL, 10);
+        }else if (!strcmp(option, "--scan")) {
+            config->mix[OP_SCAN] = strtoul(value, NULL, 10);
+        }else if (!strcmp(option, "--rmw")) {
+            config->mix[OP_RMW] = strtoul(value, NULL, 10);
+        }else if (!strcmp(option, "--distribution")) {
+            if (!strcmp(value, "uniform")) {
+                config->distribution = DIST_UNIFORM;
+            }else if (!strcmp(value, "zipfian")) {
+                config->distribution = DIST_ZIPFIAN;
+            }else if (!strcmp(value, "latest")) {
+                config->distribution = DIST_LATEST;
+            }else {
+                printf("Unknown distribution '%s'\n", value);
+                exit(EXIT_FAILURE);
+            }
+        }else if (!strcmp(option, "--theta")) {
+            config->theta = strtod(value, NULL);
+        }else if (!strcmp(option, "--keys")) {
+            if (!strcmp(value, "sequential")) {
+                config->random_keys = false;
+            }else if (!strcmp(value, "random")) {
+                config->random_keys = true;
+            }else {
+                printf("Unknown key order '%s'\n", value);
+                exit(EXIT_FAILURE);
+            }
+        }else if (!strcmp(option, "--scan-length")) {
+            config->scan_length = strtoul(value, NULL, 10);
+        }else if (!strcmp(option, "--value-length")) {
+            config->value_length = strtoul(value, NULL, 10);
+        }else if (!strcmp(option, "--cache-pages")) {
+            config->cache_pages = strtoul(value, NULL, 10);
+        }else if (!strcmp(option, "--page-size")) {
+            config->page_size = strtoul(value, NULL, 10);
+            if (!page_size_valid(config->page_size)) {
+                printf("Page size must be a power of two between %d and %d.\n", MIN_PAGE_SIZE, MAX_PAGE_SIZE);
+                exit(EXIT_FAILURE);
+            }
+        }else if (!strcmp(option, "--pager")) {
+            if (!strcmp(value, "cache") || !strcmp(value, "mmap") || !strcmp(value, "direct")) {
+                config->pager = value;
+            }else {
+                printf("Unknown pager '%s'\n", value);
+                exit(EXIT_FAILURE);
+            }
+        }else if (!strcmp(option, "--durability")) {
+            if (!strcmp(value, "off")) {
+                config->durability = DURABILITY_OFF;
+            }else if (!strcmp(value, "normal")) {
+                config->durability = DURABILITY_NORMAL;
+            }else if (!strcmp(value, "full")) {
+                config->durability = DURABILITY_FULL;
+            }else {
+                printf("Unknown durability '%s'\n", value);
+                exit(EXIT_FAILURE);
+            }
+        }else if (!strcmp(option, "--db")) {
+            config->filename = value;
+        }else if (!strcmp(option, "--seed")) {
+            config->seed = strtoull(value, NULL, 10);
+        }else {
+            printf("Unknown option '%s'\n", option);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    uint32_t total = 0;
+    for (int op = 0; op < OP_COUNT; op++) {
+        total += config->mix[op];
+    }
+    if (total != 100) {
+        printf("Operation mix must add up to 100, got %u\n", total);
+        exit(EXIT_FAILURE);
+    }
+    if (config->value_length > COLUMN_EMAIL_SIZE) {
+        config->value_length = COLUMN_EMAIL_SIZE;
+    }
+    // 按单元格大小加上槽位和键估算行数, 叶节点不满的部分不算
+    if (config->data_mb > 0) {
+        uint32_t row_bytes = ROW_STRINGS_OFFSET + 10 + config->value_length + LEAF_NODE_SLOT_SIZE;
+        config->records = (uint64_t)config->data_mb * 1024 * 1024 / row_bytes;
+    }
+    if (config->records == 0 || config->scan_length == 0 || config->seed == 0) {
+        printf("records, scan-length and seed must be positive\n");
+        exit(EXIT_FAILURE);
+    }
+    if (config->cache_pages < PAGER_MIN_FRAMES) {
+        config->cache_pages = PAGER_MIN_FRAMES;
+    }
+}
+
+int
+compare_uint32(const void *a, const void *b){
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+// 排序之后的第 p 分位, 微秒
+double
+percentile_us(Latencies *latencies, double p){
+    uint32_t index = (uint32_t)(p * latencies->count);
+    if (index >= latencies->count) {
+        index = latencies->count - 1;
+    }
+    return latencies->samples[index] / 1000.0;
+}
+
+// 读取一行, 行不存在时返回 false
+bool
+ycsb_read(Table *table, uint32_t key, Row *row){
+    Cursor *cursor = table_find(table, key);
+    void *node = get_page(table->pager, cursor->page_num);
+    bool found = cursor->cell_num < *leaf_node_num_cells(node)
+                 && *leaf_node_key(node, cursor->cell_num) == key;
+    if (found) {
+        deserialize_row(leaf_node_value(node, cursor->cell_num), row);
+        row->id = key;
+    }
+    free(cursor);
+    return found;
+}
+
+void
+ycsb_update(Table *table, uint32_t key, YcsbConfig *config, uint64_t *state){
+    Statement statement;
+    memset(&statement, 0, sizeof(statement));
+    bench_make_row(&statement.row_to_update, bench_random(state), config->value_length);
+    statement.set_email = true;
+    table_update(table, key, &statement);
+}
+
+uint32_t
+ycsb_scan(Table *table, uint32_t key, uint32_t length){
+    Cursor *cursor = table_seek(table, key);
+    Row row;
+    uint32_t rows = 0;
+    while (!cursor->end_of_table && rows < length) {
+        deserialize_row(cursor_value(cursor), &row);
+        cursor_advance(cursor);
+        rows++;
+    }
+    free(cursor);
+    return rows;
+}
+
+int
+main(int argc, char *argv[]){
+    YcsbConfig config;
+    parse_ycsb_args(argc, argv, &config);
+    key_search_init();
+
+    Table *table = bench_open_table(config.filename, config.cache_pages, config.durability, config.pager,
+                                    config.page_size);
+    Pager *pager = table->pager;
+    uint64_t state = config.seed;
+    Row row;
+
+    // 装载阶段放在一个事务里, 只提交一次
+    uint64_t start = bench_now_ns();
+    pager->in_transaction = true;
+    for (uint32_t i = 0; i < config.records; i++) {
+        bench_make_row(&row, record_key(&config, i), config.value_length);
+        table_insert(table, &row);
+        pager_unpin_all(pager);
+    }
+    pager->in_transaction = false;
+    pager_commit(pager, true);
+    double load_seconds = (bench_now_ns() - start) / 1e9;
+
+    Zipfian zipfian;
+    zipfian_init(&zipfian, config.records, config.theta);
+    Latencies latencies[OP_COUNT];
+    for (int op = 0; op < OP_COUNT; op++) {
+        latencies[op].samples = malloc(config.ops * sizeof(uint32_t));
+        latencies[op].count = 0;
+    }
+
+    uint32_t inserted = config.records;
+    uint64_t sink = 0;
+    start = bench_now_ns();
+    for (uint32_t i = 0; i < config.ops; i++) {
+        uint32_t dice = bench_random(&state) % 100;
+        OpType op = 0;
+        while (dice >= config.mix[op]) {
+            dice -= config.mix[op];
+            op++;
+        }
+        uint32_t key = op == OP_INSERT ? record_key(&config, inserted++)
+                       : record_key(&config, choose_record(&config, &zipfian, inserted, &state));
+
+        uint64_t op_start = bench_now_ns();
+        switch (op) {
+            case OP_READ:
+                sink += ycsb_read(table, key, &row);
+                break;
+            case OP_UPDATE:
+                ycsb_update(table, key, &config, &state);
+                break;
+            case OP_INSERT:
+                bench_make_row(&row, key, config.value_length);
+                table_insert(table, &row);
+                break;
+            case OP_SCAN:
+                sink += ycsb_scan(table, key, bench_random(&state) % config.scan_length + 1);
+                break;
+            case OP_RMW:
+                if (ycsb_read(table, key, &row)) {
+                    pager_unpin_all(pager);
+                    ycsb_update(table, key, &config, &state);
+                }
+                break;
+            case OP_COUNT:
+                break;
+        }
+        pager_unpin_all(pager);
+        pager_commit(pager, true);
+        uint64_t elapsed = bench_now_ns() - op_start;
+        latencies[op].samples[latencies[op].count++] = elapsed < UINT32_MAX ? elapsed : UINT32_MAX;
+    }
+    double run_seconds = (bench_now_ns() - start) / 1e9;
+    db_close(table);
+
+    const char *distributions[] = {"uniform", "zipfian", "latest"};
+    printf("{\"workload\": \"%s\", \"records\": %u, \"ops\": %u, \"distribution\": \"%s\", \"keys\": \"%s\", \"pager\": \"%s\", \"page_size\": %u, "
+           "\"load_seconds\": %.3f, \"load_ops_per_sec\": %.0f, "
+           "\"run_seconds\": %.3f, \"ops_per_sec\": %.0f",
+           config.workload, config.records, config.ops, distributions[config.distribution],
+           config.random_keys ? "random" : "sequential", config.pager, config.page_size,
+           load_seconds, config.records / load_seconds, run_seconds, config.ops / run_seconds);
+    for (int op = 0; op < OP_COUNT; op++) {
+        Latencies *l = &latencies[op];
+        if (l->count == 0) {
+            continue;
+        }
+        qsort(l->samples, l->count, sizeof(uint32_t), compare_uint32);
+        printf(", \"%s\": {\"count\": %u, \"p50_us\": %.2f, \"p99_us\": %.2f, \"p999_us\": %.2f, \"max_us\": %.2f}",
+               op_names[op], l->count, percentile_us(l, 0.5), percentile_us(l, 0.99),
+               percentile_us(l, 0.999), l->samples[l->count - 1] / 1000.0);
+        free(l->samples);
+    }
+    printf("}\n");
+    if (sink == 0 && config.mix[OP_READ] + config.mix[OP_SCAN] > 0) {
+        fprintf(stderr, "no rows found\n");
+    }
+    return 0;
+}
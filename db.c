@@ -6,21 +6,54 @@
 #include <string.h>
 
 int main(int agc, char* argv[]){
-    if (agc < 2) {
+    DbConfig config;
+    char *filename = parse_args(agc, argv, &config);
+    if (filename == NULL) {
         printf("Must supply a database filename.\n");
         exit(EXIT_FAILURE);
     }
 
-    char *filename = argv[1];
-    Table *table = db_open(filename);
+    key_search_init();
+    Table *table = db_open(filename, &config);
+    if (config.slow_log) {
+        config.slow_log_file = fopen(config.slow_log, "a");
+        if (config.slow_log_file == NULL) {
+            printf("Unable to open slow log '%s'\n", config.slow_log);
+            exit(EXIT_FAILURE);
+        }
+    }
 
     InputBuffer *input_buffer = new_input_buffer();
+    // 批处理模式下输出攒满一大块才写出; 等待输入之前 read_input 会先把它写出
+    // FULL 模式下也不能按行写出, 组提交的确认要留在缓冲区里等 fdatasync (见 output_reserve)
+    if (config.batch || config.durability == DURABILITY_FULL) {
+        setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+    }
     while (true) {
-        print_prompt();
-        read_input(input_buffer);
+        // 没有完整的下一行时 read_input 会写出缓冲的输出
+        output_reserve(table->pager, input_pending(input_buffer) ? 0 : SIZE_MAX);
+        if (!config.batch) {
+            print_prompt();
+        }
+        if (!read_input(input_buffer)) {
+            // 批处理模式下输入结束和 .exit 一样
+            if (config.batch) {
+                close_input_buffer(input_buffer);
+                db_close(table);
+                exit(EXIT_SUCCESS);
+            }
+            printf("Error reading input\n");
+            exit(EXIT_FAILURE);
+        }
+        // 写语句的输出不超过回显的输入加上 OUTPUT_ACK_MAX
+        output_reserve(table->pager, input_buffer->input_length + OUTPUT_ACK_MAX);
 
         if (input_buffer->buffer[0] == '.') {
-            switch (do_meta_command(input_buffer, table)) {
+            output_reserve(table->pager, SIZE_MAX);
+            MetaResult meta_result = do_meta_command(input_buffer, &table, &config);
+            pager_unpin_all(table->pager);
+            pager_commit(table->pager, !input_pending(input_buffer));
+            switch (meta_result) {
                 case META_SUCCESS:
                     continue;
                 case META_UNRECOGNIZED_COMMAND:
@@ -47,9 +80,26 @@ int main(int agc, char* argv[]){
                 continue;
         }
 
-        switch (execute_statement(statement, table)) {
+        // 查询的输出量没有上限, 先让之前的提交落盘
+        if (statement.type == SELECT) {
+            output_reserve(table->pager, SIZE_MAX);
+        }
+        PagerStats before = table->pager->stats;
+        uint64_t start = clock_ns();
+        ExecuteResult execute_result = execute_statement(statement, table);
+        statement_free(&statement);
+        // 语句执行期间固定的页面在语句结束时全部释放
+        pager_unpin_all(table->pager);
+        // 每条语句单独提交; 后面还有已经到达的输入时推迟 fdatasync, 让它们共享一次 (组提交)
+        pager_commit(table->pager, !input_pending(input_buffer));
+        uint64_t elapsed = clock_ns() - start;
+        table->pager->stats.busy_ns += elapsed;
+        statement_report(&config, input_buffer->buffer, &statement, table, &before, &table->pager->stats, elapsed);
+        switch (execute_result) {
             case EXECUTE_SUCCESS:
-                printf("Executed. \n");
+                if (!config.batch) {
+                    printf("Executed. \n");
+                }
                 break;
             case EXECUTE_DUPLICATE_KEY:
                 printf("Error: Duplicate key. \n");
@@ -57,298 +107,3855 @@ int main(int agc, char* argv[]){
             case EXECUTE_TABLE_FLL:
                 printf("Error: tabe full.\n");
                 break;
+            case EXECUTE_IN_TRANSACTION:
+                printf("Error: Already in a transaction.\n");
+                break;
+            case EXECUTE_NO_TRANSACTION:
+                printf("Error: No transaction is active.\n");
+                break;
+            case EXECUTE_INDEX_EXISTS:
+                printf("Error: Index already exists.\n");
+                break;
+            case EXECUTE_NOT_FOUND:
+                printf("Error: No matching rows.\n");
+                break;
+        }
+    }
+}
+
+// 解析命令行参数, 返回数据库文件名
+// 用法: db <filename> [--cache-pages N] [--durability off|normal|full] [--batch]
+//          [--mmap | --direct] [--page-size N] [--threads N] [--slow-log FILE] [--slow-ms N]
+char*
+parse_args(int argc, char *argv[], DbConfig *config){
+    char *filename = NULL;
+    config->cache_pages = PAGER_DEFAULT_FRAMES;
+    config->durability = DURABILITY_NORMAL;
+    config->batch = false;
+    config->scan_threads = 1;
+    config->mmap = false;
+    config->direct = false;
+    config->page_size = DEFAULT_PAGE_SIZE;
+    config->timer = false;
+    config->slow_log = NULL;
+    config->slow_ms = SLOW_LOG_DEFAULT_MS;
+    config->slow_log_file = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--cache-pages") && i + 1 < argc) {
+            config->cache_pages = strtoul(argv[++i], NULL, 10);
+        }else if (!strcmp(argv[i], "--durability") && i + 1 < argc) {
+            char *mode = argv[++i];
+            if (!strcmp(mode, "off")) {
+                config->durability = DURABILITY_OFF;
+            }else if (!strcmp(mode, "normal")) {
+                config->durability = DURABILITY_NORMAL;
+            }else if (!strcmp(mode, "full")) {
+                config->durability = DURABILITY_FULL;
+            }else {
+                printf("Unknown durability '%s'\n", mode);
+                exit(EXIT_FAILURE);
+            }
+        }else if (!strcmp(argv[i], "--batch")) {
+            config->batch = true;
+        }else if (!strcmp(argv[i], "--mmap")) {
+            config->mmap = true;
+        }else if (!strcmp(argv[i], "--direct")) {
+            config->direct = true;
+        }else if (!strcmp(argv[i], "--page-size") && i + 1 < argc) {
+            if (!parse_uint32(argv[++i], &config->page_size) || !page_size_valid(config->page_size)) {
+                printf("Page size must be a power of two between %d and %d.\n", MIN_PAGE_SIZE, MAX_PAGE_SIZE);
+                exit(EXIT_FAILURE);
+            }
+        }else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            config->scan_threads = strtoul(argv[++i], NULL, 10);
+        }else if (!strcmp(argv[i], "--slow-log") && i + 1 < argc) {
+            config->slow_log = argv[++i];
+        }else if (!strcmp(argv[i], "--slow-ms") && i + 1 < argc) {
+            config->slow_ms = strtoul(argv[++i], NULL, 10);
+        }else if (argv[i][0] == '-') {
+            printf("Unknown option '%s'\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }else {
+            filename = argv[i];
+        }
+    }
+
+    if (config->cache_pages < PAGER_MIN_FRAMES) {
+        config->cache_pages = PAGER_MIN_FRAMES;
+    }
+    return filename;
+}
+
+InputBuffer*
+new_input_buffer(){
+    InputBuffer* input_buffer = malloc(sizeof(InputBuffer));
+    input_buffer->buffer = NULL;
+    input_buffer->input_length = 0;
+    input_buffer->data_capacity = INPUT_BUFFER_SIZE;
+    input_buffer->data = malloc(input_buffer->data_capacity);
+    input_buffer->data_start = 0;
+    input_buffer->data_end = 0;
+    return input_buffer;
+}
+
+// 输入缓冲区中是否已经有完整的下一条语句(流水线输入)
+// 不完整的一行不算: 等它的剩余部分时 read_input 会写出缓冲的输出
+bool
+input_pending(InputBuffer *input_buffer){
+    return memchr(input_buffer->data + input_buffer->data_start, '\n',
+                  input_buffer->data_end - input_buffer->data_start) != NULL;
+}
+
+// 打印用户提示符
+void
+print_prompt(){
+    printf("acdb >");
+}
+
+// 打印行中投影的列, 自己拼接整行再一次写出, 不经过 printf 的格式解析
+// 字符串直接从视图指向的页面拷贝到输出行中
+void
+print_row_view(RowView *view, Column *columns, uint32_t num_columns){
+    char line[ROW_LINE_MAX];
+    uint32_t length = format_row_view(line, view, columns, num_columns);
+    fwrite(line, 1, length, stdout);
+}
+
+// 把输出的一行写到 line 中, 返回字节数, 最多 ROW_LINE_MAX
+uint32_t
+format_row_view(char *line, RowView *view, Column *columns, uint32_t num_columns){
+    uint32_t length = 0;
+    line[length++] = '(';
+    for (uint32_t i = 0; i < num_columns; i++) {
+        if (i > 0) {
+            line[length++] = ',';
+            line[length++] = ' ';
+        }
+        switch (columns[i]) {
+            case COLUMN_ID:
+                length += format_uint64(line + length, view->id);
+                break;
+            case COLUMN_USERNAME:
+                memcpy(line + length, view->username, view->username_length);
+                length += view->username_length;
+                break;
+            case COLUMN_EMAIL:
+                memcpy(line + length, view->email, view->email_length);
+                length += view->email_length;
+                break;
+            case COLUMN_COUNT:
+                break;
+        }
+    }
+    line[length++] = ')';
+    line[length++] = '\n';
+    return length;
+}
+
+// 把 value 的十进制表示写到 destination, 返回写入的字节数
+uint32_t
+format_uint64(char *destination, uint64_t value){
+    char digits[20];
+    uint32_t count = 0;
+    do {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    for (uint32_t i = 0; i < count; i++) {
+        destination[i] = digits[count - 1 - i];
+    }
+    return count;
+}
+
+// 128 位的版本, 只用来输出 sum; 先按 10^19 分成不超过 64 位的几段
+uint32_t
+format_uint128(char *destination, unsigned __int128 value){
+    const uint64_t base = 10000000000000000000ULL;
+    if (value < base) {
+        return format_uint64(destination, value);
+    }
+    uint32_t length = format_uint128(destination, value / base);
+    uint64_t low = value % base;
+    for (int i = 18; i >= 0; i--) {
+        destination[length + i] = '0' + low % 10;
+        low /= 10;
+    }
+    return length + 19;
+}
+
+// 从输入中取出下一行, 输入结束时返回 false
+// 缓冲区中没有完整的一行时才调用 read, 每次读入一大块
+bool
+read_input(InputBuffer *input_buffer){
+    while (true) {
+        char *start = input_buffer->data + input_buffer->data_start;
+        size_t available = input_buffer->data_end - input_buffer->data_start;
+        char *newline = memchr(start, '\n', available);
+        if (newline) {
+            // 忽略结尾的换行符
+            *newline = '\0';
+            input_buffer->buffer = start;
+            input_buffer->input_length = newline - start;
+            input_buffer->data_start += input_buffer->input_length + 1;
+            return true;
+        }
+
+        // 把不完整的一行移到开头, 留一个字节给最后一行的 '\0', 一行比缓冲区还长时扩大缓冲区
+        memmove(input_buffer->data, start, available);
+        input_buffer->data_start = 0;
+        input_buffer->data_end = available;
+        if (available + 1 >= input_buffer->data_capacity) {
+            input_buffer->data_capacity *= 2;
+            input_buffer->data = realloc(input_buffer->data, input_buffer->data_capacity);
+        }
+
+        // 可能要阻塞等待输入, 先把已经缓冲的输出交给读者
+        fflush(stdout);
+        ssize_t bytes_read = read(STDIN_FILENO, input_buffer->data + available,
+                                  input_buffer->data_capacity - available - 1);
+        if (bytes_read == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0) {
+            if (available == 0) {
+                return false;
+            }
+            // 最后一行没有换行符
+            input_buffer->data[available] = '\0';
+            input_buffer->buffer = input_buffer->data;
+            input_buffer->input_length = available;
+            input_buffer->data_start = available;
+            return true;
+        }
+        input_buffer->data_end += bytes_read;
+    }
+}
+
+// 关闭input_buffer
+void
+close_input_buffer(InputBuffer *input_buffer){
+    free(input_buffer->data);
+    free(input_buffer);
+}
+
+// 识别原名令; .open 会把 *current 换成新打开的表
+MetaResult
+do_meta_command(InputBuffer *input_buffer, Table **current, DbConfig *config){
+    Table *table = *current;
+    if (strcmp(input_buffer->buffer, ".exit") == 0) {
+        close_input_buffer(input_buffer);
+        db_close(table);
+        exit(EXIT_SUCCESS);
+    }else if (strcmp(input_buffer->buffer, ".constants") == 0) {
+        printf("Constants:\n");
+        print_constants();
+        return META_SUCCESS;
+    }else if (strcmp(input_buffer->buffer, ".btree") == 0) {
+        printf("Tree:\n");
+        print_tree(table->pager, table->root_page_num, 0);
+        for (Column column = COLUMN_USERNAME; column < COLUMN_COUNT; column++) {
+            if (table->index_roots[column] != 0) {
+                printf("Index on %s:\n", COLUMN_NAMES[column]);
+                print_tree(table->pager, table->index_roots[column], 0);
+            }
+        }
+        return META_SUCCESS;
+    }else if (strncmp(input_buffer->buffer, ".open ", 6) == 0) {
+        return do_open(current, config, input_buffer->buffer + 6);
+    }else if (strncmp(input_buffer->buffer, ".import ", 8) == 0) {
+        return do_import(table, input_buffer->buffer + 8);
+    }else if (strcmp(input_buffer->buffer, ".cache") == 0) {
+        print_pager_stats(table->pager);
+        return META_SUCCESS;
+    }else if (strncmp(input_buffer->buffer, ".threads ", 9) == 0) {
+        uint32_t threads;
+        if (!parse_uint32(input_buffer->buffer + 9, &threads) || threads == 0 || threads > MAX_SCAN_THREADS) {
+            printf("Thread count must be between 1 and %d.\n", MAX_SCAN_THREADS);
+        }else {
+            table->scan_threads = threads;
+        }
+        return META_SUCCESS;
+    }else if (strcmp(input_buffer->buffer, ".timer on") == 0) {
+        config->timer = true;
+        return META_SUCCESS;
+    }else if (strcmp(input_buffer->buffer, ".timer off") == 0) {
+        config->timer = false;
+        return META_SUCCESS;
+    }else if (strcmp(input_buffer->buffer, ".stats") == 0) {
+        print_stats(table);
+        return META_SUCCESS;
+    }else if (strcmp(input_buffer->buffer, ".stats reset") == 0) {
+        memset(&table->pager->stats, 0, sizeof(PagerStats));
+        return META_SUCCESS;
+    }else if (strcmp(input_buffer->buffer, ".wal") == 0) {
+        print_wal_stats(table->pager);
+        return META_SUCCESS;
+    }else if (strcmp(input_buffer->buffer, ".checkpoint") == 0) {
+        if (table->pager->in_transaction) {
+            printf("Cannot checkpoint inside a transaction.\n");
+        }else if (table->pager->wal) {
+            pager_commit(table->pager, true);
+            pager_checkpoint(table->pager);
+        }
+        return META_SUCCESS;
+    }else {
+        return META_UNRECOGNIZED_COMMAND;
+    }
+}
+
+// .open FILE [PAGE_SIZE]: 关闭当前的数据库, 打开(或者新建)另一个
+// 页大小只在新建数据库时使用, 已有的数据库以文件头中的页大小为准
+MetaResult
+do_open(Table **table, DbConfig *config, char *args){
+    char *filename = strtok(args, " ");
+    char *page_size = strtok(NULL, " ");
+    DbConfig open_config = *config;
+    if (filename == NULL || strtok(NULL, " ") != NULL) {
+        printf("Usage: .open FILE [PAGE_SIZE]\n");
+        return META_SUCCESS;
+    }
+    if (page_size && (!parse_uint32(page_size, &open_config.page_size) || !page_size_valid(open_config.page_size))) {
+        printf("Page size must be a power of two between %d and %d.\n", MIN_PAGE_SIZE, MAX_PAGE_SIZE);
+        return META_SUCCESS;
+    }
+
+    if ((*table)->pager->in_transaction) {
+        printf("Cannot open another database inside a transaction.\n");
+        return META_SUCCESS;
+    }
+    db_close(*table);
+    *table = db_open(filename, &open_config);
+    return META_SUCCESS;
+}
+
+// 判读语句是否可以执行, 并将可执行的语句类型添加到信息中
+PreapareResult
+preapare_statement(InputBuffer *input_buffer, Statement *statement){
+    Tokenizer tokenizer;
+    tokenizer_init(&tokenizer, input_buffer->buffer);
+    statement->rows = NULL;
+    statement->num_rows = 0;
+    statement->rows_capacity = 0;
+
+    PreapareResult result;
+    if (parser_accept(&tokenizer, "insert")) {
+        result = preapare_insert(&tokenizer, statement);
+    }else if (parser_accept(&tokenizer, "select")) {
+        result = preapare_select(&tokenizer, statement);
+    }else if (parser_accept(&tokenizer, "delete")) {
+        result = preapare_delete(&tokenizer, statement);
+    }else if (parser_accept(&tokenizer, "update")) {
+        result = preapare_update(&tokenizer, statement);
+    }else if (parser_accept(&tokenizer, "begin")) {
+        statement->type = BEGIN;
+        result = PREPARE_SUCCESS;
+    }else if (parser_accept(&tokenizer, "commit")) {
+        statement->type = COMMIT;
+        result = PREPARE_SUCCESS;
+    }else if (parser_accept(&tokenizer, "create")) {
+        result = preapare_create_index(&tokenizer, statement);
+    }else {
+        return PREPARE_UNRECOGNIZED_STATEMENT;
+    }
+
+    // 语句可以以分号结束, 之后不能再有其他内容
+    if (result == PREPARE_SUCCESS) {
+        parser_accept_symbol(&tokenizer, ';');
+        if (tokenizer.token.type != TOKEN_END) {
+            result = PREPARE_SYNTAX_ERROR;
+        }
+    }
+    if (result != PREPARE_SUCCESS) {
+        statement_free(statement);
+    }
+    return result;
+}
+
+void
+statement_free(Statement *statement){
+    free(statement->rows);
+    statement->rows = NULL;
+    statement->num_rows = 0;
+    statement->rows_capacity = 0;
+}
+
+void
+tokenizer_init(Tokenizer *tokenizer, const char *input){
+    tokenizer->input = input;
+    tokenizer->position = 0;
+    tokenizer_advance(tokenizer);
+}
+
+// 读取下一个词法单元到 tokenizer->token
+void
+tokenizer_advance(Tokenizer *tokenizer){
+    const char *input = tokenizer->input;
+    uint32_t position = tokenizer->position;
+    Token *token = &tokenizer->token;
+    token->length = 0;
+
+    while (input[position] == ' ' || input[position] == '\t' || input[position] == '\r') {
+        position++;
+    }
+
+    char c = input[position];
+    if (c == '\0') {
+        token->type = TOKEN_END;
+    }else if (strchr("(),=;*", c)) {
+        token->type = TOKEN_SYMBOL;
+        token->text[token->length++] = c;
+        position++;
+    }else if (c == '\'') {
+        token->type = TOKEN_ERROR;
+        position++;
+        while (input[position] != '\0') {
+            if (input[position] == '\'') {
+                if (input[position + 1] != '\'') {
+                    token->type = TOKEN_STRING;
+                    position++;
+                    break;
+                }
+                position++; // 两个单引号表示一个单引号
+            }
+            if (token->length < TOKEN_MAX_LENGTH) {
+                token->text[token->length] = input[position];
+            }
+            token->length++;
+            position++;
+        }
+    }else {
+        token->type = TOKEN_WORD;
+        while (input[position] != '\0' && !strchr(" \t\r(),=;*'", input[position])) {
+            if (token->length < TOKEN_MAX_LENGTH) {
+                token->text[token->length] = input[position];
+            }
+            token->length++;
+            position++;
+        }
+    }
+
+    token->text[token->length < TOKEN_MAX_LENGTH ? token->length : TOKEN_MAX_LENGTH] = '\0';
+    tokenizer->position = position;
+}
+
+// 关键字不区分大小写
+bool
+token_is(Token *token, const char *keyword){
+    return token->type == TOKEN_WORD && !strcasecmp(token->text, keyword);
+}
+
+bool
+token_is_symbol(Token *token, char symbol){
+    return token->type == TOKEN_SYMBOL && token->text[0] == symbol;
+}
+
+// 当前词法单元是给定的关键字时消耗掉它并返回 true
+bool
+parser_accept(Tokenizer *tokenizer, const char *keyword){
+    if (token_is(&tokenizer->token, keyword)) {
+        tokenizer_advance(tokenizer);
+        return true;
+    }
+    return false;
+}
+
+bool
+parser_accept_symbol(Tokenizer *tokenizer, char symbol){
+    if (token_is_symbol(&tokenizer->token, symbol)) {
+        tokenizer_advance(tokenizer);
+        return true;
+    }
+    return false;
+}
+
+// 读取一个无符号整数, 负数、超出范围和不是数字的内容都是错误
+PreapareResult
+parser_uint32(Tokenizer *tokenizer, uint32_t *value){
+    Token *token = &tokenizer->token;
+    if (token->type != TOKEN_WORD || token->length > TOKEN_MAX_LENGTH) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (token->text[0] == '-' && parse_uint32(token->text + 1, value)) {
+        return PREPARE_NEGATIVE_ID;
+    }
+    if (!parse_uint32(token->text, value)) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    tokenizer_advance(tokenizer);
+    return PREPARE_SUCCESS;
+}
+
+// 和 parser_uint32 一样, 用于 64 位的主键
+PreapareResult
+parser_uint64(Tokenizer *tokenizer, uint64_t *value){
+    Token *token = &tokenizer->token;
+    if (token->type != TOKEN_WORD || token->length > TOKEN_MAX_LENGTH) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (token->text[0] == '-' && parse_uint64(token->text + 1, value)) {
+        return PREPARE_NEGATIVE_ID;
+    }
+    if (!parse_uint64(token->text, value)) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    tokenizer_advance(tokenizer);
+    return PREPARE_SUCCESS;
+}
+
+// 读取一个带引号或者不带引号的值
+PreapareResult
+parser_string(Tokenizer *tokenizer, char *destination, uint32_t max_length){
+    Token *token = &tokenizer->token;
+    if (token->type != TOKEN_WORD && token->type != TOKEN_STRING) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (token->length > max_length) {
+        return PREPARE_STRING_TOO_LONG;
+    }
+    memcpy(destination, token->text, token->length + 1);
+    tokenizer_advance(tokenizer);
+    return PREPARE_SUCCESS;
+}
+
+// 读取一行: id username email, 在 values 中是 (id, username, email)
+PreapareResult
+parser_row(Tokenizer *tokenizer, Row *row, bool parenthesized){
+    PreapareResult result;
+    if (parenthesized && !parser_accept_symbol(tokenizer, '(')) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if ((result = parser_uint64(tokenizer, &row->id)) != PREPARE_SUCCESS) {
+        return result;
+    }
+    if (parenthesized && !parser_accept_symbol(tokenizer, ',')) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if ((result = parser_string(tokenizer, row->username, COLUMN_USERNAME_SIZE)) != PREPARE_SUCCESS) {
+        return result;
+    }
+    if (parenthesized && !parser_accept_symbol(tokenizer, ',')) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if ((result = parser_string(tokenizer, row->email, COLUMN_EMAIL_SIZE)) != PREPARE_SUCCESS) {
+        return result;
+    }
+    if (parenthesized && !parser_accept_symbol(tokenizer, ')')) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    return PREPARE_SUCCESS;
+}
+
+// 在 insert 语句的行数组末尾追加一行, 空间不够时加倍
+Row*
+statement_add_row(Statement *statement){
+    if (statement->num_rows == statement->rows_capacity) {
+        statement->rows_capacity = statement->rows_capacity ? statement->rows_capacity * 2 : 1;
+        statement->rows = realloc(statement->rows, statement->rows_capacity * sizeof(Row));
+    }
+    return &statement->rows[statement->num_rows++];
+}
+
+// insert id username email
+// insert values (id, 'username', 'email'), (id, 'username', 'email'), ...
+PreapareResult
+preapare_insert(Tokenizer *tokenizer, Statement *statement){
+    statement->type = INSERT;
+
+    if (!parser_accept(tokenizer, "values")) {
+        return parser_row(tokenizer, statement_add_row(statement), false);
+    }
+    do {
+        PreapareResult result = parser_row(tokenizer, statement_add_row(statement), true);
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+    } while (parser_accept_symbol(tokenizer, ','));
+    return PREPARE_SUCCESS;
+}
+
+// select [where id = N | where id between A and B | where username/email = X] [limit N]
+PreapareResult
+preapare_select(Tokenizer *tokenizer, Statement *statement){
+    statement->type = SELECT;
+    statement->key_low = 0;
+    statement->key_high = UINT64_MAX;
+    statement->where_column = COLUMN_ID;
+    statement->limit = UINT32_MAX;
+
+    if (preapare_columns(tokenizer, statement) != PREPARE_SUCCESS) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (parser_accept(tokenizer, "where") && preapare_where(tokenizer, statement) != PREPARE_SUCCESS) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (parser_accept(tokenizer, "limit") && parser_uint32(tokenizer, &statement->limit) != PREPARE_SUCCESS) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    return PREPARE_SUCCESS;
+}
+
+// select 之后的投影: 省略或者 * 表示所有列, 否则是逗号分隔的列名, 每列最多出现一次
+PreapareResult
+preapare_columns(Tokenizer *tokenizer, Statement *statement){
+    statement->num_columns = 0;
+    statement->num_aggregates = 0;
+    if (tokenizer->token.type == TOKEN_END || parser_accept_symbol(tokenizer, '*')
+            || token_is(&tokenizer->token, "where") || token_is(&tokenizer->token, "limit")) {
+        for (uint32_t i = 0; i < COLUMN_COUNT; i++) {
+            statement->columns[statement->num_columns++] = i;
+        }
+        return PREPARE_SUCCESS;
+    }
+
+    const char *aggregate_names[AGGREGATE_KINDS] = {"count", "min", "max", "sum", "avg"};
+    uint32_t seen = 0;
+    do {
+        // 聚合函数和普通的列不能混用
+        Aggregate aggregate = 0;
+        while (aggregate < AGGREGATE_KINDS && !token_is(&tokenizer->token, aggregate_names[aggregate])) {
+            aggregate++;
+        }
+        if (aggregate < AGGREGATE_KINDS) {
+            if (statement->num_columns > 0 || statement->num_aggregates == MAX_AGGREGATES) {
+                return PREPARE_SYNTAX_ERROR;
+            }
+            tokenizer_advance(tokenizer);
+            if (preapare_aggregate(tokenizer, statement, aggregate) != PREPARE_SUCCESS) {
+                return PREPARE_SYNTAX_ERROR;
+            }
+            continue;
+        }
+        if (statement->num_aggregates > 0) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+
+        Column column = 0;
+        while (column < COLUMN_COUNT && !token_is(&tokenizer->token, COLUMN_NAMES[column])) {
+            column++;
+        }
+        if (column == COLUMN_COUNT || (seen & (1 << column))) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        seen |= 1 << column;
+        statement->columns[statement->num_columns++] = column;
+        tokenizer_advance(tokenizer);
+    } while (parser_accept_symbol(tokenizer, ','));
+    return PREPARE_SUCCESS;
+}
+
+// 聚合函数的参数: count(*) 或者 count(列), 其他的只能是 id
+PreapareResult
+preapare_aggregate(Tokenizer *tokenizer, Statement *statement, Aggregate aggregate){
+    if (!parser_accept_symbol(tokenizer, '(')) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    bool valid = parser_accept(tokenizer, "id");
+    if (!valid && aggregate == AGGREGATE_COUNT) {
+        valid = parser_accept_symbol(tokenizer, '*') || parser_accept(tokenizer, "username")
+                || parser_accept(tokenizer, "email");
+    }
+    if (!valid || !parser_accept_symbol(tokenizer, ')')) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    statement->aggregates[statement->num_aggregates++] = aggregate;
+    return PREPARE_SUCCESS;
+}
+
+// delete [where id = N | where id between A and B]
+PreapareResult
+preapare_delete(Tokenizer *tokenizer, Statement *statement){
+    statement->type = DELETE;
+    statement->key_low = 0;
+    statement->key_high = UINT64_MAX;
+    statement->where_column = COLUMN_ID;
+
+    if (parser_accept(tokenizer, "where") && (preapare_where(tokenizer, statement) != PREPARE_SUCCESS
+                                              || statement->where_column != COLUMN_ID)) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    return PREPARE_SUCCESS;
+}
+
+// update set username = X [,] email = Y where id = N
+PreapareResult
+preapare_update(Tokenizer *tokenizer, Statement *statement){
+    statement->type = UPDATE;
+    statement->set_username = false;
+    statement->set_email = false;
+    statement->where_column = COLUMN_ID;
+
+    if (!parser_accept(tokenizer, "set")) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    // 逐个解析 列 = 值, 直到遇到 where
+    while (!parser_accept(tokenizer, "where")) {
+        PreapareResult result;
+        if (parser_accept(tokenizer, "username")) {
+            if (!parser_accept_symbol(tokenizer, '=')) {
+                return PREPARE_SYNTAX_ERROR;
+            }
+            result = parser_string(tokenizer, statement->row_to_update.username, COLUMN_USERNAME_SIZE);
+            statement->set_username = true;
+        }else if (parser_accept(tokenizer, "email")) {
+            if (!parser_accept_symbol(tokenizer, '=')) {
+                return PREPARE_SYNTAX_ERROR;
+            }
+            result = parser_string(tokenizer, statement->row_to_update.email, COLUMN_EMAIL_SIZE);
+            statement->set_email = true;
+        }else {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+        parser_accept_symbol(tokenizer, ',');
+    }
+
+    // 只支持按主键修改一行
+    if (!(statement->set_username || statement->set_email)
+            || preapare_where(tokenizer, statement) != PREPARE_SUCCESS
+            || statement->where_column != COLUMN_ID || statement->key_low != statement->key_high) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    return PREPARE_SUCCESS;
+}
+
+// 解析 where 之后的条件: id = N, id between A and B, 或者 username/email = X
+// 比较的值最长按 email 解析, 比 username 的上限长的值只是找不到任何行
+PreapareResult
+preapare_where(Tokenizer *tokenizer, Statement *statement){
+    for (Column column = COLUMN_USERNAME; column < COLUMN_COUNT; column++) {
+        if (parser_accept(tokenizer, COLUMN_NAMES[column])) {
+            statement->where_column = column;
+            if (!parser_accept_symbol(tokenizer, '=')) {
+                return PREPARE_SYNTAX_ERROR;
+            }
+            return parser_string(tokenizer, statement->where_value, COLUMN_EMAIL_SIZE);
+        }
+    }
+    if (!parser_accept(tokenizer, "id")) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    if (parser_accept_symbol(tokenizer, '=')) {
+        if (parser_uint64(tokenizer, &statement->key_low) != PREPARE_SUCCESS) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        statement->key_high = statement->key_low;
+    }else if (parser_accept(tokenizer, "between")) {
+        if (parser_uint64(tokenizer, &statement->key_low) != PREPARE_SUCCESS
+                || !parser_accept(tokenizer, "and")
+                || parser_uint64(tokenizer, &statement->key_high) != PREPARE_SUCCESS) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+    }else {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    return PREPARE_SUCCESS;
+}
+
+// 解析一个无符号的十进制整数, 必须整个字符串都是数字且不超过 uint32_t
+bool
+parse_uint32(const char *str, uint32_t *value){
+    uint64_t result;
+    if (!parse_uint64(str, &result) || result > UINT32_MAX) {
+        return false;
+    }
+    *value = result;
+    return true;
+}
+
+// 同上, 不超过 uint64_t
+bool
+parse_uint64(const char *str, uint64_t *value){
+    if (str == NULL || *str < '0' || *str > '9') {
+        return false;
+    }
+
+    char *end;
+    errno = 0;
+    unsigned long long result = strtoull(str, &end, 10);
+    if (*end != '\0' || errno == ERANGE) {
+        return false;
+    }
+    *value = result;
+    return true;
+}
+
+// create index on username|email
+PreapareResult
+preapare_create_index(Tokenizer *tokenizer, Statement *statement){
+    statement->type = CREATE_INDEX;
+    if (!parser_accept(tokenizer, "index") || !parser_accept(tokenizer, "on")) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    // id 是主键, 不需要二级索引
+    for (Column column = COLUMN_USERNAME; column < COLUMN_COUNT; column++) {
+        if (parser_accept(tokenizer, COLUMN_NAMES[column])) {
+            statement->index_column = column;
+            return PREPARE_SUCCESS;
+        }
+    }
+    return PREPARE_SYNTAX_ERROR;
+}
+
+ExecuteResult
+execute_statement(Statement statement, Table *table){
+    switch (statement.type) {
+        case INSERT:
+            return execute_insert(statement, table);
+        case SELECT:
+            return execute_select(statement, table);
+        case DELETE:
+            return execute_delete(statement, table);
+        case UPDATE:
+            return execute_update(statement, table);
+        case BEGIN:
+            return execute_begin(statement, table);
+        case COMMIT:
+            return execute_commit(statement, table);
+        case CREATE_INDEX:
+            return execute_create_index(statement, table);
+    }
+}
+
+// 向表中插入数据, 多行时按顺序逐行插入, 遇到重复的键时停止, 之前的行保留
+ExecuteResult
+execute_insert(Statement statement, Table *table){
+    for (uint32_t i = 0; i < statement.num_rows; i++) {
+        ExecuteResult result = table_insert(table, &statement.rows[i]);
+        // 每行插入时固定的页面立即释放, 大的语句不会占满缓冲池
+        pager_unpin_all(table->pager);
+        if (result != EXECUTE_SUCCESS) {
+            return result;
+        }
+    }
+    return EXECUTE_SUCCESS;
+}
+
+// 插入一行
+// 键比表中所有的键都大时直接追加到最右边的叶节点, 否则从根节点下降查找位置
+ExecuteResult
+table_insert(Table *table, Row *row){
+    uint64_t key_to_insert = row->id;
+    Cursor *cursor = table_append_cursor(table, key_to_insert);
+
+    if (cursor == NULL) {
+        cursor = table_find(table, key_to_insert);
+
+        void *node = get_page(table->pager, cursor->page_num);
+        uint32_t num_cells = *leaf_node_num_cells(node);
+        if (cursor->cell_num < num_cells) {
+            uint64_t key_at_index = *leaf_node_key(node, cursor->cell_num);
+            if (key_at_index == key_to_insert) {
+                free(cursor);
+                return EXECUTE_DUPLICATE_KEY;
+            }
+        }
+        // 下降到了最右边的叶节点, 记下它供之后的顺序插入使用
+        if (*leaf_node_next_leaf(node) == 0) {
+            table->append_page_num = cursor->page_num;
+        }
+    }
+
+    leaf_node_insert(cursor, row->id, row);
+    free(cursor);
+
+    RowView view = {row->id, row->username, strlen(row->username), row->email, strlen(row->email)};
+    index_insert_row(table, &view);
+    return EXECUTE_SUCCESS;
+}
+
+// 键大于最右边叶节点中最大的键时, 返回指向该叶节点末尾的游标, 否则返回 NULL
+// 只有最右边的叶节点没有右兄弟, 所以它分裂或者根节点分裂之后这里的检查自然失效
+Cursor*
+table_append_cursor(Table *table, uint64_t key){
+    uint32_t page_num = table->append_page_num;
+    if (page_num == INVALID_PAGE_NUM) {
+        return NULL;
+    }
+
+    void *node = get_page(table->pager, page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    if (get_node_type(node) != NODE_LEAF || *leaf_node_next_leaf(node) != 0
+            || (num_cells > 0 && key <= *leaf_node_key(node, num_cells - 1))) {
+        pager_unpin(table->pager, page_num);
+        return NULL;
+    }
+
+    Cursor *cursor = malloc(sizeof(Cursor));
+    cursor->table = table;
+    cursor->page_num = page_num;
+    cursor->cell_num = num_cells;
+    cursor->end_of_table = false;
+    cursor->readahead.parent_page_num = INVALID_PAGE_NUM;
+    cursor->readahead.window = 0;
+    return cursor;
+}
+
+// 使用游标来读取表，每循环一次游标推进1
+// 用 table_seek 定位到范围的下界, 超过上界或者达到 limit 就停止
+ExecuteResult
+execute_select(Statement statement, Table *table){
+    if (statement.where_column != COLUMN_ID) {
+        return execute_value_select(&statement, table);
+    }
+    if (statement.num_aggregates > 0) {
+        return execute_aggregate(statement, table);
+    }
+    // 有 limit 时只需要范围开头的几行, 不值得并行
+    if (table->scan_threads > 1 && statement.limit == UINT32_MAX && execute_parallel_scan(&statement, table)) {
+        return EXECUTE_SUCCESS;
+    }
+    Cursor* cursor = table_seek(table, statement.key_low);
+
+    // 只投影 id 时不需要访问单元格
+    bool need_value = false;
+    for (uint32_t i = 0; i < statement.num_columns; i++) {
+        need_value |= statement.columns[i] != COLUMN_ID;
+    }
+
+    RowView view;
+    uint32_t rows = 0;
+    uint32_t scanned = 0;
+    while (!(cursor->end_of_table) && rows < statement.limit) {
+        view.id = cursor_key(cursor);
+        scanned++;
+        if (view.id > statement.key_high) {
+            break;
+        }
+        if (need_value) {
+            cursor_row_view(cursor, &view);
+        }
+        print_row_view(&view, statement.columns, statement.num_columns);
+        cursor_advance(cursor);
+        rows++;
+    }
+
+    table->pager->stats.rows_scanned += scanned;
+    table->pager->stats.rows_returned += rows;
+    free(cursor);
+    return EXECUTE_SUCCESS;
+}
+
+// 聚合只使用键, 不访问单元格:
+// 只有 min/max 时各自下降一次, min 是范围下界处的第一个键, max 是不超过上界的最大键;
+// 有 count/sum/avg 时沿叶节点链表走过范围, count 直接累加 num_cells, sum 在连续的键数组上循环
+ExecuteResult
+execute_aggregate(Statement statement, Table *table){
+    Pager *pager = table->pager;
+    bool need_walk = false, need_sum = false;
+    for (uint32_t i = 0; i < statement.num_aggregates; i++) {
+        Aggregate aggregate = statement.aggregates[i];
+        need_walk |= aggregate == AGGREGATE_COUNT || aggregate == AGGREGATE_SUM || aggregate == AGGREGATE_AVG;
+        need_sum |= aggregate == AGGREGATE_SUM || aggregate == AGGREGATE_AVG;
+    }
+    if (need_walk && table->scan_threads > 1 && execute_parallel_scan(&statement, table)) {
+        return EXECUTE_SUCCESS;
+    }
+
+    uint64_t count = 0, min_key = 0, max_key = 0;
+    unsigned __int128 sum = 0;
+    Cursor *cursor = table_seek(table, statement.key_low);
+    bool found = !cursor->end_of_table && cursor_key(cursor) <= statement.key_high;
+    if (found) {
+        min_key = cursor_key(cursor);
+    }
+
+    if (found && need_walk) {
+        uint32_t page_num = cursor->page_num;
+        uint32_t start = cursor->cell_num;
+        Readahead readahead = {INVALID_PAGE_NUM, 0, 0};
+        while (true) {
+            void *node = get_page(pager, page_num);
+            uint32_t num_cells = *leaf_node_num_cells(node);
+            uint64_t *keys = leaf_node_key(node, 0);
+            // 整个叶节点都在范围内时不需要查找
+            uint32_t end = num_cells == 0 || keys[num_cells - 1] <= statement.key_high ? num_cells
+                                                                     : leaf_node_upper_bound(node, statement.key_high);
+            count += end - start;
+            if (need_sum) {
+                for (uint32_t i = start; i < end; i++) {
+                    sum += keys[i];
+                }
+            }
+            if (end > start) {
+                max_key = keys[end - 1];
+            }
+
+            uint32_t next_page_num = *leaf_node_next_leaf(node);
+            pager_unpin(pager, page_num);
+            if (end < num_cells || next_page_num == 0) {
+                break;
+            }
+            page_num = next_page_num;
+            start = 0;
+            leaf_readahead(pager, page_num, &readahead);
+        }
+    }else if (found) {
+        table_max_key(table, table->root_page_num, statement.key_high, &max_key);
+    }
+    free(cursor);
+
+    print_aggregates(&statement, found, count, sum, min_key, max_key);
+    pager->stats.rows_returned++;
+    return EXECUTE_SUCCESS;
+}
+
+// 输出聚合的结果, 空范围上 count 为 0, 其他的聚合为 NULL
+void
+print_aggregates(Statement *statement, bool found, uint64_t count, unsigned __int128 sum, uint64_t min_key, uint64_t max_key){
+    char line[MAX_AGGREGATES * 42 + 4]; // 128 位的 sum 最长 39 位
+    uint32_t length = 0;
+    line[length++] = '(';
+    for (uint32_t i = 0; i < statement->num_aggregates; i++) {
+        if (i > 0) {
+            line[length++] = ',';
+            line[length++] = ' ';
+        }
+        Aggregate aggregate = statement->aggregates[i];
+        if (aggregate == AGGREGATE_COUNT) {
+            length += format_uint64(line + length, count);
+        }else if (!found) {
+            length += sprintf(line + length, "NULL");
+        }else if (aggregate == AGGREGATE_MIN) {
+            length += format_uint64(line + length, min_key);
+        }else if (aggregate == AGGREGATE_MAX) {
+            length += format_uint64(line + length, max_key);
+        }else if (aggregate == AGGREGATE_SUM) {
+            length += format_uint128(line + length, sum);
+        }else {
+            length += sprintf(line + length, "%.2f", (double)sum / count);
+        }
+    }
+    line[length++] = ')';
+    line[length++] = '\n';
+    fwrite(line, 1, length, stdout);
+}
+
+/*
+ * 并行扫描: 从根节点向下按内部节点的边界把范围内的子树切成单元, 直到单元数达到线程数的
+ * PARALLEL_MORSELS_PER_THREAD 倍或者到了叶节点。每个线程先分到一段连续的单元, 做完之后
+ * 从别的线程的队列尾部偷。主线程按单元的顺序等待并写出行, 所以输出和单线程扫描一样按键排序;
+ * 聚合时等所有单元完成再合并。返回 false 表示树太小, 由调用者单线程扫描
+ */
+bool
+execute_parallel_scan(Statement *statement, Table *table){
+    Pager *pager = table->pager;
+    uint32_t num_threads = table->scan_threads;
+    uint32_t *pages;
+    bool aggregate = statement->num_aggregates > 0;
+    uint32_t target = num_threads * (aggregate ? PARALLEL_MORSELS_PER_THREAD : PARALLEL_OUTPUT_MORSELS_PER_THREAD);
+    uint32_t num_morsels = parallel_scan_collect(table, statement, target, &pages);
+    if (num_morsels < 2) {
+        free(pages);
+        return false;
+    }
+    if (num_threads > num_morsels) {
+        num_threads = num_morsels;
+    }
+    // 每个线程同时固定着从单元的根到叶节点的一条路径, 缓冲池很小时减少线程数; 映射模式下没有这个限制
+    if (!pager->mmap && num_threads > pager->num_frames / MAX_TREE_HEIGHT) {
+        num_threads = pager->num_frames / MAX_TREE_HEIGHT > 0 ? pager->num_frames / MAX_TREE_HEIGHT : 1;
+    }
+
+    ParallelScan scan;
+    scan.table = table;
+    scan.statement = statement;
+    scan.aggregate = aggregate;
+    scan.need_value = false;
+    for (uint32_t i = 0; i < statement->num_columns && !scan.aggregate; i++) {
+        scan.need_value |= statement->columns[i] != COLUMN_ID;
+    }
+    scan.need_sum = false;
+    for (uint32_t i = 0; i < statement->num_aggregates; i++) {
+        scan.need_sum |= statement->aggregates[i] == AGGREGATE_SUM || statement->aggregates[i] == AGGREGATE_AVG;
+    }
+    scan.num_morsels = num_morsels;
+    scan.morsels = calloc(num_morsels, sizeof(Morsel));
+    for (uint32_t i = 0; i < num_morsels; i++) {
+        scan.morsels[i].page_num = pages[i];
+    }
+    free(pages);
+    scan.num_threads = num_threads;
+    scan.queues = malloc(num_threads * sizeof(MorselQueue));
+    for (uint32_t i = 0; i < num_threads; i++) {
+        pthread_mutex_init(&scan.queues[i].lock, NULL);
+        scan.queues[i].head = (uint64_t)num_morsels * i / num_threads;
+        scan.queues[i].tail = (uint64_t)num_morsels * (i + 1) / num_threads;
+    }
+    pthread_mutex_init(&scan.lock, NULL);
+    pthread_cond_init(&scan.done_cond, NULL);
+    scan.next_morsel = 0;
+    scan.written = 0;
+    scan.window = num_threads * PARALLEL_OUTPUT_WINDOW;
+    pthread_cond_init(&scan.written_cond, NULL);
+
+    pthread_t threads[MAX_SCAN_THREADS];
+    ScanWorker workers[MAX_SCAN_THREADS];
+    for (uint32_t i = 0; i < num_threads; i++) {
+        workers[i].scan = &scan;
+        workers[i].worker = i;
+        if (pthread_create(&threads[i], NULL, parallel_scan_worker, &workers[i]) != 0) {
+            printf("Unable to start scan thread: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // 按顺序写出每个单元的行, 后面已经完成的单元(最多 window 个)的输出先留在内存中
+    uint64_t count = 0, min_key = 0, max_key = 0;
+    unsigned __int128 sum = 0;
+    bool found = false;
+    for (uint32_t i = 0; i < num_morsels; i++) {
+        Morsel *morsel = &scan.morsels[i];
+        pthread_mutex_lock(&scan.lock);
+        while (!morsel->done) {
+            pthread_cond_wait(&scan.done_cond, &scan.lock);
+        }
+        pthread_mutex_unlock(&scan.lock);
+
+        // 聚合的单元没有输出, output 是 NULL
+        if (morsel->output_length > 0) {
+            fwrite(morsel->output, 1, morsel->output_length, stdout);
+        }
+        free(morsel->output);
+        pthread_mutex_lock(&scan.lock);
+        scan.written = i + 1;
+        pthread_cond_broadcast(&scan.written_cond);
+        pthread_mutex_unlock(&scan.lock);
+        if (morsel->count > 0) {
+            if (!found) {
+                min_key = morsel->min_key;
+            }
+            max_key = morsel->max_key;
+            found = true;
+        }
+        count += morsel->count;
+        sum += morsel->sum;
+    }
+    for (uint32_t i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    for (uint32_t i = 0; i < num_threads; i++) {
+        pthread_mutex_destroy(&scan.queues[i].lock);
+    }
+    pthread_mutex_destroy(&scan.lock);
+    pthread_cond_destroy(&scan.done_cond);
+    pthread_cond_destroy(&scan.written_cond);
+    free(scan.queues);
+    free(scan.morsels);
+
+    pager->stats.rows_scanned += count;
+    if (scan.aggregate) {
+        print_aggregates(statement, found, count, sum, min_key, max_key);
+        pager->stats.rows_returned++;
+    }else {
+        pager->stats.rows_returned += count;
+    }
+    return true;
+}
+
+// 按键的顺序收集和 [key_low, key_high] 相交的子树, 逐层展开直到不少于 target 个或者到了叶节点
+// 孩子 i 中的键都在 (key[i-1], key[i]] 中, 据此跳过范围之外的孩子
+uint32_t
+parallel_scan_collect(Table *table, Statement *statement, uint32_t target, uint32_t **pages){
+    Pager *pager = table->pager;
+    uint32_t num_pages = 1;
+    *pages = malloc(sizeof(uint32_t));
+    (*pages)[0] = table->root_page_num;
+
+    while (num_pages > 0 && num_pages < target) {
+        void *first = get_page(pager, (*pages)[0]);
+        bool leaves = get_node_type(first) == NODE_LEAF;
+        pager_unpin(pager, (*pages)[0]);
+        if (leaves) {
+            break;
+        }
+
+        uint32_t *children = malloc(num_pages * (INTERNAL_NODE_MAX_KEYS + 1) * sizeof(uint32_t));
+        uint32_t num_children = 0;
+        for (uint32_t i = 0; i < num_pages; i++) {
+            void *node = get_page(pager, (*pages)[i]);
+            uint32_t num_keys = *internal_node_num_keys(node);
+            for (uint32_t j = 0; j <= num_keys; j++) {
+                bool below = j < num_keys && *internal_node_key(node, j) < statement->key_low;
+                bool above = j > 0 && *internal_node_key(node, j - 1) >= statement->key_high;
+                if (!below && !above) {
+                    children[num_children++] = *internal_node_child(node, j);
+                }
+            }
+            pager_unpin(pager, (*pages)[i]);
+        }
+        free(*pages);
+        *pages = children;
+        num_pages = num_children;
+    }
+    return num_pages;
+}
+
+void*
+parallel_scan_worker(void *arg){
+    ScanWorker *worker = arg;
+    ParallelScan *scan = worker->scan;
+    int32_t morsel_num;
+    while ((morsel_num = parallel_scan_next(scan, worker->worker)) != -1) {
+        Morsel *morsel = &scan->morsels[morsel_num];
+        parallel_scan_subtree(scan, morsel, morsel->page_num);
+
+        pthread_mutex_lock(&scan->lock);
+        morsel->done = true;
+        pthread_cond_broadcast(&scan->done_cond);
+        pthread_mutex_unlock(&scan->lock);
+    }
+    return NULL;
+}
+
+// 下一个要扫描的单元, 都领完了返回 -1
+// 聚合: 先取自己队列的头部, 空了再从其他线程的队列尾部偷。输出行: 所有线程按顺序领取,
+// 领先写出的位置 window 个单元时等待主线程写出, 不会把整个结果集都缓冲在内存中
+int32_t
+parallel_scan_next(ParallelScan *scan, uint32_t worker){
+    if (!scan->aggregate) {
+        int32_t morsel_num = -1;
+        pthread_mutex_lock(&scan->lock);
+        while (scan->next_morsel < scan->num_morsels && scan->next_morsel >= scan->written + scan->window) {
+            pthread_cond_wait(&scan->written_cond, &scan->lock);
+        }
+        if (scan->next_morsel < scan->num_morsels) {
+            morsel_num = scan->next_morsel++;
+        }
+        pthread_mutex_unlock(&scan->lock);
+        return morsel_num;
+    }
+    for (uint32_t i = 0; i < scan->num_threads; i++) {
+        MorselQueue *queue = &scan->queues[(worker + i) % scan->num_threads];
+        int32_t morsel_num = -1;
+        pthread_mutex_lock(&queue->lock);
+        if (queue->head < queue->tail) {
+            morsel_num = i == 0 ? queue->head++ : --queue->tail;
+        }
+        pthread_mutex_unlock(&queue->lock);
+        if (morsel_num != -1) {
+            return morsel_num;
+        }
+    }
+    return -1;
+}
+
+// 按键的顺序扫描一棵子树, 跳过范围之外的孩子
+void
+parallel_scan_subtree(ParallelScan *scan, Morsel *morsel, uint32_t page_num){
+    Pager *pager = scan->table->pager;
+    Statement *statement = scan->statement;
+    void *node = get_page_shared(pager, page_num);
+    if (get_node_type(node) == NODE_LEAF) {
+        parallel_scan_leaf(scan, morsel, node);
+    }else {
+        uint32_t num_keys = *internal_node_num_keys(node);
+        // 孩子是叶节点时先预读范围内所有的孩子
+        void *first_child = get_page_shared(pager, *internal_node_child(node, 0));
+        bool leaf_children = get_node_type(first_child) == NODE_LEAF;
+        pager_unpin_shared(pager, *internal_node_child(node, 0));
+        if (leaf_children) {
+            uint32_t *children = malloc((num_keys + 1) * sizeof(uint32_t));
+            uint32_t num_children = 0;
+            for (uint32_t i = 0; i <= num_keys; i++) {
+                bool below = i < num_keys && *internal_node_key(node, i) < statement->key_low;
+                bool above = i > 0 && *internal_node_key(node, i - 1) >= statement->key_high;
+                if (!below && !above) {
+                    children[num_children++] = *internal_node_child(node, i);
+                }
+            }
+            // O_DIRECT 模式下预读会把页面装进缓冲池, 要持写锁
+            if (pager->direct) {
+                pthread_rwlock_wrlock(&pager->lock);
+            }else {
+                pthread_rwlock_rdlock(&pager->lock);
+            }
+            pager_prefetch(pager, children, num_children);
+            pthread_rwlock_unlock(&pager->lock);
+            free(children);
+        }
+        for (uint32_t i = 0; i <= num_keys; i++) {
+            if (i < num_keys && *internal_node_key(node, i) < statement->key_low) {
+                continue;
+            }
+            parallel_scan_subtree(scan, morsel, *internal_node_child(node, i));
+            if (i < num_keys && *internal_node_key(node, i) >= statement->key_high) {
+                break;
+            }
+        }
+    }
+    pager_unpin_shared(pager, page_num);
+}
+
+// 把叶节点中范围内的行追加到单元的输出中, 聚合时只累加键
+void
+parallel_scan_leaf(ParallelScan *scan, Morsel *morsel, void *node){
+    Statement *statement = scan->statement;
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    uint64_t *keys = leaf_node_key(node, 0);
+    uint32_t start = statement->key_low == 0 ? 0 : key_search(keys, num_cells, statement->key_low);
+    uint32_t end = num_cells == 0 || keys[num_cells - 1] <= statement->key_high
+                   ? num_cells : leaf_node_upper_bound(node, statement->key_high);
+    if (start >= end) {
+        return;
+    }
+
+    if (morsel->count == 0) {
+        morsel->min_key = keys[start];
+    }
+    morsel->max_key = keys[end - 1];
+    morsel->count += end - start;
+    if (scan->aggregate) {
+        if (scan->need_sum) {
+            for (uint32_t i = start; i < end; i++) {
+                morsel->sum += keys[i];
+            }
+        }
+        return;
+    }
+
+    RowView view;
+    for (uint32_t i = start; i < end; i++) {
+        if (morsel->output_capacity - morsel->output_length < ROW_LINE_MAX) {
+            morsel->output_capacity = morsel->output_capacity * 2 + ROW_LINE_MAX;
+            morsel->output = realloc(morsel->output, morsel->output_capacity);
+        }
+        view.id = keys[i];
+        if (scan->need_value) {
+            row_view(leaf_node_value(node, i), &view);
+        }
+        morsel->output_length += format_row_view(morsel->output + morsel->output_length, &view,
+                                                 statement->columns, statement->num_columns);
+    }
+}
+
+// 子树中不超过 key_high 的最大键, 没有时返回 false
+// key_high 所在的孩子中没有时, 答案是它左边第一个非空子树中最大的键, 沿最右边的孩子下降即可得到
+bool
+table_max_key(Table *table, uint32_t page_num, uint64_t key_high, uint64_t *max_key){
+    Pager *pager = table->pager;
+    void *node = get_page(pager, page_num);
+    if (get_node_type(node) == NODE_LEAF) {
+        uint32_t end = leaf_node_upper_bound(node, key_high);
+        if (end > 0) {
+            *max_key = *leaf_node_key(node, end - 1);
+        }
+        pager_unpin(pager, page_num);
+        return end > 0;
+    }
+
+    uint32_t index = internal_node_find_child(node, key_high);
+    if (table_max_key(table, *internal_node_child(node, index), key_high, max_key)) {
+        pager_unpin(pager, page_num);
+        return true;
+    }
+    while (index-- > 0) {
+        if (table_max_key(table, *internal_node_child(node, index), UINT64_MAX, max_key)) {
+            pager_unpin(pager, page_num);
+            return true;
+        }
+    }
+    pager_unpin(pager, page_num);
+    return false;
+}
+
+// 删除主键在 [key_low, key_high] 中的行
+ExecuteResult
+execute_delete(Statement statement, Table *table){
+    if (table_delete(table, statement.key_low, statement.key_high) == 0) {
+        return EXECUTE_NOT_FOUND;
+    }
+    return EXECUTE_SUCCESS;
+}
+
+ExecuteResult
+execute_update(Statement statement, Table *table){
+    if (!table_update(table, statement.key_low, &statement)) {
+        return EXECUTE_NOT_FOUND;
+    }
+    return EXECUTE_SUCCESS;
+}
+
+// 开始一个事务: 之后的语句都不单独提交, 直到 commit 时作为一次提交写进 WAL
+ExecuteResult
+execute_begin(Statement statement, Table *table){
+    if (table->pager->in_transaction) {
+        return EXECUTE_IN_TRANSACTION;
+    }
+    table->pager->in_transaction = true;
+    return EXECUTE_SUCCESS;
+}
+
+// 结束事务, 语句执行完之后和普通语句一样提交
+ExecuteResult
+execute_commit(Statement statement, Table *table){
+    if (!table->pager->in_transaction) {
+        return EXECUTE_NO_TRANSACTION;
+    }
+    table->pager->in_transaction = false;
+    return EXECUTE_SUCCESS;
+}
+
+// 删除主键在 [key_low, key_high] 中的行, 返回删除的行数
+// 每次删除一个叶节点中所有落在范围内的行, 调整好树之后再从 key_low 重新定位
+uint32_t
+table_delete(Table *table, uint64_t key_low, uint64_t key_high){
+    Pager *pager = table->pager;
+    uint32_t deleted = 0;
+    while (true) {
+        Cursor *cursor = table_seek(table, key_low);
+        if (cursor->end_of_table) {
+            free(cursor);
+            break;
+        }
+
+        void *node = get_page(pager, cursor->page_num);
+        uint32_t num_cells = *leaf_node_num_cells(node);
+        uint32_t end = cursor->cell_num;
+        while (end < num_cells && *leaf_node_key(node, end) <= key_high) {
+            end++;
+        }
+        if (end == cursor->cell_num) {
+            free(cursor);
+            break;
+        }
+
+        // 单元格删除之后可能被覆盖, 先用它们的值删除索引中的项
+        if (table_has_index(table)) {
+            for (uint32_t i = cursor->cell_num; i < end; i++) {
+                RowView view;
+                view.id = *leaf_node_key(node, i);
+                row_view(leaf_node_cell(node, i), &view);
+                index_delete_row(table, &view);
+            }
+        }
+        leaf_node_remove_cells(node, cursor->cell_num, end - cursor->cell_num);
+        pager_mark_dirty(pager, cursor->page_num);
+        deleted += end - cursor->cell_num;
+        node_rebalance(table, cursor->page_num);
+        free(cursor);
+        pager_unpin_all(pager);
+    }
+    return deleted;
+}
+
+// 修改主键为 key 的行, 行不存在时返回 false
+// 修改后的行放不下时和插入一样分裂叶节点, 键不变所以父节点不受影响
+bool
+table_update(Table *table, uint64_t key, Statement *statement){
+    Cursor *cursor = table_find(table, key);
+    void *node = get_page(table->pager, cursor->page_num);
+    if (cursor->cell_num >= *leaf_node_num_cells(node) || *leaf_node_key(node, cursor->cell_num) != key) {
+        free(cursor);
+        return false;
+    }
+
+    Row row;
+    deserialize_row(leaf_node_value(node, cursor->cell_num), &row);
+    row.id = key;
+    if (statement->set_username) {
+        strcpy(row.username, statement->row_to_update.username);
+    }
+    if (statement->set_email) {
+        strcpy(row.email, statement->row_to_update.email);
+    }
+
+    // 旧的值还在单元格中, 在删除单元格之前更新索引
+    RowView old_view, new_view = {key, row.username, strlen(row.username), row.email, strlen(row.email)};
+    old_view.id = key;
+    row_view(leaf_node_value(node, cursor->cell_num), &old_view);
+    index_update_row(table, &old_view, &new_view);
+
+    leaf_node_remove_cells(node, cursor->cell_num, 1);
+    leaf_node_insert(cursor, key, &row);
+    free(cursor);
+    return true;
+}
+
+/*
+ * 二级索引: username 或 email 上的一棵B+树, 和表在同一个文件中, 项是 (值, id), 按值、再按 id 排序。
+ * 根节点的页号记录在数据库头中, 和表的根节点一样分裂时保持不变。
+ * 插入时从根节点下降并记下路径, 节点放不下时分裂, 分隔项沿路径插入父节点; 删除从叶节点中去掉这一项,
+ * 叶节点删空时从叶节点链表和父节点中摘下并放回空闲页链表, 没有孩子的内部节点同样释放,
+ * 根节点只剩一个孩子时把孩子提上来(index_unlink_leaf, index_node_remove_child, index_root_collapse)
+ */
+
+// create index on username|email: 分配根节点, 在已有的行上建立索引
+ExecuteResult
+execute_create_index(Statement statement, Table *table){
+    Pager *pager = table->pager;
+    Column column = statement.index_column;
+    if (table->index_roots[column] != 0) {
+        return EXECUTE_INDEX_EXISTS;
+    }
+
+    uint32_t root_page_num = get_unused_page_num(pager);
+    void *root = get_page(pager, root_page_num);
+    initialize_index_node(root, NODE_INDEX_LEAF);
+    set_node_root(root, true);
+    pager_mark_dirty(pager, root_page_num);
+    pager_unpin(pager, root_page_num);
+
+    // 不认识索引的旧版本不会维护它, 所以有索引的文件升到新的格式版本
+    void *header = get_page(pager, HEADER_PAGE_NUM);
+    *header_index_root(header, column) = root_page_num;
+    *header_version(header) = DB_FORMAT_VERSION;
+    pager_mark_dirty(pager, HEADER_PAGE_NUM);
+    pager_unpin(pager, HEADER_PAGE_NUM);
+
+    table->index_roots[column] = root_page_num;
+    index_build(table, column);
+    return EXECUTE_SUCCESS;
+}
+
+// 沿叶节点链表读出每一行的 (值, id), 每攒够 IMPORT_SORT_BUFFER_BYTES 排一次序再按顺序插入索引。
+// 同一批的插入从左到右经过索引, 访问的页面是连续的; 按 id 的顺序插入时值是随机的, 索引比缓冲池大时几乎每次都缺页
+void
+index_build(Table *table, Column column){
+    char *buffer = malloc(IMPORT_SORT_BUFFER_BYTES);
+    size_t used = 0;
+    void **cells = NULL;
+    uint32_t num_cells = 0, capacity = 0;
+    Cursor *cursor = table_start(table);
+    RowView view;
+    uint32_t length;
+    while (true) {
+        bool end = cursor->end_of_table;
+        if (end || used + INDEX_CELL_MAX_SIZE > IMPORT_SORT_BUFFER_BYTES) {
+            qsort(cells, num_cells, sizeof(void*), compare_index_cell);
+            for (uint32_t i = 0; i < num_cells; i++) {
+                index_insert(table, column, index_cell_value(cells[i]), index_cell_length(cells[i]),
+                             index_cell_id(cells[i]));
+            }
+            used = 0;
+            num_cells = 0;
+            if (end) {
+                break;
+            }
+        }
+
+        // 游标固定着当前的叶节点, 行视图一直有效
+        cursor_row_view(cursor, &view);
+        const char *value = row_view_value(&view, column, &length);
+        if (num_cells == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            cells = realloc(cells, capacity * sizeof(void*));
+        }
+        cells[num_cells++] = buffer + used;
+        used += index_make_cell(buffer + used, value, length, view.id, false, 0);
+        cursor_advance(cursor);
+    }
+    free(cursor);
+    free(cells);
+    free(buffer);
+}
+
+int
+compare_index_cell(const void *a, const void *b){
+    void *cell = *(void**)b;
+    return index_compare(*(void**)a, index_cell_value(cell), index_cell_length(cell), index_cell_id(cell));
+}
+
+// 只投影 id 和 where 的这一列(值就是 where_value), 或者只有聚合(聚合只使用 id)时, 索引中的项就足够回答查询
+bool
+statement_covered(Statement *statement){
+    for (uint32_t i = 0; i < statement->num_columns; i++) {
+        if (statement->columns[i] != COLUMN_ID && statement->columns[i] != statement->where_column) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// where username/email = X
+// 有索引时定位到索引中这个值的第一项, 顺着叶节点链表取出所有的 id; 需要其他的列时再按 id 在表中查找(回表)。
+// 没有索引时扫描全表比较这一列。两种方式都按 id 的顺序输出
+ExecuteResult
+execute_value_select(Statement *statement, Table *table){
+    Pager *pager = table->pager;
+    Column column = statement->where_column;
+    const char *value = statement->where_value;
+    uint32_t length = strlen(value);
+    bool aggregate = statement->num_aggregates > 0;
+    bool covered = statement_covered(statement);
+
+    uint64_t count = 0, min_key = 0, max_key = 0;
+    unsigned __int128 sum = 0;
+    uint32_t scanned = 0;
+    RowView view;
+    if (table->index_roots[column] != 0) {
+        uint32_t path[MAX_TREE_HEIGHT];
+        uint32_t page_num = path[index_descend(table, column, value, length, 0, path)];
+        void *node = get_page(pager, page_num);
+        uint32_t cell_num = index_node_lower_bound(node, value, length, 0);
+        while (aggregate || count < statement->limit) {
+            // 定位到叶节点的末尾时, 这个值的第一项在下一个叶节点中
+            if (cell_num == *leaf_node_num_cells(node)) {
+                uint32_t next_page_num = *leaf_node_next_leaf(node);
+                pager_unpin(pager, page_num);
+                if (next_page_num == 0) {
+                    break;
+                }
+                page_num = next_page_num;
+                node = get_page(pager, page_num);
+                cell_num = 0;
+                continue;
+            }
+            void *cell = leaf_node_cell(node, cell_num);
+            if (index_cell_length(cell) != length || memcmp(index_cell_value(cell), value, length) != 0) {
+                pager_unpin(pager, page_num);
+                break;
+            }
+            uint64_t id = index_cell_id(cell);
+            cell_num++;
+            scanned++;
+
+            if (aggregate) {
+                min_key = count == 0 ? id : min_key;
+                max_key = id;
+                sum += id;
+            }else if (covered) {
+                view.id = id;
+                view.username = view.email = value;
+                view.username_length = view.email_length = length;
+                print_row_view(&view, statement->columns, statement->num_columns);
+            }else {
+                Cursor *cursor = table_find(table, id);
+                cursor_row_view(cursor, &view);
+                print_row_view(&view, statement->columns, statement->num_columns);
+                free(cursor);
+                // 回表时下降固定的页面立即释放, 匹配的行很多时不会占满缓冲池
+                pager_unpin_all(pager);
+                node = get_page(pager, page_num);
+            }
+            count++;
+        }
+    }else {
+        Cursor *cursor = table_start(table);
+        uint32_t view_length;
+        while (!cursor->end_of_table && (aggregate || count < statement->limit)) {
+            cursor_row_view(cursor, &view);
+            const char *view_value = row_view_value(&view, column, &view_length);
+            scanned++;
+            if (view_length == length && memcmp(view_value, value, length) == 0) {
+                if (aggregate) {
+                    min_key = count == 0 ? view.id : min_key;
+                    max_key = view.id;
+                    sum += view.id;
+                }else {
+                    print_row_view(&view, statement->columns, statement->num_columns);
+                }
+                count++;
+            }
+            cursor_advance(cursor);
+        }
+        free(cursor);
+    }
+
+    if (aggregate) {
+        print_aggregates(statement, count > 0, count, sum, min_key, max_key);
+    }
+    pager->stats.rows_scanned += scanned;
+    pager->stats.rows_returned += aggregate ? 1 : count;
+    return EXECUTE_SUCCESS;
+}
+
+// 行视图中 username 或 email 的值和长度
+const char*
+row_view_value(RowView *view, Column column, uint32_t *length){
+    if (column == COLUMN_USERNAME) {
+        *length = view->username_length;
+        return view->username;
+    }
+    *length = view->email_length;
+    return view->email;
+}
+
+bool
+table_has_index(Table *table){
+    return table->index_roots[COLUMN_USERNAME] != 0 || table->index_roots[COLUMN_EMAIL] != 0;
+}
+
+// 把一行加入所有的索引
+void
+index_insert_row(Table *table, RowView *view){
+    uint32_t length;
+    for (Column column = COLUMN_USERNAME; column < COLUMN_COUNT; column++) {
+        if (table->index_roots[column] != 0) {
+            const char *value = row_view_value(view, column, &length);
+            index_insert(table, column, value, length, view->id);
+        }
+    }
+}
+
+// 从所有的索引中删除一行
+void
+index_delete_row(Table *table, RowView *view){
+    uint32_t length;
+    for (Column column = COLUMN_USERNAME; column < COLUMN_COUNT; column++) {
+        if (table->index_roots[column] != 0) {
+            const char *value = row_view_value(view, column, &length);
+            index_delete(table, column, value, length, view->id);
+        }
+    }
+}
+
+// 修改一行: 只更新值变了的列上的索引
+void
+index_update_row(Table *table, RowView *old_view, RowView *new_view){
+    uint32_t old_length, new_length;
+    for (Column column = COLUMN_USERNAME; column < COLUMN_COUNT; column++) {
+        if (table->index_roots[column] == 0) {
+            continue;
+        }
+        const char *old_value = row_view_value(old_view, column, &old_length);
+        const char *new_value = row_view_value(new_view, column, &new_length);
+        if (old_length != new_length || memcmp(old_value, new_value, old_length) != 0) {
+            index_delete(table, column, old_value, old_length, old_view->id);
+            index_insert(table, column, new_value, new_length, new_view->id);
+        }
+    }
+}
+
+// 从根节点下降到 (value, id) 所在的叶节点, path[0..depth] 是经过的页号, 返回 depth
+uint32_t
+index_descend(Table *table, Column column, const char *value, uint32_t length, uint64_t id, uint32_t *path){
+    Pager *pager = table->pager;
+    uint32_t depth = 0;
+    path[0] = table->index_roots[column];
+    void *node = get_page(pager, path[0]);
+    while (get_node_type(node) == NODE_INDEX_INTERNAL) {
+        uint32_t child_page_num = index_node_child(node, index_node_lower_bound(node, value, length, id));
+        pager_unpin(pager, path[depth]);
+        path[++depth] = child_page_num;
+        node = get_page(pager, child_page_num);
+    }
+    if (get_node_type(node) != NODE_INDEX_LEAF) {
+        printf("Page %d in the index is not an index page. Corrupt file.\n", path[depth]);
+        exit(EXIT_FAILURE);
+    }
+    pager_unpin(pager, path[depth]);
+    return depth;
+}
+
+void
+index_insert(Table *table, Column column, const char *value, uint32_t length, uint64_t id){
+    uint32_t path[MAX_TREE_HEIGHT];
+    uint32_t depth = index_descend(table, column, value, length, id, path);
+    void *node = get_page(table->pager, path[depth]);
+    uint32_t cell_num = index_node_lower_bound(node, value, length, id);
+    pager_unpin(table->pager, path[depth]);
+
+    uint8_t cell[INDEX_CELL_MAX_SIZE];
+    uint32_t cell_size = index_make_cell(cell, value, length, id, false, 0);
+    index_node_insert(table, path, depth, cell_num, cell, cell_size);
+}
+
+// 删除一项; 不存在时什么也不做
+// 叶节点删空时从叶节点链表和父节点中摘下, 放回空闲页链表, 索引在反复插入删除时不会一直变大
+void
+index_delete(Table *table, Column column, const char *value, uint32_t length, uint64_t id){
+    Pager *pager = table->pager;
+    uint32_t path[MAX_TREE_HEIGHT];
+    uint32_t depth = index_descend(table, column, value, length, id, path);
+    void *node = get_page(pager, path[depth]);
+    uint32_t cell_num = index_node_lower_bound(node, value, length, id);
+    bool empty = false;
+    if (cell_num < *leaf_node_num_cells(node) && index_compare(leaf_node_cell(node, cell_num), value, length, id) == 0) {
+        leaf_node_remove_cells(node, cell_num, 1);
+        pager_mark_dirty(pager, path[depth]);
+        empty = *leaf_node_num_cells(node) == 0;
+    }
+    pager_unpin(pager, path[depth]);
+
+    // 根节点是叶节点时保留空的根节点
+    if (empty && depth > 0) {
+        index_unlink_leaf(table, path, depth, value, length, id);
+        index_node_remove_child(table, path, depth - 1, value, length, id);
+    }
+}
+
+// 把空的叶节点 path[depth] 从叶节点链表中摘下, 它左边的叶节点改为指向它的右兄弟。
+// 左边的叶节点在最近一个不是从第 0 个孩子下降的祖先中: 从前一个孩子一直沿右孩子下降; 没有这样的祖先时它是最左边的叶节点
+void
+index_unlink_leaf(Table *table, uint32_t *path, uint32_t depth, const char *value, uint32_t length, uint64_t id){
+    Pager *pager = table->pager;
+    void *leaf = get_page(pager, path[depth]);
+    uint32_t next_page_num = *leaf_node_next_leaf(leaf);
+    pager_unpin(pager, path[depth]);
+
+    uint32_t page_num = 0;
+    for (uint32_t level = depth; level > 0 && page_num == 0; level--) {
+        void *node = get_page(pager, path[level - 1]);
+        uint32_t child_num = index_node_lower_bound(node, value, length, id);
+        if (child_num > 0) {
+            page_num = index_node_child(node, child_num - 1);
+        }
+        pager_unpin(pager, path[level - 1]);
+    }
+    if (page_num == 0) {
+        return;
+    }
+
+    void *node = get_page(pager, page_num);
+    while (get_node_type(node) == NODE_INDEX_INTERNAL) {
+        uint32_t child_page_num = *index_node_right_child(node);
+        pager_unpin(pager, page_num);
+        page_num = child_page_num;
+        node = get_page(pager, page_num);
+    }
+    *leaf_node_next_leaf(node) = next_page_num;
+    pager_mark_dirty(pager, page_num);
+    pager_unpin(pager, page_num);
+}
+
+// 释放路径上第 level + 1 个节点, 并从第 level 个节点中去掉通向它的孩子(单元格和它的分隔项一起去掉,
+// 去掉的是右孩子时最后一个单元格的孩子成为右孩子)。节点因此没有孩子时同样释放, 继续从它的父节点中去掉;
+// 根节点不释放, 没有孩子时变回空的叶节点, 只剩右孩子时把孩子提上来
+void
+index_node_remove_child(Table *table, uint32_t *path, uint32_t level, const char *value, uint32_t length,
+                        uint64_t id){
+    Pager *pager = table->pager;
+    free_page(table, path[level + 1]);
+
+    uint32_t page_num = path[level];
+    void *node = get_page(pager, page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    if (num_cells == 0) {
+        if (level == 0) {
+            initialize_index_node(node, NODE_INDEX_LEAF);
+            set_node_root(node, true);
+            pager_mark_dirty(pager, page_num);
+            pager_unpin(pager, page_num);
+        }else {
+            pager_unpin(pager, page_num);
+            index_node_remove_child(table, path, level - 1, value, length, id);
+        }
+        return;
+    }
+
+    uint32_t child_num = index_node_lower_bound(node, value, length, id);
+    if (child_num == num_cells) {
+        child_num = num_cells - 1;
+        *index_node_right_child(node) = index_cell_child(leaf_node_cell(node, child_num));
+    }
+    leaf_node_remove_cells(node, child_num, 1);
+    pager_mark_dirty(pager, page_num);
+    pager_unpin(pager, page_num);
+    if (level == 0) {
+        index_root_collapse(table, page_num);
+    }
+}
+
+// 根节点只剩右孩子时把孩子的内容搬进根节点并释放孩子, 根节点的页号保持不变
+// 索引节点没有父指针, 搬动孩子不需要修改它下面的节点
+void
+index_root_collapse(Table *table, uint32_t root_page_num){
+    Pager *pager = table->pager;
+    void *root = get_page(pager, root_page_num);
+    while (get_node_type(root) == NODE_INDEX_INTERNAL && *leaf_node_num_cells(root) == 0) {
+        uint32_t child_page_num = *index_node_right_child(root);
+        void *child = get_page(pager, child_page_num);
+        memcpy(root, child, PAGE_SIZE);
+        set_node_root(root, true);
+        pager_unpin(pager, child_page_num);
+        free_page(table, child_page_num);
+    }
+    pager_mark_dirty(pager, root_page_num);
+    pager_unpin(pager, root_page_num);
+}
+
+// 在路径上第 depth 个节点的第 cell_num 个位置插入单元格, 放不下时分裂
+void
+index_node_insert(Table *table, uint32_t *path, uint32_t depth, uint32_t cell_num, void *cell, uint32_t cell_size){
+    Pager *pager = table->pager;
+    void *node = get_page(pager, path[depth]);
+    if (!leaf_node_reserve(node, cell_size)) {
+        pager_unpin(pager, path[depth]);
+        index_node_split_and_insert(table, path, depth, cell_num, cell, cell_size);
+        return;
+    }
+    leaf_node_insert_cell(node, cell_num, index_prefix(index_cell_value(cell), index_cell_length(cell)),
+                          cell, cell_size);
+    pager_mark_dirty(pager, path[depth]);
+    pager_unpin(pager, path[depth]);
+}
+
+// 和表的叶节点一样按字节数把单元格平均分到旧(左)节点和新(右)节点中, 左节点的最大项作为分隔项插入父节点。
+// 内部节点分裂时, 左边最后一个单元格的孩子成为左节点的右孩子, 这个单元格本身上移成为分隔项。
+// 根节点分裂时先把它的内容搬到新的页面, 根节点变成只有右孩子的内部节点, 再分裂新的页面
+void
+index_node_split_and_insert(Table *table, uint32_t *path, uint32_t depth, uint32_t cell_num,
+                            void *cell, uint32_t cell_size){
+    Pager *pager = table->pager;
+    uint32_t page_num = path[depth];
+    void *node = get_page(pager, page_num);
+    if (depth == 0) {
+        uint32_t child_page_num = get_unused_page_num(pager);
+        void *child = get_page(pager, child_page_num);
+        memcpy(child, node, PAGE_SIZE);
+        set_node_root(child, false);
+        initialize_index_node(node, NODE_INDEX_INTERNAL);
+        set_node_root(node, true);
+        *index_node_right_child(node) = child_page_num;
+        pager_mark_dirty(pager, page_num);
+        pager_unpin(pager, page_num);
+
+        path[1] = child_page_num;
+        depth = 1;
+        page_num = child_page_num;
+        node = child;
+    }
+
+    bool leaf = get_node_type(node) == NODE_INDEX_LEAF;
+    if (leaf) {
+        pager->stats.leaf_splits++;
+    }else {
+        pager->stats.internal_splits++;
+    }
+    uint32_t new_page_num = get_unused_page_num(pager);
+    void *new_node = get_page(pager, new_page_num);
+    initialize_index_node(new_node, get_node_type(node));
+
+    void *old_copy = malloc(PAGE_SIZE);
+    memcpy(old_copy, node, PAGE_SIZE);
+    uint32_t num_cells = *leaf_node_num_cells(old_copy);
+
+    uint32_t total = cell_size + LEAF_NODE_SLOT_SIZE;
+    for (uint32_t i = 0; i < num_cells; i++) {
+        total += leaf_node_cell_size(old_copy, i) + LEAF_NODE_SLOT_SIZE;
+    }
+    // 在最右边的叶节点末尾插入时旧节点保持满的, 按顺序建立的索引的叶节点都是满的
+    uint32_t left_count = num_cells, left_bytes = 0;
+    if (!leaf || cell_num != num_cells || *leaf_node_next_leaf(old_copy) != 0) {
+        for (left_count = 0; left_count < num_cells + 1 && left_bytes < total / 2; left_count++) {
+            uint32_t size = left_count == cell_num ? cell_size
+                                                   : leaf_node_cell_size(old_copy, left_count - (left_count > cell_num));
+            left_bytes += size + LEAF_NODE_SLOT_SIZE;
+        }
+        if (left_count > num_cells) { // 右节点至少要有一个单元格
+            left_count = num_cells;
+        }
+    }
+
+    // 叶节点: 新节点插入到旧节点和它的右兄弟之间; 内部节点: 新节点继承旧节点的右孩子
+    *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_copy);
+    *leaf_node_next_leaf(node) = new_page_num;
+    leaf_node_clear(node);
+    uint8_t separator[INDEX_CELL_MAX_SIZE];
+    uint32_t separator_size = 0;
+    for (uint32_t i = 0; i <= num_cells; i++) {
+        void *source = i == cell_num ? cell : leaf_node_cell(old_copy, i - (i > cell_num));
+        uint32_t size = i == cell_num ? cell_size : leaf_node_cell_size(old_copy, i - (i > cell_num));
+        uint64_t prefix = index_prefix(index_cell_value(source), index_cell_length(source));
+        if (i == left_count - 1) {
+            separator_size = index_make_cell(separator, index_cell_value(source), index_cell_length(source),
+                                             index_cell_id(source), true, page_num);
+            if (!leaf) {
+                *index_node_right_child(node) = index_cell_child(source);
+                continue;
+            }
+        }
+        if (i < left_count) {
+            leaf_node_insert_cell(node, *leaf_node_num_cells(node), prefix, source, size);
+        }else {
+            leaf_node_insert_cell(new_node, *leaf_node_num_cells(new_node), prefix, source, size);
+        }
+    }
+    free(old_copy);
+    pager_mark_dirty(pager, page_num);
+    pager_mark_dirty(pager, new_page_num);
+    pager_unpin(pager, page_num);
+    pager_unpin(pager, new_page_num);
+
+    // 父节点中原来指向旧节点的孩子改为指向新节点, 分隔项(孩子是旧节点)插在它的前面
+    uint32_t parent_page_num = path[depth - 1];
+    void *parent = get_page(pager, parent_page_num);
+    uint32_t separator_num = index_node_lower_bound(parent, index_cell_value(separator),
+                                                    index_cell_length(separator), index_cell_id(separator));
+    if (separator_num == *leaf_node_num_cells(parent)) {
+        *index_node_right_child(parent) = new_page_num;
+    }else {
+        index_cell_set_child(leaf_node_cell(parent, separator_num), new_page_num);
+    }
+    pager_mark_dirty(pager, parent_page_num);
+    pager_unpin(pager, parent_page_num);
+    index_node_insert(table, path, depth - 1, separator_num, separator, separator_size);
+}
+
+void
+initialize_index_node(void *node, NodeType type){
+    initialize_leaf_node(node);
+    set_node_type(node, type);
+}
+
+// 内部索引节点的右孩子, 存放在叶节点头中右兄弟的位置
+uint32_t*
+index_node_right_child(void *node){
+    return leaf_node_next_leaf(node);
+}
+
+// 内部索引节点的第 child_num 个孩子, 等于单元格数时是右孩子
+uint32_t
+index_node_child(void *node, uint32_t child_num){
+    if (child_num == *leaf_node_num_cells(node)) {
+        return *index_node_right_child(node);
+    }
+    return index_cell_child(leaf_node_cell(node, child_num));
+}
+
+// 第一个不小于 (value, id) 的单元格的下标
+// 前缀不同的单元格只看键数组就能比较, 只有前缀相等的那一段需要读单元格比较完整的值
+uint32_t
+index_node_lower_bound(void *node, const char *value, uint32_t length, uint64_t id){
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    uint64_t *prefixes = leaf_node_key(node, 0);
+    uint64_t prefix = index_prefix(value, length);
+    uint32_t low = key_search(prefixes, num_cells, prefix);
+    uint32_t high = num_cells;
+    if (prefix != UINT64_MAX) {
+        high = low + key_search(prefixes + low, num_cells - low, prefix + 1);
+    }
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (index_compare(leaf_node_cell(node, middle), value, length, id) < 0) {
+            low = middle + 1;
+        }else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// 值的前 8 个字节按大端组成的整数, 不足 8 个字节的补 0; 值中没有 '\0', 所以前缀的顺序和值的顺序一致
+uint64_t
+index_prefix(const char *value, uint32_t length){
+    uint64_t prefix = 0;
+    for (uint32_t i = 0; i < sizeof(uint64_t); i++) {
+        prefix = prefix << 8 | (i < length ? (uint8_t)value[i] : 0);
+    }
+    return prefix;
+}
+
+// 写出一个索引项, 返回它的字节数; 内部节点的单元格带有孩子的页号
+uint32_t
+index_make_cell(void *cell, const char *value, uint32_t length, uint64_t id, bool internal,
+                uint32_t child_page_num){
+    *(uint8_t *)(cell + INDEX_CELL_LENGTH_OFFSET) = length;
+    memcpy(cell + INDEX_CELL_ID_OFFSET, &id, sizeof(uint64_t));
+    memcpy(cell + INDEX_CELL_VALUE_OFFSET, value, length);
+    if (!internal) {
+        return INDEX_CELL_VALUE_OFFSET + length;
+    }
+    index_cell_set_child(cell, child_page_num);
+    return INDEX_CELL_VALUE_OFFSET + length + INDEX_CELL_CHILD_SIZE;
+}
+
+uint32_t
+index_cell_size(void *node, void *cell){
+    uint32_t size = INDEX_CELL_VALUE_OFFSET + index_cell_length(cell);
+    return get_node_type(node) == NODE_INDEX_INTERNAL ? size + INDEX_CELL_CHILD_SIZE : size;
+}
+
+uint32_t
+index_cell_length(void *cell){
+    return *(uint8_t *)(cell + INDEX_CELL_LENGTH_OFFSET);
+}
+
+const char*
+index_cell_value(void *cell){
+    return cell + INDEX_CELL_VALUE_OFFSET;
+}
+
+// 单元格没有对齐, id 和孩子的页号用 memcpy 读写
+uint64_t
+index_cell_id(void *cell){
+    uint64_t id;
+    memcpy(&id, cell + INDEX_CELL_ID_OFFSET, sizeof(uint64_t));
+    return id;
+}
+
+uint32_t
+index_cell_child(void *cell){
+    uint32_t child_page_num;
+    memcpy(&child_page_num, cell + INDEX_CELL_VALUE_OFFSET + index_cell_length(cell), sizeof(uint32_t));
+    return child_page_num;
+}
+
+void
+index_cell_set_child(void *cell, uint32_t child_page_num){
+    memcpy(cell + INDEX_CELL_VALUE_OFFSET + index_cell_length(cell), &child_page_num, sizeof(uint32_t));
+}
+
+// 比较单元格和 (value, id): 先按字节比较值, 值相同时按 id
+int
+index_compare(void *cell, const char *value, uint32_t length, uint64_t id){
+    uint32_t cell_length = index_cell_length(cell);
+    int result = memcmp(index_cell_value(cell), value, cell_length < length ? cell_length : length);
+    if (result == 0) {
+        result = (cell_length > length) - (cell_length < length);
+    }
+    if (result == 0) {
+        uint64_t cell_id = index_cell_id(cell);
+        result = (cell_id > id) - (cell_id < id);
+    }
+    return result;
+}
+
+// 递归统计索引中各类节点的数量和项数, 页面用 pager_peek_page 读到 buffer 中
+void
+index_node_stats(Pager *pager, uint32_t page_num, void *buffer, uint64_t *leaves, uint64_t *internal,
+                 uint64_t *entries){
+    void *node = pager_peek_page(pager, page_num, buffer);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    if (get_node_type(node) == NODE_INDEX_LEAF) {
+        (*leaves)++;
+        *entries += num_cells;
+        return;
+    }
+
+    // 下降时 buffer 会被孩子覆盖, 先取出所有孩子的页号
+    (*internal)++;
+    uint32_t *children = malloc((num_cells + 1) * sizeof(uint32_t));
+    for (uint32_t i = 0; i <= num_cells; i++) {
+        children[i] = index_node_child(node, i);
+    }
+    for (uint32_t i = 0; i <= num_cells; i++) {
+        index_node_stats(pager, children[i], buffer, leaves, internal, entries);
+    }
+    free(children);
+}
+
+// .stats 中的一个索引: 项数、高度和页数, 页数累加到 *pages 中
+void
+print_index_stats(Table *table, Column column, void *buffer, uint64_t *pages){
+    Pager *pager = table->pager;
+    uint32_t height = 1;
+    void *node = pager_peek_page(pager, table->index_roots[column], buffer);
+    while (get_node_type(node) == NODE_INDEX_INTERNAL) {
+        node = pager_peek_page(pager, index_node_child(node, 0), buffer);
+        height++;
+    }
+
+    uint64_t leaves = 0, internal = 0, entries = 0;
+    index_node_stats(pager, table->index_roots[column], buffer, &leaves, &internal, &entries);
+    printf("index on %s: %lu entries, height %u, %lu pages (%lu leaf, %lu internal)\n", COLUMN_NAMES[column],
+           entries, height, leaves + internal, leaves, internal);
+    *pages += leaves + internal;
+}
+
+// .import <file> [fill_percent]
+// 文件每行一条记录: id username email, 用空格、制表符或逗号分隔
+// 先把所有行排序(必要时外部排序), 空表直接自底向上构建B+树, 否则按顺序逐行插入
+MetaResult
+do_import(Table *table, char *args){
+    char *filename = strtok(args, " ");
+    char *fill_str = strtok(NULL, " ");
+    uint32_t fill_percent = IMPORT_DEFAULT_FILL;
+    if (filename == NULL || (fill_str && !(parse_uint32(fill_str, &fill_percent)
+                                           && fill_percent >= 10 && fill_percent <= 100))) {
+        printf("Usage: .import <file> [fill_percent 10-100]\n");
+        return META_SUCCESS;
+    }
+
+    ImportSorter sorter;
+    if (!import_read_file(filename, &sorter)) {
+        sorter_free(&sorter);
+        return META_SUCCESS;
+    }
+    sorter_finish(&sorter);
+
+    Pager *pager = table->pager;
+    void *root = get_page(pager, table->root_page_num);
+    bool empty = get_node_type(root) == NODE_LEAF && *leaf_node_num_cells(root) == 0;
+    pager_unpin(pager, table->root_page_num);
+
+    uint64_t imported = 0, duplicates = 0;
+    bool has_last = false;
+    uint64_t last_key = 0;
+    ImportRow row;
+    TreeBuilder builder;
+    if (empty) {
+        builder_init(&builder, table, fill_percent);
+    }
+
+    while (sorter_next(&sorter, &row)) {
+        if (has_last && row.row.id == last_key) {
+            duplicates++;
+            continue;
+        }
+        has_last = true;
+        last_key = row.row.id;
+
+        if (empty) {
+            builder_add_row(&builder, &row.row);
+            imported++;
+            continue;
+        }
+
+        if (table_insert(table, &row.row) == EXECUTE_DUPLICATE_KEY) {
+            duplicates++;
+        }else {
+            imported++;
+        }
+        pager_unpin_all(pager);
+    }
+    if (empty) {
+        builder_finish(&builder);
+        // 构建器不经过 table_insert, 表原来是空的, 索引也是空的, 在新的行上重新建立
+        for (Column column = COLUMN_USERNAME; column < COLUMN_COUNT; column++) {
+            if (table->index_roots[column] != 0) {
+                index_build(table, column);
+            }
+        }
+        pager_unpin_all(pager);
+    }
+    sorter_free(&sorter);
+
+    printf("Imported %lu rows, skipped %lu duplicates.\n", imported, duplicates);
+    return META_SUCCESS;
+}
+
+// 读取并校验导入文件的每一行, 有任何错误时不修改数据库
+bool
+import_read_file(const char *filename, ImportSorter *sorter){
+    memset(sorter, 0, sizeof(ImportSorter));
+
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) {
+        printf("Unable to open '%s'\n", filename);
+        return false;
+    }
+
+    char *line = NULL;
+    size_t line_capacity = 0;
+    uint64_t line_num = 0;
+    bool ok = true;
+    while (getline(&line, &line_capacity, file) > 0) {
+        line_num++;
+        char *id_str = strtok(line, " \t,\r\n");
+        if (id_str == NULL) {
+            continue; // 空行
+        }
+        char *username = strtok(NULL, " \t,\r\n");
+        char *email = strtok(NULL, " \t,\r\n");
+
+        ImportRow row;
+        row.seq = line_num;
+        if (!(username && email && parse_uint64(id_str, &row.row.id))) {
+            printf("Syntax error at line %lu of '%s'\n", line_num, filename);
+            ok = false;
+            break;
+        }
+        if (strlen(username) > COLUMN_USERNAME_SIZE || strlen(email) > COLUMN_EMAIL_SIZE) {
+            printf("String is too long at line %lu of '%s'\n", line_num, filename);
+            ok = false;
+            break;
+        }
+        strcpy(row.row.username, username);
+        strcpy(row.row.email, email);
+        sorter_add(sorter, &row);
+    }
+
+    free(line);
+    fclose(file);
+    return ok;
+}
+
+void
+sorter_add(ImportSorter *sorter, ImportRow *row){
+    if (sorter->num_rows == sorter->capacity) {
+        // 内存中的行已经达到上限, 排序后作为一个有序段写到临时文件
+        if ((sorter->capacity + 1) * sizeof(ImportRow) > IMPORT_SORT_BUFFER_BYTES) {
+            sorter_spill(sorter);
+        }else {
+            sorter->capacity = sorter->capacity ? sorter->capacity * 2 : 1024;
+            if (sorter->capacity * sizeof(ImportRow) > IMPORT_SORT_BUFFER_BYTES) {
+                sorter->capacity = IMPORT_SORT_BUFFER_BYTES / sizeof(ImportRow);
+            }
+            sorter->rows = realloc(sorter->rows, sorter->capacity * sizeof(ImportRow));
+        }
+    }
+    sorter->rows[sorter->num_rows++] = *row;
+}
+
+// 把内存中的行排序后写成一个有序段
+void
+sorter_spill(ImportSorter *sorter){
+    qsort(sorter->rows, sorter->num_rows, sizeof(ImportRow), compare_import_row);
+
+    FILE *file = tmpfile();
+    if (file == NULL || fwrite(sorter->rows, sizeof(ImportRow), sorter->num_rows, file) != sorter->num_rows) {
+        printf("Error writing sort run: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    rewind(file);
+
+    sorter->runs = realloc(sorter->runs, (sorter->num_runs + 1) * sizeof(ImportRun));
+    sorter->runs[sorter->num_runs++].file = file;
+    sorter->num_rows = 0;
+}
+
+// 输入读完之后调用: 只有内存中的行时直接排序, 否则把所有有序段放进最小堆准备归并
+void
+sorter_finish(ImportSorter *sorter){
+    if (sorter->num_runs == 0) {
+        qsort(sorter->rows, sorter->num_rows, sizeof(ImportRow), compare_import_row);
+        return;
+    }
+
+    if (sorter->num_rows > 0) {
+        sorter_spill(sorter);
+    }
+    free(sorter->rows);
+    sorter->rows = NULL;
+
+    sorter->heap = malloc(sorter->num_runs * sizeof(uint32_t));
+    for (uint32_t i = 0; i < sorter->num_runs; i++) {
+        if (fread(&sorter->runs[i].current, sizeof(ImportRow), 1, sorter->runs[i].file) == 1) {
+            sorter->heap[sorter->heap_size++] = i;
+        }
+    }
+    for (int32_t i = sorter->heap_size / 2 - 1; i >= 0; i--) {
+        sorter_sift_down(sorter, i);
+    }
+}
+
+// 按键的顺序取出下一行
+bool
+sorter_next(ImportSorter *sorter, ImportRow *row){
+    if (sorter->num_runs == 0) {
+        if (sorter->next == sorter->num_rows) {
+            return false;
+        }
+        *row = sorter->rows[sorter->next++];
+        return true;
+    }
+
+    if (sorter->heap_size == 0) {
+        return false;
+    }
+    ImportRun *run = &sorter->runs[sorter->heap[0]];
+    *row = run->current;
+    if (fread(&run->current, sizeof(ImportRow), 1, run->file) != 1) {
+        sorter->heap[0] = sorter->heap[--sorter->heap_size];
+    }
+    sorter_sift_down(sorter, 0);
+    return true;
+}
+
+void
+sorter_sift_down(ImportSorter *sorter, uint32_t index){
+    while (true) {
+        uint32_t smallest = index;
+        for (uint32_t child = 2 * index + 1; child <= 2 * index + 2 && child < sorter->heap_size; child++) {
+            if (compare_import_row(&sorter->runs[sorter->heap[child]].current,
+                                   &sorter->runs[sorter->heap[smallest]].current) < 0) {
+                smallest = child;
+            }
+        }
+        if (smallest == index) {
+            return;
+        }
+        uint32_t temp = sorter->heap[index];
+        sorter->heap[index] = sorter->heap[smallest];
+        sorter->heap[smallest] = temp;
+        index = smallest;
+    }
+}
+
+void
+sorter_free(ImportSorter *sorter){
+    for (uint32_t i = 0; i < sorter->num_runs; i++) {
+        fclose(sorter->runs[i].file);
+    }
+    free(sorter->runs);
+    free(sorter->rows);
+    free(sorter->heap);
+}
+
+// 按 (id, 行号) 排序
+int
+compare_import_row(const void *a, const void *b){
+    const ImportRow *row_a = a, *row_b = b;
+    if (row_a->row.id != row_b->row.id) {
+        return row_a->row.id < row_b->row.id ? -1 : 1;
+    }
+    return (row_a->seq > row_b->seq) - (row_a->seq < row_b->seq);
+}
+
+void
+builder_init(TreeBuilder *builder, Table *table, uint32_t fill_percent){
+    builder->table = table;
+    builder->num_levels = 0;
+    builder->pages_since_flush = 0;
+    for (uint32_t i = 0; i < MAX_TREE_HEIGHT; i++) {
+        builder->levels[i].page_num = INVALID_PAGE_NUM;
+        builder->levels[i].prev_page_num = INVALID_PAGE_NUM;
+    }
+
+    // 叶节点按字节数填充, 每个叶节点至少放一行
+    builder->leaf_fill = LEAF_NODE_SPACE_FOR_CELLS * fill_percent / 100;
+    // 内部节点至少要有3个孩子, 这样最后一个节点不够两个孩子时可以从前一个节点借一个
+    builder->internal_fill = (INTERNAL_NODE_MAX_KEYS + 1) * fill_percent / 100;
+    if (builder->internal_fill < 3) {
+        builder->internal_fill = 3;
+    }
+}
+
+// 按键的顺序追加一行, 当前叶节点填满后开始一个新的叶节点
+void
+builder_add_row(TreeBuilder *builder, Row *row){
+    BuildLevel *leaf = &builder->levels[0];
+    uint8_t cell[ROW_MAX_SIZE];
+    uint32_t cell_size = serialize_row(row, cell);
+    if (leaf->page_num == INVALID_PAGE_NUM ||
+        (leaf->count > 0 && LEAF_NODE_SPACE_FOR_CELLS - leaf_node_free_space(leaf->node)
+                            + cell_size + LEAF_NODE_SLOT_SIZE > builder->leaf_fill)) {
+        builder_start_node(builder, 0);
+    }
+
+    leaf_node_insert_cell(leaf->node, leaf->count, row->id, cell, cell_size);
+    leaf->count++;
+    leaf->last_max_key = row->id;
+}
+
+// 给第 level 层追加一个孩子: 原来的右孩子变成普通的单元格, 新孩子成为右孩子
+void
+builder_add_child(TreeBuilder *builder, uint32_t level, uint32_t child_page_num,
+                  void *child, uint64_t child_max_key){
+    BuildLevel *current = &builder->levels[level];
+    if (current->page_num == INVALID_PAGE_NUM || current->count == builder->internal_fill) {
+        builder_start_node(builder, level);
+    }
+
+    void *node = current->node;
+    if (current->count > 0) {
+        uint32_t num_keys = (*internal_node_num_keys(node))++;
+        *internal_node_cell(node, num_keys) = *internal_node_right_child(node);
+        *internal_node_key(node, num_keys) = current->last_max_key;
+    }
+    *internal_node_right_child(node) = child_page_num;
+    current->count++;
+    current->last_max_key = child_max_key;
+    *node_parent(child) = current->page_num;
+}
+
+// 在第 level 层开始一个新节点, 先完成这一层原来的节点
+void
+builder_start_node(TreeBuilder *builder, uint32_t level){
+    Pager *pager = builder->table->pager;
+    BuildLevel *current = &builder->levels[level];
+    if (level >= MAX_TREE_HEIGHT - 1) {
+        printf("Tree is too high.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t page_num = get_unused_page_num(pager);
+    void *node = get_page(pager, page_num);
+    if (level == 0) {
+        initialize_leaf_node(node);
+    }else {
+        initialize_internal_node(node);
+    }
+
+    if (current->page_num != INVALID_PAGE_NUM) {
+        if (level == 0) {
+            *leaf_node_next_leaf(current->node) = page_num;
+        }
+        builder_close_node(builder, level);
+        current->prev_page_num = current->page_num;
+    }
+    current->page_num = page_num;
+    current->node = node;
+    current->count = 0;
+    if (level + 1 > builder->num_levels) {
+        builder->num_levels = level + 1;
+    }
+
+    // 定期把已经完成的页面成批写回, 避免它们在缓冲池中被逐页淘汰
+    if (++builder->pages_since_flush >= IMPORT_FLUSH_PAGES) {
+        pager_write_back(pager);
+        builder->pages_since_flush = 0;
+    }
+}
+
+// 完成第 level 层当前的节点, 把它作为孩子追加到上一层
+void
+builder_close_node(TreeBuilder *builder, uint32_t level){
+    Pager *pager = builder->table->pager;
+    BuildLevel *current = &builder->levels[level];
+    builder_add_child(builder, level + 1, current->page_num, current->node, current->last_max_key);
+    pager_mark_dirty(pager, current->page_num);
+    pager_unpin(pager, current->page_num);
+}
+
+// 自底向上完成每一层, 最上层唯一的节点拷贝到根节点所在的页面
+void
+builder_finish(TreeBuilder *builder){
+    Pager *pager = builder->table->pager;
+    if (builder->num_levels == 0) {
+        return;
+    }
+
+    uint32_t level = 0;
+    while (level < builder->num_levels - 1 || builder->levels[level].prev_page_num != INVALID_PAGE_NUM) {
+        BuildLevel *current = &builder->levels[level];
+
+        // 内部节点只有一个孩子时, 从这一层前一个节点借走最后一个孩子
+        // 前一个节点一定是上一层当前节点的右孩子, 它的最大键记录在上一层的 last_max_key 中
+        if (level > 0 && current->count == 1) {
+            BuildLevel *parent = &builder->levels[level + 1];
+            void *prev = get_page(pager, current->prev_page_num);
+            uint32_t prev_num_keys = *internal_node_num_keys(prev);
+            uint32_t borrowed_page_num = *internal_node_right_child(prev);
+            uint64_t borrowed_max_key = parent->last_max_key;
+
+            *internal_node_right_child(prev) = *internal_node_cell(prev, prev_num_keys - 1);
+            parent->last_max_key = *internal_node_key(prev, prev_num_keys - 1);
+            *internal_node_num_keys(prev) = prev_num_keys - 1;
+            pager_mark_dirty(pager, current->prev_page_num);
+            pager_unpin(pager, current->prev_page_num);
+
+            *internal_node_num_keys(current->node) = 1;
+            *internal_node_cell(current->node, 0) = borrowed_page_num;
+            *internal_node_key(current->node, 0) = borrowed_max_key;
+            current->count = 2;
+            set_node_parent(pager, borrowed_page_num, current->page_num);
+        }
+        builder_close_node(builder, level);
+        level++;
+    }
+
+    // 根节点必须在第0页
+    BuildLevel *top = &builder->levels[level];
+    uint32_t root_page_num = builder->table->root_page_num;
+    void *root = get_page(pager, root_page_num);
+    memcpy(root, top->node, PAGE_SIZE);
+    set_node_root(root, true);
+    if (get_node_type(root) == NODE_INTERNAL) {
+        for (uint32_t i = 0; i <= *internal_node_num_keys(root); i++) {
+            set_node_parent(pager, *internal_node_child(root, i), root_page_num);
+        }
+    }
+    pager_mark_dirty(pager, root_page_num);
+    pager_unpin(pager, top->page_num);
+    free_page(builder->table, top->page_num);
+}
+
+// 把当前所有的脏页写回: 开启 WAL 时作为一次提交写进 WAL, 否则直接写回数据库文件
+void
+pager_write_back(Pager *pager){
+    if (pager->wal) {
+        pager_commit(pager, false);
+    }else {
+        pager_flush_all(pager);
+    }
+}
+
+// 将source信息写入表中的一行, 返回写入的字节数
+uint32_t
+serialize_row(Row *source, void *destination) {
+    uint8_t username_length = strlen(source->username);
+    uint8_t email_length = strlen(source->email);
+
+    *(uint8_t *)(destination + USERNAME_LENGTH_OFFSET) = username_length;
+    *(uint8_t *)(destination + EMAIL_LENGTH_OFFSET) = email_length;
+    memcpy(destination + ROW_STRINGS_OFFSET, source->username, username_length);
+    memcpy(destination + ROW_STRINGS_OFFSET + username_length, source->email, email_length);
+    return ROW_STRINGS_OFFSET + username_length + email_length;
+}
+
+// 从表中读取信息到 source中
+// 此时 source是表的一行, destination存放读取的数据, id 由调用者从键中取得
+void
+deserialize_row(void *source, Row *destination){
+    uint8_t username_length = *(uint8_t *)(source + USERNAME_LENGTH_OFFSET);
+    uint8_t email_length = *(uint8_t *)(source + EMAIL_LENGTH_OFFSET);
+
+    memcpy(destination->username, source + ROW_STRINGS_OFFSET, username_length);
+    destination->username[username_length] = '\0';
+    memcpy(destination->email, source + ROW_STRINGS_OFFSET + username_length, email_length);
+    destination->email[email_length] = '\0';
+}
+
+// 在单元格上建立只读视图, 只读取两个长度字节, 不拷贝字符串; id 由调用者从键中取得
+void
+row_view(void *cell, RowView *view){
+    view->username_length = *(uint8_t *)(cell + USERNAME_LENGTH_OFFSET);
+    view->email_length = *(uint8_t *)(cell + EMAIL_LENGTH_OFFSET);
+    view->username = cell + ROW_STRINGS_OFFSET;
+    view->email = view->username + view->username_length;
+}
+
+// 序列化的行占用的字节数
+uint32_t
+row_size(void *source){
+    return ROW_STRINGS_OFFSET + *(uint8_t *)(source + USERNAME_LENGTH_OFFSET)
+           + *(uint8_t *)(source + EMAIL_LENGTH_OFFSET);
+}
+
+// 获取指定数值页的地址，如果该页不再内存中，则加载进内存
+// 返回的页面会被固定(pin)在缓冲池中, 直到调用 pager_unpin 或语句结束
+void*
+get_page(Pager *pager, uint32_t page_num){
+    // 映射模式下只是地址计算; 新页面在私有映射中清零并标记为脏页
+    if (pager->mmap) {
+        void *page = pager_frame_data(pager, page_num);
+        if (page_num >= pager->num_pages) {
+            pager_map_extend(pager, page_num + 1);
+            memset(page, 0, PAGE_SIZE);
+            pager->num_pages = page_num + 1;
+            pager_mark_dirty(pager, page_num);
+        }
+        pager->stats.hits++;
+        return page;
+    }
+
+    int32_t frame_num = pager_lookup(pager, page_num);
+    if (frame_num != -1) {
+        Frame *frame = &pager->frames[frame_num];
+        frame->referenced = true;
+        pager_pin(pager, frame_num);
+        pager->stats.hits++;
+        return pager_frame_data(pager, frame_num);
+    }
+
+    // 缓存中没有, 找到一个空闲的帧，并将同一页的数据加载到内存
+    pager->stats.misses++;
+    frame_num = pager_find_victim(pager);
+    void *page = pager_frame_data(pager, frame_num);
+
+    // 新分配的页面不需要读取, 但必须写回
+    bool new_page = page_num >= pager->num_pages;
+    if (new_page) {
+        memset(page, 0, PAGE_SIZE);
+    }else {
+        pager_read_page(pager, page_num, page);
+    }
+
+    Frame *frame = &pager->frames[frame_num];
+    frame->page_num = page_num;
+    frame->pin_count = 0;
+    pager_pin(pager, frame_num);
+    frame->in_use = true;
+    frame->referenced = true;
+    frame->dirty = new_page;
+
+    uint32_t bucket = pager_hash(pager, page_num);
+    frame->hash_next = pager->buckets[bucket];
+    pager->buckets[bucket] = frame_num;
+
+    if (page_num >= pager->num_pages) {
+        pager->num_pages = page_num + 1;
+    }
+    return page;
+}
+
+// 并行扫描中工作线程使用的 get_page: 命中时只持读锁, 用原子操作固定帧;
+// 未命中时持写锁走单线程的路径, 此时没有线程在读哈希表, 持有固定的帧也不会被淘汰
+void*
+get_page_shared(Pager *pager, uint32_t page_num){
+    // 只读的扫描不会访问新页面, 映射模式下不需要加锁
+    if (pager->mmap) {
+        return pager_frame_data(pager, page_num);
+    }
+    pthread_rwlock_rdlock(&pager->lock);
+    int32_t frame_num = pager_lookup(pager, page_num);
+    if (frame_num != -1) {
+        Frame *frame = &pager->frames[frame_num];
+        __atomic_add_fetch(&frame->pin_count, 1, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&frame->referenced, true, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&pager->stats.hits, 1, __ATOMIC_RELAXED);
+        pthread_rwlock_unlock(&pager->lock);
+        return pager_frame_data(pager, frame_num);
+    }
+    pthread_rwlock_unlock(&pager->lock);
+
+    pthread_rwlock_wrlock(&pager->lock);
+    void *page = get_page(pager, page_num);
+    pthread_rwlock_unlock(&pager->lock);
+    return page;
+}
+
+void
+pager_unpin_shared(Pager *pager, uint32_t page_num){
+    if (pager->mmap) {
+        return;
+    }
+    pthread_rwlock_rdlock(&pager->lock);
+    int32_t frame_num = pager_lookup(pager, page_num);
+    if (frame_num != -1) {
+        __atomic_sub_fetch(&pager->frames[frame_num].pin_count, 1, __ATOMIC_RELEASE);
+    }
+    pthread_rwlock_unlock(&pager->lock);
+}
+
+// 页面最新的镜像在哪个文件的什么位置: 在 WAL 中就是 WAL 中最新的帧, 否则是数据库文件
+// 页面还没有写进任何文件时返回 false
+bool
+pager_page_location(Pager *pager, uint32_t page_num, int *fd, off_t *offset){
+    int32_t wal_frame = pager->wal ? wal_find_frame(pager->wal, page_num) : -1;
+    if (wal_frame != -1) {
+        *fd = pager->wal->file_descriptor;
+        *offset = wal_frame_offset(wal_frame) + sizeof(WalFrameHeader);
+        return true;
+    }
+    *fd = pager->file_descriptor;
+    *offset = (off_t)page_num * PAGE_SIZE;
+    return *offset < pager->file_length;
+}
+
+// 通知内核提前读入不在缓冲池中的页面(posix_fadvise WILLNEED 是异步的),
+// 之后 get_page 的 pread 只需要从页缓存拷贝; 文件中相邻的页面合并成一次通知
+// 并行扫描中调用时要持有读锁
+void
+pager_prefetch(Pager *pager, uint32_t *pages, uint32_t num_pages){
+    if (pager->direct) {
+        pager_prefetch_direct(pager, pages, num_pages);
+        return;
+    }
+    int run_fd = -1;
+    off_t run_start = 0, run_end = 0;
+    for (uint32_t i = 0; i <= num_pages; i++) {
+        int fd = -1;
+        off_t offset = 0;
+        bool valid = i < num_pages && pager_lookup(pager, pages[i]) == -1
+                     && pager_page_location(pager, pages[i], &fd, &offset);
+        if (valid && fd == run_fd && offset == run_end) {
+            run_end += PAGE_SIZE;
+            continue;
+        }
+        if (run_fd != -1) {
+            posix_fadvise(run_fd, run_start, run_end - run_start, POSIX_FADV_WILLNEED);
+            __atomic_add_fetch(&pager->stats.prefetches, (run_end - run_start) / PAGE_SIZE, __ATOMIC_RELAXED);
+            run_fd = -1;
+        }
+        if (valid) {
+            run_fd = fd;
+            run_start = offset;
+            run_end = offset + PAGE_SIZE;
+        }
+    }
+}
+
+// O_DIRECT 模式下没有页缓存, 通知内核没有用: 把数据库文件中相邻的页面用一次 preadv 直接读进缓冲池
+// 预读的页面不固定, 一次最多占用缓冲池的四分之一, 避免把正在使用的页面都挤出去
+// 最新的镜像在 WAL 中的页面留给 get_page 读取
+void
+pager_prefetch_direct(Pager *pager, uint32_t *pages, uint32_t num_pages){
+    uint32_t budget = pager->num_frames / 4;
+    uint32_t run[PAGER_MAX_IOV];
+    uint32_t run_length = 0;
+    for (uint32_t i = 0; i <= num_pages && budget > 0; i++) {
+        int fd = -1;
+        off_t offset = 0;
+        bool valid = i < num_pages && pager_lookup(pager, pages[i]) == -1
+                     && pager_page_location(pager, pages[i], &fd, &offset) && fd == pager->file_descriptor;
+        if (valid && run_length > 0 && run_length < PAGER_MAX_IOV && run_length < budget
+                && pages[i] == run[run_length - 1] + 1) {
+            run[run_length++] = pages[i];
+            continue;
+        }
+        if (run_length > 0) {
+            pager_load_run(pager, run, run_length);
+            budget -= run_length;
+            run_length = 0;
+        }
+        if (valid && budget > 0) {
+            run[run_length++] = pages[i];
+        }
+    }
+}
+
+// 为一段页号连续的页面找到帧, 用一次 preadv 读入, 然后加入哈希表
+// 找不到可以淘汰的帧时只读前面已经有帧的部分
+void
+pager_load_run(Pager *pager, uint32_t *pages, uint32_t num_pages){
+    struct iovec iov[PAGER_MAX_IOV];
+    uint32_t frame_nums[PAGER_MAX_IOV];
+    uint32_t num_frames = 0;
+    while (num_frames < num_pages) {
+        int32_t frame_num = pager_evict(pager);
+        if (frame_num == -1) {
+            break;
+        }
+        frame_nums[num_frames] = frame_num;
+        iov[num_frames].iov_base = pager_frame_data(pager, frame_num);
+        iov[num_frames].iov_len = PAGE_SIZE;
+        // 暂时占住这个帧, 后面的 pager_evict 不会再选中它
+        pager->frames[frame_num].pin_count = 1;
+        num_frames++;
+    }
+    if (num_frames == 0) {
+        return;
+    }
+
+    uint64_t start = clock_ns();
+    ssize_t bytes_read = preadv(pager->file_descriptor, iov, num_frames, (off_t)pages[0] * PAGE_SIZE);
+    if (bytes_read != (ssize_t)num_frames * PAGE_SIZE) {
+        printf("Error reading file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    pager->stats.io_ns += clock_ns() - start;
+    pager->stats.pages_read += num_frames;
+    pager->stats.bytes_read += bytes_read;
+    pager->stats.prefetches += num_frames;
+
+    for (uint32_t i = 0; i < num_frames; i++) {
+        Frame *frame = &pager->frames[frame_nums[i]];
+        frame->page_num = pages[i];
+        frame->pin_count = 0;
+        frame->in_use = true;
+        frame->referenced = true;
+        frame->dirty = false;
+        uint32_t bucket = pager_hash(pager, pages[i]);
+        frame->hash_next = pager->buckets[bucket];
+        pager->buckets[bucket] = frame_nums[i];
+    }
+}
+
+// 扫描进入叶节点 page_num 之后, 预读父节点中它后面的 READAHEAD_PAGES 个兄弟;
+// 窗口随着扫描向前滑动, 每个页面只通知一次。到了父节点的末尾就停下, 进入下一个父节点时重新开始
+// O_DIRECT 模式下预读是同步的读, 只走过几个叶节点的短扫描用不上后面的兄弟: 窗口从 0 开始逐步翻倍
+void
+leaf_readahead(Pager *pager, uint32_t page_num, Readahead *readahead){
+    uint32_t window = READAHEAD_PAGES;
+    if (pager->direct) {
+        window = readahead->window;
+        readahead->window = window == 0 ? 1 : (window * 2 < READAHEAD_PAGES ? window * 2 : READAHEAD_PAGES);
+        if (window == 0) {
+            return;
+        }
+    }
+    void *node = get_page(pager, page_num);
+    bool root = is_node_root(node);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    uint32_t parent_page_num = *node_parent(node);
+    uint64_t first_key = num_cells > 0 ? *leaf_node_key(node, 0) : 0;
+    pager_unpin(pager, page_num);
+    if (root || num_cells == 0) {
+        return;
+    }
+
+    void *parent = get_page(pager, parent_page_num);
+    uint32_t num_children = *internal_node_num_keys(parent) + 1;
+    uint32_t index = internal_node_find_child(parent, first_key);
+    uint32_t start = index + 1;
+    if (readahead->parent_page_num == parent_page_num && readahead->end > start) {
+        start = readahead->end;
+    }
+    uint32_t end = index + 1 + window < num_children ? index + 1 + window : num_children;
+    // 窗口只剩一半时才补充, 通知的次数少一些
+    if (start < end && (start == index + 1 || end - start >= window / 2)) {
+        uint32_t pages[READAHEAD_PAGES];
+        for (uint32_t i = start; i < end; i++) {
+            pages[i - start] = *internal_node_child(parent, i);
+        }
+        pager_prefetch(pager, pages, end - start);
+        readahead->parent_page_num = parent_page_num;
+        readahead->end = end;
+    }
+    pager_unpin(pager, parent_page_num);
+}
+
+// 只读地查看一个页面, 不固定、不放入缓冲池, 也不计入命中和未命中:
+// 在缓冲池中(或者映射模式)时直接返回它的内存, 否则读进 buffer (按 io_align 对齐) 中返回 buffer。
+// 返回的内存只能在下一次 get_page 之前使用
+void*
+pager_peek_page(Pager *pager, uint32_t page_num, void *buffer){
+    if (pager->mmap) {
+        return pager_frame_data(pager, page_num);
+    }
+    int32_t frame_num = pager_lookup(pager, page_num);
+    if (frame_num != -1) {
+        return pager_frame_data(pager, frame_num);
+    }
+    pager_read_page(pager, page_num, buffer);
+    return buffer;
+}
+
+// 读取页面最新的镜像: 在 WAL 中就从 WAL 读, 否则从数据库文件读
+void
+pager_read_page(Pager *pager, uint32_t page_num, void *page){
+    int fd;
+    off_t offset;
+    if (!pager_page_location(pager, page_num, &fd, &offset)) {
+        memset(page, 0, PAGE_SIZE);
+        return;
+    }
+
+    uint64_t start = clock_ns();
+    ssize_t bytes_read = pread(fd, page, PAGE_SIZE, offset);
+    if (bytes_read == -1) {
+        printf("Error reading file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    pager->stats.io_ns += clock_ns() - start;
+    pager->stats.pages_read++;
+    pager->stats.bytes_read += bytes_read;
+    memset(page + bytes_read, 0, PAGE_SIZE - bytes_read);
+}
+
+// 帧在 arena 中对应的内存
+void*
+pager_frame_data(Pager *pager, uint32_t frame_num){
+    return pager->arena + (size_t)frame_num * PAGE_SIZE;
+}
+
+uint32_t
+pager_hash(Pager *pager, uint32_t page_num){
+    return (page_num * 2654435761u) & (pager->num_buckets - 1);
+}
+
+// 查找页面所在的帧, 不在缓冲池中返回 -1
+int32_t
+pager_lookup(Pager *pager, uint32_t page_num){
+    int32_t frame_num = pager->buckets[pager_hash(pager, page_num)];
+    while (frame_num != -1 && pager->frames[frame_num].page_num != page_num) {
+        frame_num = pager->frames[frame_num].hash_next;
+    }
+    return frame_num;
+}
+
+// 将帧从哈希表中移除
+void
+pager_hash_remove(Pager *pager, uint32_t frame_num){
+    int32_t *link = &pager->buckets[pager_hash(pager, pager->frames[frame_num].page_num)];
+    while (*link != (int32_t)frame_num) {
+        link = &pager->frames[*link].hash_next;
+    }
+    *link = pager->frames[frame_num].hash_next;
+}
+
+// 找到一个可以装入新页面的帧
+// 先使用从未使用过的帧, 用完后按 CLOCK 算法淘汰一个没有被固定的页面
+uint32_t
+pager_find_victim(Pager *pager){
+    int32_t frame_num = pager_evict(pager);
+    if (frame_num == -1) {
+        printf("Buffer pool exhausted: all %d frames are pinned.\n", pager->num_frames);
+        exit(EXIT_FAILURE);
+    }
+    return frame_num;
+}
+
+// 腾出一个帧, 所有的帧都被固定时返回 -1
+int32_t
+pager_evict(Pager *pager){
+    if (pager->frames_used < pager->num_frames) {
+        return pager->frames_used++;
+    }
+
+    // 转两圈: 第一圈清除访问位, 第二圈一定能找到未被固定的帧
+    for (uint32_t i = 0; i < 2 * pager->num_frames; i++) {
+        uint32_t frame_num = pager->clock_hand;
+        Frame *frame = &pager->frames[frame_num];
+        pager->clock_hand = (pager->clock_hand + 1) % pager->num_frames;
+
+        if (frame->pin_count > 0) {
+            continue;
+        }
+        if (frame->referenced) {
+            frame->referenced = false;
+            continue;
+        }
+
+        // 开启 WAL 时脏页只能写进 WAL (作为未提交的帧), 数据库文件只在检查点时修改
+        if (frame->dirty && pager->wal) {
+            DirtyPage victim = {frame->page_num, frame_num};
+            wal_write_frames(pager, &victim, 1, false);
+        }else if (frame->dirty) {
+            pager_write_frame(pager, frame_num);
+        }
+        pager_hash_remove(pager, frame_num);
+        frame->in_use = false;
+        pager->stats.evictions++;
+        return frame_num;
+    }
+    return -1;
+}
+
+// 标记页面被修改过, 调用者必须已经通过 get_page 固定了该页
+void
+pager_mark_dirty(Pager *pager, uint32_t page_num){
+    if (pager->mmap) {
+        if (!pager->dirty_map[page_num]) {
+            pager->dirty_map[page_num] = true;
+            if (pager->num_dirty == pager->dirty_capacity) {
+                pager->dirty_capacity = pager->dirty_capacity * 2 + 64;
+                pager->dirty_list = realloc(pager->dirty_list, pager->dirty_capacity * sizeof(uint32_t));
+            }
+            pager->dirty_list[pager->num_dirty++] = page_num;
+        }
+        return;
+    }
+    int32_t frame_num = pager_lookup(pager, page_num);
+    if (frame_num == -1) {
+        printf("Tried to mark page %d dirty, but it is not in the buffer pool\n", page_num);
+        exit(EXIT_FAILURE);
+    }
+    pager->frames[frame_num].dirty = true;
+}
+
+// 取消一次对页面的固定
+void
+pager_unpin(Pager *pager, uint32_t page_num){
+    int32_t frame_num = pager_lookup(pager, page_num);
+    if (frame_num != -1 && pager->frames[frame_num].pin_count > 0) {
+        pager->frames[frame_num].pin_count--;
+    }
+}
+
+// 固定一个帧, 记下从未固定变为固定的帧, 语句结束时只需要处理它们
+void
+pager_pin(Pager *pager, int32_t frame_num){
+    if (pager->frames[frame_num].pin_count++ == 0) {
+        if (pager->num_pinned < pager->num_frames) {
+            pager->pinned[pager->num_pinned++] = frame_num;
+        }else {
+            pager->pinned_overflow = true;
+        }
+    }
+}
+
+// 语句结束时, 释放它固定的所有页面
+// 每条语句只固定少数几个帧, 不需要扫描整个缓冲池; 记录放不下时才扫描所有的帧
+void
+pager_unpin_all(Pager *pager){
+    if (pager->pinned_overflow) {
+        for (uint32_t i = 0; i < pager->frames_used; i++) {
+            pager->frames[i].pin_count = 0;
+        }
+    }else {
+        for (uint32_t i = 0; i < pager->num_pinned; i++) {
+            pager->frames[pager->pinned[i]].pin_count = 0;
+        }
+    }
+    pager->num_pinned = 0;
+    pager->pinned_overflow = false;
+}
+
+void
+print_pager_stats(Pager *pager){
+    uint64_t accesses = pager->stats.hits + pager->stats.misses;
+    printf("Cache:\n");
+    if (pager->mmap) {
+        printf("mmap: %d pages mapped\n", pager->map_pages);
+    }else {
+        printf("frames: %d (%d used)\n", pager->num_frames, pager->frames_used);
+    }
+    printf("hits: %lu\n", pager->stats.hits);
+    printf("misses: %lu\n", pager->stats.misses);
+    printf("evictions: %lu\n", pager->stats.evictions);
+    printf("pages written: %lu (%lu write calls)\n", pager->stats.pages_written, pager->stats.write_calls);
+    printf("hit ratio: %.2f%%\n", accesses ? 100.0 * pager->stats.hits / accesses : 0.0);
+
+    void *header = get_page(pager, HEADER_PAGE_NUM);
+    printf("pages: %d (%d free)\n", pager->num_pages, *header_free_count(header));
+    pager_unpin(pager, HEADER_PAGE_NUM);
+}
+
+// 语句执行之后: .timer on 时打印耗时和访问的页数, 超过阈值时写入慢语句日志
+// 访问的页数是 get_page 的次数, 读入的页数是真正从文件读取的页数
+void
+statement_report(DbConfig *config, const char *text, Statement *statement, Table *table,
+                 PagerStats *before, PagerStats *after, uint64_t elapsed_ns){
+    uint64_t touched = (after->hits + after->misses) - (before->hits + before->misses);
+    uint64_t pages_read = after->pages_read - before->pages_read;
+    if (config->timer) {
+        printf("Run Time: %.3f ms, pages: %lu touched, %lu read\n", elapsed_ns / 1e6, touched, pages_read);
+    }
+    if (config->slow_log_file && elapsed_ns >= (uint64_t)config->slow_ms * 1000000) {
+        char timestamp[32];
+        time_t now = time(NULL);
+        strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", localtime(&now));
+        fprintf(config->slow_log_file, "%s\t%.3f ms\tplan=%s\tpages=%lu\tmisses=%lu\tread=%lu\t%s\n",
+                timestamp, elapsed_ns / 1e6, statement_plan(statement, table), touched,
+                after->misses - before->misses, pages_read, text);
+        fflush(config->slow_log_file);
+    }
+}
+
+// 语句访问数据的方式: 单个主键是点查找, 整个键空间是全表扫描, 否则是范围扫描;
+// 按 username/email 查找时是索引查找(不回表时是覆盖索引), 没有索引时是全表扫描加过滤
+const char*
+statement_plan(Statement *statement, Table *table){
+    switch (statement->type) {
+        case INSERT:
+            return "insert";
+        case SELECT:
+            if (statement->where_column != COLUMN_ID) {
+                if (table->index_roots[statement->where_column] == 0) {
+                    return "filter_scan";
+                }
+                return statement_covered(statement) ? "covering_index" : "index_seek";
+            }
+            // fall through
+        case DELETE:
+        case UPDATE:
+            if (statement->key_low == statement->key_high) {
+                return "point";
+            }
+            if (statement->key_low == 0 && statement->key_high == UINT64_MAX) {
+                return "full_scan";
+            }
+            return "range";
+        case CREATE_INDEX:
+            return "create_index";
+        case BEGIN:
+        case COMMIT:
+            break;
+    }
+    return "none";
+}
+
+// .stats: 计数器之外, 树的高度和叶节点的填充率在这里沿着叶节点链表现场计算
+void
+print_stats(Table *table){
+    Pager *pager = table->pager;
+    PagerStats *stats = &pager->stats;
+    uint64_t accesses = stats->hits + stats->misses;
+    printf("Stats:\n");
+    printf("cache: %lu hits, %lu misses (%.2f%% hit ratio), %lu evictions\n", stats->hits, stats->misses,
+           accesses ? 100.0 * stats->hits / accesses : 0.0, stats->evictions);
+    printf("pages read: %lu\n", stats->pages_read);
+    printf("pages written: %lu (%lu WAL frames)\n", stats->pages_written, stats->wal_frames);
+    printf("bytes read: %lu\n", stats->bytes_read);
+    printf("bytes written: %lu\n", stats->bytes_written);
+    printf("splits: %lu leaf, %lu internal\n", stats->leaf_splits, stats->internal_splits);
+    printf("select rows: %lu scanned, %lu returned\n", stats->rows_scanned, stats->rows_returned);
+    printf("pages prefetched: %lu\n", stats->prefetches);
+    uint64_t cpu_ns = stats->busy_ns > stats->io_ns ? stats->busy_ns - stats->io_ns : 0;
+    printf("time: %.3f ms io, %.3f ms cpu\n", stats->io_ns / 1e6, cpu_ns / 1e6);
+
+    // 下面遍历整棵树和索引, 页面用 pager_peek_page 读: 不进入缓冲池, 不会把工作集挤出去;
+    // 读文件时累加的计数器在最后恢复, 下一次 .stats 看到的仍然只是语句的访问
+    PagerStats saved = pager->stats;
+    void *buffer;
+    if (posix_memalign(&buffer, pager->io_align, PAGE_SIZE)) {
+        printf("Unable to allocate stats buffer\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // 树的高度: 沿最左边的孩子下降
+    uint32_t height = 1;
+    void *node = pager_peek_page(pager, table->root_page_num, buffer);
+    while (get_node_type(node) == NODE_INTERNAL) {
+        node = pager_peek_page(pager, *internal_node_child(node, 0), buffer);
+        height++;
+    }
+
+    // 沿叶节点链表统计已用和碎片字节
+    uint64_t leaves = 0, used_bytes = 0, fragmented = 0, cells = 0;
+    while (true) {
+        leaves++;
+        used_bytes += leaf_node_used_bytes(node);
+        fragmented += *leaf_node_fragmented(node);
+        cells += *leaf_node_num_cells(node);
+        uint32_t next_page_num = *leaf_node_next_leaf(node);
+        if (next_page_num == 0) {
+            break;
+        }
+        node = pager_peek_page(pager, next_page_num, buffer);
+    }
+
+    uint32_t free_pages = *header_free_count(pager_peek_page(pager, HEADER_PAGE_NUM, buffer));
+    printf("page size: %u\n", PAGE_SIZE);
+    printf("tree height: %u\n", height);
+    uint64_t index_pages = 0;
+    for (Column column = COLUMN_USERNAME; column < COLUMN_COUNT; column++) {
+        if (table->index_roots[column] != 0) {
+            print_index_stats(table, column, buffer, &index_pages);
+        }
+    }
+    free(buffer);
+    pager->stats = saved;
+    printf("pages: %u (%lu leaf, %lu internal, %lu index, %u free)\n", pager->num_pages, leaves,
+           pager->num_pages - 1 - leaves - index_pages - free_pages, index_pages, free_pages);
+    printf("rows in table: %lu\n", cells);
+    printf("leaf fill: %.1f%% (%lu bytes fragmented)\n",
+           100.0 * used_bytes / (leaves * LEAF_NODE_SPACE_FOR_CELLS), fragmented);
+}
+
+void
+print_wal_stats(Pager *pager){
+    const char *modes[] = {"off", "normal", "full"};
+    printf("WAL:\n");
+    printf("durability: %s\n", modes[pager->durability]);
+    if (pager->wal) {
+        printf("frames: %d\n", pager->wal->num_frames);
+    }
+    printf("frames written: %lu\n", pager->stats.wal_frames);
+    printf("commits: %lu\n", pager->stats.commits);
+    printf("syncs: %lu\n", pager->stats.syncs);
+    printf("checkpoints: %lu\n", pager->stats.checkpoints);
+}
+
+// 新建表
+Table*
+db_open(const char *filename, DbConfig *config){
+    Pager *pager = pager_open(filename, config);
+
+    Table *table = malloc(sizeof(Table));
+    table->pager = pager;
+    table->append_page_num = INVALID_PAGE_NUM;
+    table->scan_threads = 1;
+    if (config->scan_threads > 1) {
+        table->scan_threads = config->scan_threads < MAX_SCAN_THREADS ? config->scan_threads : MAX_SCAN_THREADS;
+    }
+
+    // 新数据库文件: 第 0 页是数据库头, 根节点从第 1 页开始
+    bool new_file = pager->num_pages == 0;
+    void *header = get_page(pager, HEADER_PAGE_NUM);
+    if (new_file) {
+        memset(header, 0, PAGE_SIZE);
+        *header_magic(header) = DB_MAGIC;
+        *header_root_page(header) = 1;
+        *header_version(header) = DB_FORMAT_VERSION;
+        *header_page_size(header) = PAGE_SIZE;
+        *header_page_count(header) = 2;
+        pager_mark_dirty(pager, HEADER_PAGE_NUM);
+
+        void *root_node = get_page(pager, 1);
+        initialize_leaf_node(root_node);
+        set_node_root(root_node, true);
+        pager_mark_dirty(pager, 1);
+        pager_unpin(pager, 1);
+    }else if (*header_magic(header) != DB_MAGIC) {
+        printf("File is not a database.\n");
+        exit(EXIT_FAILURE);
+    }else if (*header_version(header) > DB_FORMAT_VERSION) {
+        printf("Unsupported database format version %d.\n", *header_version(header));
+        exit(EXIT_FAILURE);
+    }else if (*header_version(header) < 2) {
+        // 版本 0 和 1 的键是 32 位的, 节点布局不同, 只能用旧版本读出所有的行再 .import 到新的数据库中
+        printf("Database format version %d uses 32-bit keys. Dump it with an older build and .import the rows.\n",
+               *header_version(header));
+        exit(EXIT_FAILURE);
+    }
+    table->root_page_num = *header_root_page(header);
+    for (Column column = 0; column < COLUMN_COUNT; column++) {
+        table->index_roots[column] = *header_index_root(header, column);
+    }
+    pager_unpin(pager, HEADER_PAGE_NUM);
+
+    return table;
+}
+
+// 关闭数据库
+void
+db_close(Table *table){
+    Pager *pager = table->pager;
+
+    // 开启 WAL 时提交剩下的修改(包括没有 commit 的事务)并做检查点, 否则只把修改过的页面写回文件
+    pager->in_transaction = false;
+    if (pager->wal) {
+        pager_commit(pager, true);
+        pager_checkpoint(pager);
+        unlink(pager->wal->filename);
+        wal_close(pager->wal);
+    }else {
+        pager_flush_all(pager);
+    }
+
+    int result = close(pager->file_descriptor);
+    if (result == -1) {
+        printf("Error closing db file.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (pager->mmap) {
+        munmap(pager->map, MMAP_RESERVE_BYTES);
+        free(pager->dirty_map);
+        free(pager->dirty_list);
+    }else {
+        free(pager->arena);
+    }
+    free(pager->frames);
+    free(pager->pinned);
+    free(pager->buckets);
+    free(pager);
+    free(table);
+}
+
+// 将表（内存中）中对应的页些入文件中
+void 
+pager_flush(Pager *pager, uint32_t page_num){
+    int32_t frame_num = pager_lookup(pager, page_num);
+    if (frame_num == -1) {
+        printf("Tried to flush null page\n");
+        exit(EXIT_FAILURE);
+    }
+    pager_write_frame(pager, frame_num);
+}
+
+// 将帧中的页面写到它在文件中的位置
+void
+pager_write_frame(Pager *pager, uint32_t frame_num){
+    DirtyPage page = {pager->frames[frame_num].page_num, frame_num};
+    pager_write_run(pager, &page, 1);
+}
+
+// 收集缓冲池中所有的脏页, 按页号排序
+uint32_t
+pager_collect_dirty(Pager *pager, DirtyPage **dirty_pages){
+    // 映射模式下页号就是帧号; 调用者马上写出这些页面, 所以这里直接清除脏标记
+    if (pager->mmap) {
+        uint32_t num_dirty = pager->num_dirty;
+        *dirty_pages = malloc((num_dirty + 1) * sizeof(DirtyPage));
+        for (uint32_t i = 0; i < num_dirty; i++) {
+            uint32_t page_num = pager->dirty_list[i];
+            (*dirty_pages)[i].page_num = page_num;
+            (*dirty_pages)[i].frame_num = page_num;
+            pager->dirty_map[page_num] = false;
+        }
+        pager->num_dirty = 0;
+        qsort(*dirty_pages, num_dirty, sizeof(DirtyPage), compare_dirty_page);
+        return num_dirty;
+    }
+    *dirty_pages = malloc((pager->frames_used + 1) * sizeof(DirtyPage));
+    uint32_t num_dirty = 0;
+    for (uint32_t i = 0; i < pager->frames_used; i++) {
+        if (pager->frames[i].in_use && pager->frames[i].dirty) {
+            (*dirty_pages)[num_dirty].page_num = pager->frames[i].page_num;
+            (*dirty_pages)[num_dirty].frame_num = i;
+            num_dirty++;
+        }
+    }
+    qsort(*dirty_pages, num_dirty, sizeof(DirtyPage), compare_dirty_page);
+    return num_dirty;
+}
+
+// 写回所有脏页
+// 脏页按页号排序, 页号连续的一段合并成一次 pwritev
+void
+pager_flush_all(Pager *pager){
+    pager_update_page_count(pager);
+    DirtyPage *dirty_pages;
+    uint32_t num_dirty = pager_collect_dirty(pager, &dirty_pages);
+
+    uint32_t run_start = 0;
+    for (uint32_t i = 1; i <= num_dirty; i++) {
+        if (i == num_dirty || dirty_pages[i].page_num != dirty_pages[i - 1].page_num + 1
+                || i - run_start == PAGER_MAX_IOV) {
+            pager_write_run(pager, dirty_pages + run_start, i - run_start);
+            run_start = i;
+        }
+    }
+    free(dirty_pages);
+    pager_map_refresh(pager);
+}
+
+// 页面写出之后清除脏标记; 映射模式下 pager_collect_dirty 已经清除过了
+void
+pager_clear_dirty(Pager *pager, uint32_t frame_num){
+    if (!pager->mmap) {
+        pager->frames[frame_num].dirty = false;
+    }
+}
+
+int
+compare_dirty_page(const void *a, const void *b){
+    uint32_t page_a = ((const DirtyPage *)a)->page_num;
+    uint32_t page_b = ((const DirtyPage *)b)->page_num;
+    return (page_a > page_b) - (page_a < page_b);
+}
+
+// 用一次 pwritev 写回一段页号连续的页面, 并清除它们的脏标记
+void
+pager_write_run(Pager *pager, DirtyPage *run, uint32_t run_length){
+    struct iovec iov[PAGER_MAX_IOV];
+    for (uint32_t i = 0; i < run_length; i++) {
+        iov[i].iov_base = pager_frame_data(pager, run[i].frame_num);
+        iov[i].iov_len = PAGE_SIZE;
+    }
+
+    off_t offset = (off_t)run[0].page_num * PAGE_SIZE;
+    uint64_t start = clock_ns();
+    ssize_t bytes_written = pwritev(pager->file_descriptor, iov, run_length, offset);
+    if (bytes_written != (ssize_t)run_length * PAGE_SIZE) {
+        printf("Error writing: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    pager->stats.io_ns += clock_ns() - start;
+    pager->stats.bytes_written += bytes_written;
+
+    for (uint32_t i = 0; i < run_length; i++) {
+        pager_clear_dirty(pager, run[i].frame_num);
+    }
+    pager->stats.pages_written += run_length;
+    pager->stats.write_calls++;
+
+    if (offset + bytes_written > pager->file_length) {
+        pager->file_length = offset + bytes_written;
+    }
+}
+
+// 提交当前语句的修改: 把所有脏页作为一组帧追加到 WAL, 最后一帧带提交标记
+// FULL 模式下提交要等到 fdatasync 之后才算完成, sync_now 为 false 时推迟到
+// 没有后续输入或者攒够 WAL_GROUP_COMMIT_MAX 个提交, 让多个提交共享一次 fdatasync
+void
+pager_commit(Pager *pager, bool sync_now){
+    Wal *wal = pager->wal;
+    // 事务中的修改在 commit 时一起提交
+    if (wal == NULL || pager->in_transaction) {
+        return;
+    }
+    pager_update_page_count(pager);
+
+    DirtyPage *dirty_pages;
+    uint32_t num_dirty = pager_collect_dirty(pager, &dirty_pages);
+    if (num_dirty > 0 || wal->uncommitted_frames > 0) {
+        wal_write_frames(pager, dirty_pages, num_dirty, true);
+    }
+    free(dirty_pages);
+
+    if (pager->durability == DURABILITY_FULL && wal->pending_syncs > 0
+            && (sync_now || wal->pending_syncs >= WAL_GROUP_COMMIT_MAX)) {
+        pager_sync(pager);
+    }
+    if (wal->num_frames >= WAL_CHECKPOINT_FRAMES) {
+        pager_checkpoint(pager);
+    }
+}
+
+// 单调时钟, 纳秒, 用于统计时间
+uint64_t
+clock_ns(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// 将 WAL 落盘
+void
+pager_sync(Pager *pager){
+    uint64_t start = clock_ns();
+    if (fdatasync(pager->wal->file_descriptor) == -1) {
+        printf("Error syncing WAL: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    pager->stats.io_ns += clock_ns() - start;
+    pager->wal->pending_syncs = 0;
+    pager->stats.syncs++;
+}
+
+// 接下来最多还要向标准输出写 upcoming 个字节 (SIZE_MAX 表示不确定或者马上要写出)
+// FULL 模式下 "Executed." 要等提交落盘后才能让读者看到, 缓冲区可能写出时先 fdatasync
+void
+output_reserve(Pager *pager, size_t upcoming){
+    if (pager->durability != DURABILITY_FULL || pager->wal == NULL || pager->wal->pending_syncs == 0) {
+        return;
+    }
+    if (upcoming >= OUTPUT_BUFFER_SIZE || __fpending(stdout) + upcoming >= OUTPUT_BUFFER_SIZE) {
+        pager_sync(pager);
+    }
+}
+
+// 检查点: 把 WAL 中每个页面最新的镜像拷贝回数据库文件, 然后清空 WAL
+// 只能在提交之后调用, 此时 WAL 中没有未提交的帧
+void
+pager_checkpoint(Pager *pager){
+    Wal *wal = pager->wal;
+    if (wal->num_frames == 0) {
+        return;
+    }
+
+    // WAL 必须先落盘, 才能开始改写数据库文件
+    pager_sync(pager);
+
+    DirtyPage *pages = malloc(wal->index_count * sizeof(DirtyPage));
+    uint32_t num_pages = 0;
+    for (uint32_t i = 0; i < wal->index_capacity; i++) {
+        if (wal->index[i].page_num != WAL_NO_PAGE) {
+            pages[num_pages].page_num = wal->index[i].page_num;
+            pages[num_pages].frame_num = wal->index[i].frame_num;
+            num_pages++;
+        }
+    }
+    qsort(pages, num_pages, sizeof(DirtyPage), compare_dirty_page);
+
+    // 页号连续的一段先从 WAL 读进对齐的缓冲区, 再用一次 pwritev 写回, O_DIRECT 模式也可以直接写
+    uint64_t start = clock_ns();
+    void *buffer;
+    if (posix_memalign(&buffer, pager->io_align, (size_t)PAGER_MAX_IOV * PAGE_SIZE)) {
+        printf("Unable to allocate checkpoint buffer\n");
+        exit(EXIT_FAILURE);
+    }
+    struct iovec iov[PAGER_MAX_IOV];
+    uint32_t run_start = 0;
+    for (uint32_t i = 0; i < num_pages; i++) {
+        void *page = buffer + (size_t)(i - run_start) * PAGE_SIZE;
+        off_t wal_offset = wal_frame_offset(pages[i].frame_num) + sizeof(WalFrameHeader);
+        if (pread(wal->file_descriptor, page, PAGE_SIZE, wal_offset) != PAGE_SIZE) {
+            printf("Error checkpointing: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        iov[i - run_start].iov_base = page;
+        iov[i - run_start].iov_len = PAGE_SIZE;
+
+        uint32_t run_length = i + 1 - run_start;
+        if (i + 1 < num_pages && pages[i + 1].page_num == pages[i].page_num + 1 && run_length < PAGER_MAX_IOV) {
+            continue;
         }
+        off_t offset = (off_t)pages[run_start].page_num * PAGE_SIZE;
+        if (pwritev(pager->file_descriptor, iov, run_length, offset) != (ssize_t)run_length * PAGE_SIZE) {
+            printf("Error checkpointing: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        pager->stats.write_calls++;
+        if (offset + (off_t)run_length * PAGE_SIZE > pager->file_length) {
+            pager->file_length = offset + (off_t)run_length * PAGE_SIZE;
+        }
+        run_start = i + 1;
     }
-}
-
-InputBuffer*
-new_input_buffer(){
-    InputBuffer* input_buffer = malloc(sizeof(InputBuffer));
-    input_buffer->buffer = NULL;
-    input_buffer->buffer_length = 0;
-    input_buffer->input_length = 0;
-    return input_buffer;
-}
+    free(buffer);
+    free(pages);
 
-// 打印用户提示符
-void
-print_prompt(){
-    printf("acdb >");
+    if (fdatasync(pager->file_descriptor) == -1) {
+        printf("Error syncing db file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    pager->stats.io_ns += clock_ns() - start;
+    pager->stats.pages_read += num_pages;
+    pager->stats.pages_written += num_pages;
+    pager->stats.bytes_read += (uint64_t)num_pages * PAGE_SIZE;
+    pager->stats.bytes_written += (uint64_t)num_pages * PAGE_SIZE;
+    wal_reset(wal);
+    pager->stats.checkpoints++;
+    pager_map_refresh(pager);
 }
 
-// 打印行
+// 映射模式: 预留地址空间, 把整个文件按 MAP_PRIVATE 映射到开头, 之后的页面按需变为可访问的匿名内存
+// 在 WAL 恢复之后调用, 此时文件中就是所有页面最新的镜像
 void
-print_row(Row *row){
-    printf("(%d, %s, %s)\n", row->id, row->username, row->email);
+pager_map_open(Pager *pager){
+    pager->map = mmap(NULL, MMAP_RESERVE_BYTES, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (pager->map == MAP_FAILED) {
+        printf("Unable to reserve address space for mmap: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    pager->map_pages = 0;
+    pager->dirty_map = NULL;
+    pager->dirty_list = NULL;
+    pager->num_dirty = 0;
+    pager->dirty_capacity = 0;
+    pager->arena = pager->map;
+    pager_map_extend(pager, pager->num_pages);
+    pager_map_refresh(pager);
 }
 
-// 将读取的信息进行一个简单的封装
+// 让前 num_pages 页可以访问, 每次扩展 MMAP_EXTENT_PAGES 的整数倍
+// 文件之外的部分是匿名内存, 不需要用 ftruncate 扩展文件, 页面写出时 pwrite 自然扩展文件
 void
-read_input(InputBuffer *input_buffer){
-    //getline 的第一个参数会被分配, 所以关闭时要free
-    ssize_t bytes_read = getline(&(input_buffer->buffer), &(input_buffer->buffer_length), stdin);
-    if (bytes_read <= 0) {
-        printf("Error reading input\n");
+pager_map_extend(Pager *pager, uint32_t num_pages){
+    if (num_pages <= pager->map_pages) {
+        return;
+    }
+    uint32_t map_pages = (num_pages + MMAP_EXTENT_PAGES - 1) / MMAP_EXTENT_PAGES * MMAP_EXTENT_PAGES;
+    if ((uint64_t)map_pages * PAGE_SIZE > MMAP_RESERVE_BYTES) {
+        printf("Database is too large for mmap mode.\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t offset = (size_t)pager->map_pages * PAGE_SIZE;
+    if (mprotect((uint8_t *)pager->map + offset, (size_t)map_pages * PAGE_SIZE - offset, PROT_READ | PROT_WRITE) == -1) {
+        printf("Unable to extend mapping: %d\n", errno);
         exit(EXIT_FAILURE);
     }
-    // 忽略结尾的换行符
-    input_buffer->input_length = bytes_read - 1;
-    input_buffer->buffer[bytes_read - 1] = '\0';
+    pager->dirty_map = realloc(pager->dirty_map, map_pages);
+    memset(pager->dirty_map + pager->map_pages, 0, map_pages - pager->map_pages);
+    pager->map_pages = map_pages;
 }
 
-// 关闭input_buffer
+// 所有修改都写回数据库文件之后, 重新把文件映射到同一个地址: 私有的副本和匿名页被丢弃,
+// 内存中只剩和页缓存共享的干净页面。地址不变, 内容也相同, 已经拿到的页面指针仍然有效
+// 可写的私有映射默认按整个长度计入内存承诺, 比内存大的文件会被拒绝, 所以加上 MAP_NORESERVE;
+// 缺页时内核默认连带读入周围的一大段, 随机访问时大部分是浪费, 顺序扫描已经有 leaf_readahead 提前通知, 所以用 MADV_RANDOM
 void
-close_input_buffer(InputBuffer *input_buffer){
-    free(input_buffer->buffer);
-    free(input_buffer);
-}
-
-// 识别原名令
-MetaResult
-do_meta_command(InputBuffer *input_buffer, Table *table){
-    if (strcmp(input_buffer->buffer, ".exit") == 0) {
-        close_input_buffer(input_buffer);
-        db_close(table);
-        exit(EXIT_SUCCESS);
-    }else if (strcmp(input_buffer->buffer, ".constants") == 0) {
-        printf("Constants:\n");
-        print_constants();
-        return META_SUCCESS;
-    }else if (strcmp(input_buffer->buffer, ".btree") == 0) {
-        printf("Tree:\n");
-        print_tree(table->pager, 0, 0);
-        return META_SUCCESS;
-    }else {
-        return META_UNRECOGNIZED_COMMAND;
+pager_map_refresh(Pager *pager){
+    if (!pager->mmap || pager->map == NULL || pager->num_dirty > 0
+            || (pager->wal && pager->wal->num_frames > 0) || pager->file_length == 0) {
+        return;
     }
+    if (mmap(pager->map, pager->file_length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED | MAP_NORESERVE,
+             pager->file_descriptor, 0) == MAP_FAILED) {
+        printf("Unable to map database file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    madvise(pager->map, pager->file_length, MADV_RANDOM);
 }
 
-// 判读语句是否可以执行, 并将可执行的语句类型添加到信息中
-PreapareResult
-preapare_statement(InputBuffer *input_buffer, Statement *statement){
-    if (!strncmp(input_buffer->buffer, "insert", 6)) {
-        return preapare_insert(input_buffer, statement);
-    }else if (!strcmp(input_buffer->buffer, "select")) {
-        statement->type = SELECT;
-        return PREPARE_SUCCESS;
+// 打开数据库文件旁边的 WAL 文件 (<filename>-wal)
+Wal*
+wal_open(const char *filename, Pager *pager){
+    Wal *wal = malloc(sizeof(Wal));
+    wal->filename = malloc(strlen(filename) + 5);
+    sprintf(wal->filename, "%s-wal", filename);
+
+    wal->file_descriptor = open(wal->filename, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+    if (wal->file_descriptor == -1) {
+        printf("Unable to open WAL file\n");
+        exit(EXIT_FAILURE);
     }
 
-    return PREPARE_UNRECOGNIZED_STATEMENT;
+    wal->index_capacity = 1024;
+    wal->index = malloc(wal->index_capacity * sizeof(WalIndexEntry));
+    wal->salt = (uint32_t)time(NULL) ^ (uint32_t)getpid();
+    wal_index_clear(wal);
+    return wal;
 }
 
-PreapareResult
-preapare_insert(InputBuffer *input_buffer, Statement *statement){
-    statement->type = INSERT;
-
-    char *keyword = strtok(input_buffer->buffer, " ");
-    char *id_str = strtok(NULL, " ");
-    char *username= strtok(NULL, " ");
-    char *email = strtok(NULL, " ");
+void
+wal_close(Wal *wal){
+    close(wal->file_descriptor);
+    free(wal->filename);
+    free(wal->index);
+    free(wal);
+}
 
-    // 判断是否都存在
-    if (!(id_str && username && email)) {
-        return PREPARE_SYNTAX_ERROR;
+// 清空 WAL, 换一个新的 salt 使旧的帧全部失效
+void
+wal_reset(Wal *wal){
+    if (ftruncate(wal->file_descriptor, 0) == -1) {
+        printf("Error truncating WAL: %d\n", errno);
+        exit(EXIT_FAILURE);
     }
 
-    int id = atoi(id_str);
-    if (id < 0) {
-        return PREPARE_NEGATIVE_ID;
-    }
-    // 长度是否满足
-    if (strlen(username) > COLUMN_USERNAME_SIZE || strlen(email) > COLUMN_EMAIL_SIZE) {
-        return PREPARE_STRING_TOO_LONG;
+    wal->salt++;
+    WalHeader header = {WAL_MAGIC, WAL_VERSION, PAGE_SIZE, wal->salt};
+    if (pwrite(wal->file_descriptor, &header, sizeof(WalHeader), 0) != sizeof(WalHeader)) {
+        printf("Error writing WAL header: %d\n", errno);
+        exit(EXIT_FAILURE);
     }
 
-    statement->row_to_insert.id = id;
-    strcpy(statement->row_to_insert.username, username);
-    strcpy(statement->row_to_insert.email, email);
-    
-    return PREPARE_SUCCESS;
+    wal->checksum = wal->salt;
+    wal->num_frames = 0;
+    wal->uncommitted_frames = 0;
+    wal->pending_syncs = 0;
+    wal_index_clear(wal);
 }
 
-ExecuteResult
-execute_statement(Statement statement, Table *table){
-    switch (statement.type) {
-        case INSERT:
-            return execute_insert(statement, table);
-        case SELECT:
-            return execute_select(statement, table);
+// 打开数据库时重放 WAL: 找到最后一个完整的提交帧, 把它之前的帧拷贝回数据库文件
+void
+wal_recover(Wal *wal, Pager *pager){
+    WalHeader header;
+    off_t wal_length = lseek(wal->file_descriptor, 0, SEEK_END);
+    if (wal_length < (off_t)sizeof(WalHeader)
+            || pread(wal->file_descriptor, &header, sizeof(WalHeader), 0) != sizeof(WalHeader)
+            || header.magic != WAL_MAGIC || header.version != WAL_VERSION
+            || header.page_size != PAGE_SIZE) {
+        wal_reset(wal);
+        return;
     }
-}
-
-// 向表中插入数据
-ExecuteResult
-execute_insert(Statement statement, Table *table){
-    void *node = get_page(table->pager, table->root_page_num);
-    uint32_t num_cells = *leaf_node_num_cells(node);
-
-    Row *row_to_insert = &(statement.row_to_insert);
-    uint32_t key_to_insert = row_to_insert->id; 
-    Cursor *cursor = table_find(table, key_to_insert);
 
-    if (cursor->cell_num < num_cells) {
-        uint32_t key_at_index = *leaf_node_key(node, cursor->cell_num);
-        if (key_at_index == key_to_insert) {
-            return EXECUTE_DUPLICATE_KEY;
+    // 第一遍: 校验帧的链式校验和, 找到最后一个提交帧
+    uint32_t frame_size = sizeof(WalFrameHeader) + PAGE_SIZE;
+    void *frame = malloc(frame_size);
+    WalFrameHeader *frame_header = frame;
+    uint32_t checksum = header.salt;
+    uint32_t num_committed = 0, db_pages = 0;
+    for (uint32_t i = 0; wal_frame_offset(i) + frame_size <= wal_length; i++) {
+        if (pread(wal->file_descriptor, frame, frame_size, wal_frame_offset(i)) != frame_size
+                || frame_header->salt != header.salt) {
+            break;
+        }
+        checksum = wal_checksum(checksum, frame, offsetof(WalFrameHeader, checksum));
+        checksum = wal_checksum(checksum, frame_header + 1, PAGE_SIZE);
+        if (checksum != frame_header->checksum) {
+            break;
+        }
+        if (frame_header->db_pages) {
+            num_committed = i + 1;
+            db_pages = frame_header->db_pages;
         }
     }
 
-    leaf_node_insert(cursor, row_to_insert->id, row_to_insert);
-    free(cursor);
-    return EXECUTE_SUCCESS;
-}
-
-// 使用游标来读取表，每循环一次游标推进1
-ExecuteResult
-execute_select(Statement statement, Table *table){
-    Cursor* cursor = table_start(table);
-
-    Row row;
-    while (!(cursor->end_of_table)) {
-        deserialize_row(cursor_value(cursor), &row);
-        print_row(&row);
-        cursor_advance(cursor);
+    // 第二遍: 为提交过的帧建立索引, 然后用检查点把它们写回数据库文件
+    wal->salt = header.salt;
+    for (uint32_t i = 0; i < num_committed; i++) {
+        pread(wal->file_descriptor, frame_header, sizeof(WalFrameHeader), wal_frame_offset(i));
+        if (frame_header->page_num != WAL_NO_PAGE) {
+            wal_index_put(wal, frame_header->page_num, i);
+        }
     }
+    free(frame);
 
-    free(cursor);
-    return EXECUTE_SUCCESS;
-}
-
-// 将source信息写入表中的一行
-void
-serialize_row(Row *source, void *destination) {
-    memcpy(destination + ID_OFFSET, &(source->id), ID_SIZE);
-    memcpy(destination + USERNAME_OFFSET, &(source->username), USERNAME_SIZE);
-    memcpy(destination + EMAIL_OFFSET, &(source->email), EMAIL_SIZE);
+    wal->num_frames = num_committed;
+    if (num_committed > 0) {
+        pager->num_pages = db_pages;
+        pager_checkpoint(pager);
+    }else {
+        wal_reset(wal);
+    }
 }
 
-// 从表中读取信息到 source中
-// 此时 source是表的一行, destination存放读取的数据
+// 追加一组帧到 WAL, commit 为 true 时最后一帧是提交帧
+// 写进 WAL 的页面不再是脏页: 之后淘汰它时可以直接丢弃, 需要时再从 WAL 读回
 void
-deserialize_row(void *source, Row *destination){
-    memcpy(&(destination->id), source + ID_OFFSET, ID_SIZE);
-    memcpy(&(destination->username), source + USERNAME_OFFSET, USERNAME_SIZE);
-    memcpy(&(destination->email), source + EMAIL_OFFSET, EMAIL_SIZE);
-}
+wal_write_frames(Pager *pager, DirtyPage *pages, uint32_t num_pages, bool commit){
+    Wal *wal = pager->wal;
+    void *empty_page = NULL;
 
-// 获取指定数值页的地址，如果该页不再内存中，则加载进内存
-void*
-get_page(Pager *pager, uint32_t page_num){
-    if (page_num >= TABLE_MAX_PAGES ) {
-        printf("Tried to fetch page number out of bounds. %d > %d\n", page_num, TABLE_MAX_PAGES);
-        exit(EXIT_FAILURE);
+    // 所有页面都已经作为未提交帧溢出到 WAL 时, 单独写一个只带提交标记的帧
+    DirtyPage marker = {WAL_NO_PAGE, 0};
+    if (num_pages == 0) {
+        empty_page = calloc(1, PAGE_SIZE);
+        pages = &marker;
+        num_pages = 1;
     }
 
-    // 缓存中没有, 分配内存，并将同一页的数据加载到内存
-    if (pager->pages[page_num] == NULL) {
-        void *page = malloc(PAGE_SIZE);
-        uint32_t num_pages = pager->file_length / PAGE_SIZE; // 得到现有完整的页数
-
-        // 当存在不满一页的数据时，将其视为一页
-        if (pager->file_length % PAGE_SIZE) {
-            num_pages++;
-        }
+    WalFrameHeader *headers = malloc(num_pages * sizeof(WalFrameHeader));
+    struct iovec iov[PAGER_MAX_IOV];
+    uint32_t batch_start = 0;
+    for (uint32_t i = 0; i < num_pages; i++) {
+        void *page = pages[i].page_num == WAL_NO_PAGE ? empty_page
+                                                      : pager_frame_data(pager, pages[i].frame_num);
+        WalFrameHeader *header = &headers[i];
+        header->page_num = pages[i].page_num;
+        header->db_pages = (commit && i == num_pages - 1) ? pager->num_pages : 0;
+        header->salt = wal->salt;
+        wal->checksum = wal_checksum(wal->checksum, header, offsetof(WalFrameHeader, checksum));
+        wal->checksum = wal_checksum(wal->checksum, page, PAGE_SIZE);
+        header->checksum = wal->checksum;
 
-        // 如果访问的页中有数据
-        if (page_num <= num_pages) {
-            lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-            ssize_t bytes_read = read(pager->file_descriptor, page, PAGE_SIZE);
+        uint32_t batch_index = i - batch_start;
+        iov[2 * batch_index].iov_base = header;
+        iov[2 * batch_index].iov_len = sizeof(WalFrameHeader);
+        iov[2 * batch_index + 1].iov_base = page;
+        iov[2 * batch_index + 1].iov_len = PAGE_SIZE;
 
-            if (bytes_read == -1) {
-                printf("Error reading file: %d\n", errno);
+        // 一批帧用一次 pwritev 写入
+        if (2 * (batch_index + 1) == PAGER_MAX_IOV || i == num_pages - 1) {
+            uint32_t batch_frames = batch_index + 1;
+            ssize_t expected = (ssize_t)batch_frames * (sizeof(WalFrameHeader) + PAGE_SIZE);
+            uint64_t start = clock_ns();
+            if (pwritev(wal->file_descriptor, iov, 2 * batch_frames,
+                        wal_frame_offset(wal->num_frames + batch_start)) != expected) {
+                printf("Error writing WAL: %d\n", errno);
                 exit(EXIT_FAILURE);
             }
+            pager->stats.io_ns += clock_ns() - start;
+            pager->stats.bytes_written += expected;
+            batch_start = i + 1;
         }
+    }
 
-        pager->pages[page_num] = page;
-        if (page_num >= pager->num_pages) {
-            pager->num_pages = page_num + 1;
+    for (uint32_t i = 0; i < num_pages; i++) {
+        if (pages[i].page_num != WAL_NO_PAGE) {
+            wal_index_put(wal, pages[i].page_num, wal->num_frames + i);
+            pager_clear_dirty(pager, pages[i].frame_num);
         }
     }
-    return pager->pages[page_num];
-}
+    wal->num_frames += num_pages;
+    pager->stats.wal_frames += num_pages;
 
-// 新建表
-Table*
-db_open(const char *filename){
-    Pager *pager = pager_open(filename);
+    if (commit) {
+        wal->uncommitted_frames = 0;
+        wal->pending_syncs++;
+        pager->stats.commits++;
+    }else {
+        wal->uncommitted_frames += num_pages;
+    }
+    free(headers);
+    free(empty_page);
+}
 
-    Table *table = malloc(sizeof(Table));
-    table->pager = pager;
-    table->root_page_num = 0;
+// 第 frame_num 帧在 WAL 文件中的偏移
+off_t
+wal_frame_offset(uint32_t frame_num){
+    return sizeof(WalHeader) + (off_t)frame_num * (sizeof(WalFrameHeader) + PAGE_SIZE);
+}
 
-    // 新数据库文件
-    if (pager->num_pages == 0) {
-        void *root_node = get_page(pager, 0);
-        initialize_leaf_node(root_node);
-        set_node_root(root_node, true);
+// 查找页面在 WAL 中最新的帧, 不在 WAL 中返回 -1
+int32_t
+wal_find_frame(Wal *wal, uint32_t page_num){
+    uint32_t mask = wal->index_capacity - 1;
+    for (uint32_t i = (page_num * 2654435761u) & mask; ; i = (i + 1) & mask) {
+        if (wal->index[i].page_num == page_num) {
+            return wal->index[i].frame_num;
+        }
+        if (wal->index[i].page_num == WAL_NO_PAGE) {
+            return -1;
+        }
     }
-
-    return table;
 }
 
-// 关闭数据库
 void
-db_close(Table *table){
-    Pager *pager = table->pager;
-
-    // 处理填满的页面
-    for (uint32_t i = 0; i < pager->num_pages; i++) {
-        if (pager->pages[i] == NULL) {
-            continue;
+wal_index_put(Wal *wal, uint32_t page_num, uint32_t frame_num){
+    // 装载因子超过一半时扩容
+    if (2 * (wal->index_count + 1) > wal->index_capacity) {
+        WalIndexEntry *old_index = wal->index;
+        uint32_t old_capacity = wal->index_capacity;
+        wal->index_capacity *= 2;
+        wal->index = malloc(wal->index_capacity * sizeof(WalIndexEntry));
+        wal_index_clear(wal);
+        for (uint32_t i = 0; i < old_capacity; i++) {
+            if (old_index[i].page_num != WAL_NO_PAGE) {
+                wal_index_put(wal, old_index[i].page_num, old_index[i].frame_num);
+            }
         }
-        pager_flush(pager, i);
-        free(pager->pages[i]);
-        pager->pages[i] = NULL;
+        free(old_index);
     }
 
-    int result = close(pager->file_descriptor);
-    if (result == -1) {
-        printf("Error closing db file.\n");
-        exit(EXIT_FAILURE);
+    uint32_t mask = wal->index_capacity - 1;
+    uint32_t i = (page_num * 2654435761u) & mask;
+    while (wal->index[i].page_num != WAL_NO_PAGE && wal->index[i].page_num != page_num) {
+        i = (i + 1) & mask;
     }
-
-    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-        void *page = pager->pages[i];
-        if (page) {
-            free(page);
-            pager->pages[i] = NULL;
-        }
+    if (wal->index[i].page_num == WAL_NO_PAGE) {
+        wal->index_count++;
     }
-
-    free(pager);
-    free(table);
+    wal->index[i].page_num = page_num;
+    wal->index[i].frame_num = frame_num;
 }
 
-// 将表（内存中）中对应的页些入文件中
-void 
-pager_flush(Pager *pager, uint32_t page_num){
-    if (pager->pages[page_num] == NULL) {
-        printf("Tried to flush null page\n");
-        exit(EXIT_FAILURE);
+void
+wal_index_clear(Wal *wal){
+    for (uint32_t i = 0; i < wal->index_capacity; i++) {
+        wal->index[i].page_num = WAL_NO_PAGE;
     }
+    wal->index_count = 0;
+}
 
-    off_t offset = lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-
-    if (offset == -1) {
-        printf("Error seeking: %d\n", errno);
-        exit(EXIT_FAILURE);
-    }
-    ssize_t bytes_written = write(pager->file_descriptor, pager->pages[page_num], PAGE_SIZE);
-    if (bytes_written == -1) {
-        printf("Error writing: %d\n", errno);
-        exit(EXIT_FAILURE);
+// 按 32 位字计算的 FNV-1a 校验和, seed 为前一帧的校验和
+uint32_t
+wal_checksum(uint32_t seed, const void *data, size_t length){
+    const uint32_t *words = data;
+    uint32_t hash = seed ^ 2166136261u;
+    for (size_t i = 0; i < length / sizeof(uint32_t); i++) {
+        hash = (hash ^ words[i]) * 16777619u;
     }
+    return hash;
 }
 
 // 从内存中读取表文件
 Pager*
-pager_open(const char *filename){
+pager_open(const char *filename, DbConfig *config){
+    if (config->mmap && config->direct) {
+        printf("--mmap and --direct cannot be used together.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    layout_init(db_read_page_size(filename, config->page_size));
+
     // 读写模式，不存在创建， 读写权限
-    int fd = open(filename, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR );
+    int flags = O_RDWR | O_CREAT;
+    if (config->direct) {
+        flags |= O_DIRECT;
+    }
+    int fd = open(filename, flags, S_IWUSR | S_IRUSR );
 
     if (fd == -1) {
-        printf("Unable to open file\n");
+        if (config->direct && errno == EINVAL) {
+            printf("The file system does not support O_DIRECT\n");
+        }else {
+            printf("Unable to open file\n");
+        }
         exit(EXIT_FAILURE);
     }
 
@@ -365,29 +3972,106 @@ pager_open(const char *filename){
         exit(EXIT_FAILURE);
     }
 
-    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-        pager->pages[i] = NULL;
+    // O_DIRECT 要求缓冲区、偏移和长度按设备的块大小对齐; 页面的偏移和长度都是页大小的整数倍,
+    // 所以页大小必须是块大小的整数倍
+    pager->direct = config->direct;
+    pager->io_align = PAGE_SIZE;
+#ifdef STATX_DIOALIGN
+    if (pager->direct) {
+        struct statx stx;
+        if (statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 && (stx.stx_mask & STATX_DIOALIGN)
+                && stx.stx_dio_offset_align > 0) {
+            if (PAGE_SIZE % stx.stx_dio_offset_align) {
+                printf("Page size %d is not a multiple of the direct I/O block size %d.\n",
+                       PAGE_SIZE, stx.stx_dio_offset_align);
+                exit(EXIT_FAILURE);
+            }
+            if (stx.stx_dio_mem_align > pager->io_align) {
+                pager->io_align = stx.stx_dio_mem_align;
+            }
+        }
+    }
+#endif
+
+    // 所有帧来自一块按页对齐的连续内存
+    pager->num_frames = config->cache_pages;
+    if (posix_memalign(&pager->arena, pager->io_align, (size_t)pager->num_frames * PAGE_SIZE)) {
+        printf("Unable to allocate buffer pool\n");
+        exit(EXIT_FAILURE);
+    }
+    pager->frames = calloc(pager->num_frames, sizeof(Frame));
+    pager->pinned = malloc(pager->num_frames * sizeof(uint32_t));
+    pager->num_pinned = 0;
+    pager->pinned_overflow = false;
+
+    // 哈希桶的数量取不小于帧数两倍的2的幂
+    pager->num_buckets = 1;
+    while (pager->num_buckets < 2 * pager->num_frames) {
+        pager->num_buckets <<= 1;
+    }
+    pager->buckets = malloc(pager->num_buckets * sizeof(int32_t));
+    for (uint32_t i = 0; i < pager->num_buckets; i++) {
+        pager->buckets[i] = -1;
+    }
+
+    pager->frames_used = 0;
+    pager->clock_hand = 0;
+    memset(&pager->stats, 0, sizeof(PagerStats));
+    pthread_rwlock_init(&pager->lock, NULL);
+
+    // 上次没有正常关闭时 WAL 中还有提交过的帧, 不管这次用哪种持久化级别都要先重放
+    pager->durability = config->durability;
+    pager->in_transaction = false;
+    pager->mmap = false;
+    pager->map = NULL;
+    pager->wal = wal_open(filename, pager);
+    wal_recover(pager->wal, pager);
+    if (pager->durability == DURABILITY_OFF) {
+        unlink(pager->wal->filename);
+        wal_close(pager->wal);
+        pager->wal = NULL;
+    }
+    if (config->mmap) {
+        free(pager->arena);
+        pager->mmap = true;
+        pager_map_open(pager);
     }
     return pager;
 }
 
+// 游标指向最左边的叶节点的第一个单元格
 Cursor*
 table_start(Table *table){
-    Cursor *cursor = malloc(sizeof(Cursor));
-    cursor->table = table;
-    cursor->page_num = table->root_page_num;
-    cursor->cell_num = 0;
+    return table_seek(table, 0);
+}
 
-    void *root_node = get_page(table->pager, table->root_page_num);
-    uint32_t num_cells = *leaf_node_num_cells(root_node);
-    cursor->end_of_table = (num_cells == 0);
+// 游标指向第一个不小于 key 的单元格, 没有这样的单元格时 end_of_table 为 true
+// 与 table_find 不同, 返回的游标不会停在叶节点的末尾
+Cursor*
+table_seek(Table *table, uint64_t key){
+    Pager *pager = table->pager;
+    Cursor *cursor = table_find(table, key);
 
+    void *node = get_page(pager, cursor->page_num);
+    pager_unpin(pager, cursor->page_num);
+    if (cursor->cell_num >= *leaf_node_num_cells(node)) {
+        // key 比这个叶节点中所有的键都大, 从右兄弟的第一个单元格开始
+        uint32_t next_page_num = *leaf_node_next_leaf(node);
+        if (next_page_num == 0) {
+            cursor->end_of_table = true;
+        }else {
+            pager_unpin(pager, cursor->page_num);
+            get_page(pager, next_page_num);
+            cursor->page_num = next_page_num;
+            cursor->cell_num = 0;
+        }
+    }
     return cursor;
 }
 
 // 返回给定key的在表中的位置，如果该key存在返回位置，不存在，则返回应该插入的位置
 Cursor*
-table_find(Table *table, uint32_t key){
+table_find(Table *table, uint64_t key){
     uint32_t root_page_num = table->root_page_num;
     void *root_node = get_page(table->pager, root_page_num);
 
@@ -399,20 +4083,51 @@ table_find(Table *table, uint32_t key){
 }
 
 // 推进游标
+// 走到叶节点末尾时沿着兄弟指针进入下一个叶节点, 不需要回到内部节点
+// 游标固定着它所在的叶节点, 离开时释放
 void
 cursor_advance(Cursor *cursor){
-    void *node = get_page(cursor->table->pager, cursor->page_num);
+    Pager *pager = cursor->table->pager;
+    void *node = get_page(pager, cursor->page_num);
+    pager_unpin(pager, cursor->page_num);
 
     cursor->cell_num++;
     if (cursor->cell_num >= *leaf_node_num_cells(node)) {
-        cursor->end_of_table = true;
+        uint32_t next_page_num = *leaf_node_next_leaf(node);
+        if (next_page_num == 0) {
+            cursor->end_of_table = true;
+        }else {
+            pager_unpin(pager, cursor->page_num);
+            get_page(pager, next_page_num);
+            cursor->page_num = next_page_num;
+            cursor->cell_num = 0;
+            leaf_readahead(pager, next_page_num, &cursor->readahead);
+        }
     }
 }
 
+// 获得游标指向的单元格的键
+uint64_t
+cursor_key(Cursor *cursor){
+    void *page = get_page(cursor->table->pager, cursor->page_num);
+    pager_unpin(cursor->table->pager, cursor->page_num);
+
+    return *leaf_node_key(page, cursor->cell_num);
+}
+
+// 游标指向的行的只读视图, 在游标离开这个叶节点之前有效
+void
+cursor_row_view(Cursor *cursor, RowView *view){
+    view->id = cursor_key(cursor);
+    row_view(cursor_value(cursor), view);
+}
+
 // 获得 游标 在表中指向的地址
 void*
 cursor_value(Cursor *cursor){
+    // 页面已经被游标固定, 这里不再增加固定次数
     void *page = get_page(cursor->table->pager, cursor->page_num);
+    pager_unpin(cursor->table->pager, cursor->page_num);
 
     return leaf_node_value(page, cursor->cell_num);
 }
@@ -435,22 +4150,114 @@ leaf_node_num_cells(void *node){
     return node + LEAF_NODE_NUM_CELLS_OFFSET;
 }
 
+uint32_t*
+leaf_node_next_leaf(void *node){
+    return node + LEAF_NODE_NEXT_LEAF_OFFSET;
+}
+
+uint32_t*
+leaf_node_content_start(void *node){
+    return node + LEAF_NODE_CONTENT_START_OFFSET;
+}
+
+uint32_t*
+leaf_node_fragmented(void *node){
+    return node + LEAF_NODE_FRAGMENTED_OFFSET;
+}
+
+// 得到 node节点的第 cell_num 个槽的地址, 槽数组紧跟在键数组之后
+uint16_t*
+leaf_node_slot(void *node, uint32_t cell_num){
+    return node + LEAF_NODE_HEADER_SIZE + LEAF_NODE_KEY_SIZE * *leaf_node_num_cells(node)
+           + LEAF_NODE_OFFSET_SIZE * cell_num;
+}
+
 // 得到 node节点的第 cell_num 个cell(键值信息) 的地址
 void*
 leaf_node_cell(void *node, uint32_t cell_num){
-    return node + LEAF_NODE_HEADER_SIZE + LEAF_NODE_CELL_SIZE * cell_num;
+    return node + *leaf_node_slot(node, cell_num);
 }
 
 // 得到 node节点的第 cell_num 个key 的地址
-uint32_t*
+uint64_t*
 leaf_node_key(void *node, uint32_t cell_num){
-    return leaf_node_cell(node, cell_num);
+    return node + LEAF_NODE_HEADER_SIZE + LEAF_NODE_KEY_SIZE * cell_num;
 }
 
-// 得到 node节点的第 cell_num 个value 的地址
+// 得到 node节点的第 cell_num 个value 的地址, 即序列化的行
 uint32_t*
 leaf_node_value(void *node, uint32_t cell_num){
-    return leaf_node_cell(node, cell_num) + LEAF_NODE_KEY_SIZE;
+    return leaf_node_cell(node, cell_num);
+}
+
+// 叶节点的单元格是序列化的行, 索引节点的单元格是索引项
+uint32_t
+leaf_node_cell_size(void *node, uint32_t cell_num){
+    void *cell = leaf_node_cell(node, cell_num);
+    if (get_node_type(node) == NODE_LEAF) {
+        return row_size(cell);
+    }
+    return index_cell_size(node, cell);
+}
+
+uint32_t
+leaf_node_free_space(void *node){
+    return *leaf_node_content_start(node) - LEAF_NODE_HEADER_SIZE
+           - *leaf_node_num_cells(node) * LEAF_NODE_SLOT_SIZE;
+}
+
+// 确保能放下一个 cell_size 字节的单元格和它的槽
+// 连续的空闲空间不够、但加上碎片足够时先整理页面, 两者都不够时返回 false
+bool
+leaf_node_reserve(void *node, uint32_t cell_size){
+    uint32_t needed = cell_size + LEAF_NODE_SLOT_SIZE;
+    if (leaf_node_free_space(node) >= needed) {
+        return true;
+    }
+    if (leaf_node_free_space(node) + *leaf_node_fragmented(node) < needed) {
+        return false;
+    }
+    leaf_node_defragment(node);
+    return true;
+}
+
+// 在第 cell_num 个位置插入键和单元格, 调用者保证空间足够
+void
+leaf_node_insert_cell(void *node, uint32_t cell_num, uint64_t key, void *cell, uint32_t cell_size){
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    uint32_t offset = *leaf_node_content_start(node) - cell_size;
+    memcpy(node + offset, cell, cell_size);
+    *leaf_node_content_start(node) = offset;
+
+    // 键数组变长一格, 槽数组整体后移一个键的宽度; 从后往前移动, 避免覆盖还没有移动的部分
+    uint16_t *old_slots = leaf_node_slot(node, 0);
+    uint16_t *new_slots = (void*)old_slots + LEAF_NODE_KEY_SIZE;
+    memmove(new_slots + cell_num + 1, old_slots + cell_num, (num_cells - cell_num) * LEAF_NODE_OFFSET_SIZE);
+    memmove(new_slots, old_slots, cell_num * LEAF_NODE_OFFSET_SIZE);
+    memmove(leaf_node_key(node, cell_num + 1), leaf_node_key(node, cell_num),
+            (num_cells - cell_num) * LEAF_NODE_KEY_SIZE);
+
+    *leaf_node_key(node, cell_num) = key;
+    *leaf_node_num_cells(node) = num_cells + 1;
+    *leaf_node_slot(node, cell_num) = offset;
+}
+
+// 整理页面: 按槽的顺序把单元格重新紧凑地排在页尾, 消除碎片
+void
+leaf_node_defragment(void *node){
+    void *copy = malloc(PAGE_SIZE);
+    memcpy(copy, node, PAGE_SIZE);
+
+    uint32_t offset = PAGE_SIZE;
+    for (uint32_t i = 0; i < *leaf_node_num_cells(node); i++) {
+        uint32_t cell_size = leaf_node_cell_size(copy, i);
+        offset -= cell_size;
+        memcpy(node + offset, leaf_node_cell(copy, i), cell_size);
+        *leaf_node_slot(node, i) = offset;
+    }
+    *leaf_node_content_start(node) = offset;
+    *leaf_node_fragmented(node) = 0;
+    free(copy);
 }
 
 // 初始化一个节点，即将该节点的num_cells值置为0
@@ -458,90 +4265,233 @@ void
 initialize_leaf_node(void *node){
     set_node_type(node, NODE_LEAF); 
     set_node_root(node, false);
+    *leaf_node_next_leaf(node) = 0;
+    leaf_node_clear(node);
+}
+
+// 清空节点中所有的单元格, 保留节点头中的其他信息
+void
+leaf_node_clear(void *node){
     *leaf_node_num_cells(node) = 0;
+    *leaf_node_content_start(node) = PAGE_SIZE;
+    *leaf_node_fragmented(node) = 0;
+}
+
+// 删除从 cell_num 开始的 count 个单元格, 它们占用的内容区成为碎片, 之后需要空间时再整理
+void
+leaf_node_remove_cells(void *node, uint32_t cell_num, uint32_t count){
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    for (uint32_t i = cell_num; i < cell_num + count; i++) {
+        *leaf_node_fragmented(node) += leaf_node_cell_size(node, i);
+    }
+
+    // 键数组变短, 槽数组整体前移; 从前往后移动, 避免覆盖还没有移动的部分
+    uint16_t *old_slots = leaf_node_slot(node, 0);
+    uint16_t *new_slots = (void*)old_slots - count * LEAF_NODE_KEY_SIZE;
+    uint32_t tail = num_cells - cell_num - count;
+    memmove(leaf_node_key(node, cell_num), leaf_node_key(node, cell_num + count), tail * LEAF_NODE_KEY_SIZE);
+    memmove(new_slots, old_slots, cell_num * LEAF_NODE_OFFSET_SIZE);
+    memmove(new_slots + cell_num, old_slots + cell_num + count, tail * LEAF_NODE_OFFSET_SIZE);
+    *leaf_node_num_cells(node) = num_cells - count;
+
+    if (num_cells == count) {
+        leaf_node_clear(node);
+    }
+}
+
+// 节点中的单元格和它们的槽实际占用的字节数, 不包括碎片
+uint32_t
+leaf_node_used_bytes(void *node){
+    return PAGE_SIZE - *leaf_node_content_start(node) - *leaf_node_fragmented(node)
+           + *leaf_node_num_cells(node) * LEAF_NODE_SLOT_SIZE;
 }
 
 void 
-leaf_node_insert(Cursor *cursor, uint32_t key, Row *value){
+leaf_node_insert(Cursor *cursor, uint64_t key, Row *value){
     void *node = get_page(cursor->table->pager, cursor->page_num);
 
-    // 获取当前要插入的节点的cell数量
-    uint32_t num_cells = *leaf_node_num_cells(node);
-    if (num_cells >= LEAF_NODE_MAX_CELLS) { // 当前节点空间不够
+    uint8_t cell[ROW_MAX_SIZE];
+    uint32_t cell_size = serialize_row(value, cell);
+    if (!leaf_node_reserve(node, cell_size)) { // 当前节点空间不够
         leaf_node_split_and_insert(cursor, key, value); // 进行分页
-        return;
-    }
-
-    if (cursor->cell_num < num_cells) {
-        for (uint32_t i = num_cells; i > cursor->cell_num; --i) {
-            memcpy(leaf_node_cell(node, i), leaf_node_cell(node, i - 1), LEAF_NODE_CELL_SIZE);
-        }
+        return;
     }
 
     // 插入新节点
-    (*leaf_node_num_cells(node))++;
-    *leaf_node_key(node, cursor->cell_num) = key;
-    serialize_row(value, leaf_node_value(node, cursor->cell_num));
+    leaf_node_insert_cell(node, cursor->cell_num, key, cell, cell_size);
+    pager_mark_dirty(cursor->table->pager, cursor->page_num);
 }
 
 Cursor*
-leaf_node_find(Table *table, uint32_t page_num, uint32_t key){
+leaf_node_find(Table *table, uint32_t page_num, uint64_t key){
     void *node = get_page(table->pager, page_num);
     uint32_t num_cells = *leaf_node_num_cells(node);
 
     Cursor *cursor = malloc(sizeof(Cursor));
     cursor->page_num = page_num;
     cursor->table = table;
+    cursor->end_of_table = false;
+    cursor->readahead.parent_page_num = INVALID_PAGE_NUM;
+    cursor->readahead.window = 0;
 
-    // 二分查找
-    uint32_t left = 0, right = num_cells;
-    while (left < right) {
-        uint32_t index = (left + right) / 2;
-        uint32_t key_at_index = *leaf_node_key(node, index);
-        if (key > key_at_index) {
-            left = index + 1;
-        }else {
-            right = index;
-        }
+    cursor->cell_num = key_search(leaf_node_key(node, 0), num_cells, key);
+    return cursor;
+}
+
+// 返回应该包含 key 的孩子的下标, 即第一个不小于 key 的键的下标
+// 叶节点中第一个大于 key 的键的下标
+uint32_t
+leaf_node_upper_bound(void *node, uint64_t key){
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    if (key == UINT64_MAX) {
+        return num_cells;
     }
+    return key_search(leaf_node_key(node, 0), num_cells, key + 1);
+}
 
-    cursor->cell_num = left;
-    return cursor;
+uint32_t
+internal_node_find_child(void *node, uint64_t key){
+    return key_search(internal_node_key(node, 0), *internal_node_num_keys(node), key);
 }
 
-Cursor*
-internal_node_find(Table *table, uint32_t page_num, uint32_t key){
-    void *node = get_page(table->pager, page_num);
-    uint32_t num_keys = *internal_node_num_keys(node);
+// 当前 CPU 上最快的查找实现, 由 key_search_init() 选择
+KeySearch key_search = key_lower_bound_scalar;
 
-    uint32_t left = 0, right = num_keys;
-    while (left < right) {
-        uint32_t index = (left + right) / 2;
-        uint32_t key_at_index = *internal_node_key(node, index);
-        if (key > key_at_index) {
-            left = index + 1;
-        }else {
-            right = index;
-        }
+void
+key_search_init(){
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        key_search = key_lower_bound_avx2;
+    }else if (__builtin_cpu_supports("sse4.2")) {
+        key_search = key_lower_bound_sse42;
+    }
+#endif
+}
+
+const char*
+key_search_name(){
+#if defined(__x86_64__) || defined(__i386__)
+    if (key_search == key_lower_bound_avx2) {
+        return "avx2";
+    }else if (key_search == key_lower_bound_sse42) {
+        return "sse4.2";
+    }
+#endif
+    return "scalar";
+}
+
+// 无分支的二分查找: 每一步只根据比较结果移动 base, 不产生难以预测的跳转
+uint32_t
+key_lower_bound_scalar(const uint64_t *keys, uint32_t num_keys, uint64_t key){
+    if (num_keys == 0) {
+        return 0;
+    }
+    const uint64_t *base = keys;
+    uint32_t n = num_keys;
+    while (n > 1) {
+        uint32_t half = n / 2;
+        // 无分支的版本不会预测执行下一次访问, 所以把两个可能的下一步都预取进来
+        __builtin_prefetch(base + half / 2);
+        __builtin_prefetch(base + half + half / 2);
+        base = base[half] < key ? base + half : base;
+        n -= half;
+    }
+    return (base - keys) + (*base < key);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// 先用无分支的二分把范围缩小到 KEY_SEARCH_WINDOW 个键以内, 再用向量比较一次数出窗口中小于 key 的键。
+// 键是无符号数, 而 64 位的向量比较只有有符号的(SSE4.2 起才有), 所以两边都先翻转符号位
+__attribute__((target("sse4.2")))
+uint32_t
+key_lower_bound_sse42(const uint64_t *keys, uint32_t num_keys, uint64_t key){
+    const uint64_t *base = keys;
+    uint32_t n = num_keys;
+    while (n > KEY_SEARCH_WINDOW) {
+        uint32_t half = n / 2;
+        __builtin_prefetch(base + half / 2);
+        __builtin_prefetch(base + half + half / 2);
+        base = base[half] < key ? base + half : base;
+        n -= half;
+    }
+
+    // 比较结果每个通道是 0 或 -1, 减到累加器上就是计数
+    __m128i sign = _mm_set1_epi64x(INT64_MIN);
+    __m128i target = _mm_xor_si128(_mm_set1_epi64x(key), sign);
+    __m128i counts = _mm_setzero_si128();
+    uint32_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128i block = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(base + i)), sign);
+        counts = _mm_sub_epi64(counts, _mm_cmpgt_epi64(target, block));
+    }
+    counts = _mm_add_epi64(counts, _mm_unpackhi_epi64(counts, counts));
+    uint32_t count = _mm_cvtsi128_si32(counts);
+    for (; i < n; i++) {
+        count += base[i] < key;
     }
-    
-    uint32_t child_num = *internal_node_child(node, left);
+    return (base - keys) + count;
+}
+
+__attribute__((target("avx2")))
+uint32_t
+key_lower_bound_avx2(const uint64_t *keys, uint32_t num_keys, uint64_t key){
+    const uint64_t *base = keys;
+    uint32_t n = num_keys;
+    while (n > KEY_SEARCH_WINDOW) {
+        uint32_t half = n / 2;
+        __builtin_prefetch(base + half / 2);
+        __builtin_prefetch(base + half + half / 2);
+        base = base[half] < key ? base + half : base;
+        n -= half;
+    }
+
+    __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    __m256i target = _mm256_xor_si256(_mm256_set1_epi64x(key), sign);
+    __m256i counts = _mm256_setzero_si256();
+    uint32_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i block = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(base + i)), sign);
+        counts = _mm256_sub_epi64(counts, _mm256_cmpgt_epi64(target, block));
+    }
+    __m128i half_counts = _mm_add_epi64(_mm256_castsi256_si128(counts), _mm256_extracti128_si256(counts, 1));
+    half_counts = _mm_add_epi64(half_counts, _mm_unpackhi_epi64(half_counts, half_counts));
+    uint32_t count = _mm_cvtsi128_si32(half_counts);
+    for (; i < n; i++) {
+        count += base[i] < key;
+    }
+    return (base - keys) + count;
+}
+#endif
+
+Cursor*
+internal_node_find(Table *table, uint32_t page_num, uint64_t key){
+    void *node = get_page(table->pager, page_num);
+    uint32_t child_num = *internal_node_child(node, internal_node_find_child(node, key));
     switch (get_node_type(get_page(table->pager, child_num))) {
         case NODE_INTERNAL:
             return internal_node_find(table, child_num, key);
         case NODE_LEAF:
             return leaf_node_find(table, child_num, key);
+        case NODE_FREE:
+        case NODE_INDEX_INTERNAL:
+        case NODE_INDEX_LEAF:
+            break;
     }
+    printf("Page %d in the tree is a free page or an index page. Corrupt file.\n", child_num);
+    exit(EXIT_FAILURE);
 }
 
 void
 print_constants(){
-    printf("ROW_SIZE: %d\n", ROW_SIZE);
+    printf("PAGE_SIZE: %d\n", PAGE_SIZE);
+    printf("ROW_MAX_SIZE: %d\n", ROW_MAX_SIZE);
     printf("COMMON_NODE_HEADER_SIZE: %d\n", COMMON_NODE_HEADER_SIZE);
     printf("LEAF_NODE_HEADER_SIZE: %d\n", LEAF_NODE_HEADER_SIZE);
-    printf("LEAF_NODE_CELL_SIZE: %d\n", LEAF_NODE_CELL_SIZE);
+    printf("LEAF_NODE_SLOT_SIZE: %d\n", LEAF_NODE_SLOT_SIZE);
     printf("LEAF_NODE_SPACE_FOR_CELLS: %d\n", LEAF_NODE_SPACE_FOR_CELLS);
-    printf("LEAF_NODE_MAX_CELLS: %d\n", LEAF_NODE_MAX_CELLS);
+    printf("INTERNAL_NODE_MAX_KEYS: %d\n", INTERNAL_NODE_MAX_KEYS);
+    printf("KEY_SEARCH: %s\n", key_search_name());
 }
 
 void
@@ -556,7 +4506,7 @@ print_tree(Pager *pager, uint32_t page_num, uint32_t indentation_level){
             printf("- leaf (size %d)\n", num_keys);
             for (uint32_t i = 0; i < num_keys; i++) {
                 indent(indentation_level + 1);
-                printf("- %d\n", *leaf_node_key(node, i));
+                printf("- %lu\n", *leaf_node_key(node, i));
             }
             break;
         case NODE_INTERNAL:
@@ -568,12 +4518,40 @@ print_tree(Pager *pager, uint32_t page_num, uint32_t indentation_level){
                 print_tree(pager, child, indentation_level + 1);
 
                 indent(indentation_level + 1);
-                printf("- key %d\n", *internal_node_key(node, i));
+                printf("- key %lu\n", *internal_node_key(node, i));
             }
             child = *internal_node_right_child(node);
             print_tree(pager, child, indentation_level + 1);
             break;
+        case NODE_FREE:
+            indent(indentation_level);
+            printf("- free page %d\n", page_num);
+            break;
+        case NODE_INDEX_LEAF:
+            num_keys = *leaf_node_num_cells(node);
+            indent(indentation_level);
+            printf("- index leaf (size %d)\n", num_keys);
+            for (uint32_t i = 0; i < num_keys; i++) {
+                void *cell = leaf_node_cell(node, i);
+                indent(indentation_level + 1);
+                printf("- %.*s %lu\n", index_cell_length(cell), index_cell_value(cell), index_cell_id(cell));
+            }
+            break;
+        case NODE_INDEX_INTERNAL:
+            num_keys = *leaf_node_num_cells(node);
+            indent(indentation_level);
+            printf("- index internal (size %d)\n", num_keys);
+            for (uint32_t i = 0; i < num_keys; i++) {
+                void *cell = leaf_node_cell(node, i);
+                print_tree(pager, index_cell_child(cell), indentation_level + 1);
+
+                indent(indentation_level + 1);
+                printf("- key %.*s %lu\n", index_cell_length(cell), index_cell_value(cell), index_cell_id(cell));
+            }
+            print_tree(pager, *index_node_right_child(node), indentation_level + 1);
+            break;
     }
+    pager_unpin(pager, page_num);
 }
 
 void 
@@ -587,56 +4565,238 @@ indent(uint32_t level){
 // 在两个节点之一中插入新值。
 // 更新父级或创建新的父级
 void
-leaf_node_split_and_insert(Cursor *cursor, uint32_t key, Row *value){
-    void *old_node = get_page(cursor->table->pager, cursor->page_num);
-    uint32_t new_page_num = get_unused_page_num(cursor->table->pager);
-    void *new_node = get_page(cursor->table->pager, new_page_num);
+leaf_node_split_and_insert(Cursor *cursor, uint64_t key, Row *value){
+    Pager *pager = cursor->table->pager;
+    pager->stats.leaf_splits++;
+    void *old_node = get_page(pager, cursor->page_num);
+    uint32_t new_page_num = get_unused_page_num(pager);
+    void *new_node = get_page(pager, new_page_num);
     initialize_leaf_node(new_node);
+    *node_parent(new_node) = *node_parent(old_node);
 
-    //已经存在的key加上新的key应该被分开
-    //在旧（左）和新（右）节点之间均匀分布。
-    //从右侧开始，将每个键移动到正确的位置
-    for (int32_t i = LEAF_NODE_MAX_CELLS; i >= 0; i--) {
+    // 已经存在的单元格加上新的单元格按字节数在旧（左）和新（右）节点之间均匀分布。
+    // 在最右边的叶节点末尾插入(顺序插入)时, 旧节点保持满的, 新节点只放新的单元格,
+    // 这样顺序插入的叶节点都是满的
+    void *old_copy = malloc(PAGE_SIZE);
+    memcpy(old_copy, old_node, PAGE_SIZE);
+    uint32_t num_cells = *leaf_node_num_cells(old_copy);
 
-        // 判断当前的cell应该属于那个节点 
-        void *destination_node;
-        if (i >= LEAF_NODE_LEFT_SPLIT_COUNT) {
-            destination_node = new_node;
-        }else {
-            destination_node = old_node;
+    uint8_t new_cell[ROW_MAX_SIZE];
+    uint32_t new_cell_size = serialize_row(value, new_cell);
+
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < num_cells; i++) {
+        total += leaf_node_cell_size(old_copy, i) + LEAF_NODE_SLOT_SIZE;
+    }
+    total += new_cell_size + LEAF_NODE_SLOT_SIZE;
+
+    uint32_t left_count = num_cells;
+    if (cursor->cell_num != num_cells || *leaf_node_next_leaf(old_copy) != 0) {
+        uint32_t left_bytes = 0;
+        for (left_count = 0; left_count < num_cells + 1 && left_bytes < total / 2; left_count++) {
+            uint32_t cell_size;
+            if (left_count == cursor->cell_num) {
+                cell_size = new_cell_size;
+            }else {
+                cell_size = leaf_node_cell_size(old_copy, left_count - (left_count > cursor->cell_num));
+            }
+            left_bytes += cell_size + LEAF_NODE_SLOT_SIZE;
         }
+        if (left_count > num_cells) { // 右节点至少要有一个单元格
+            left_count = num_cells;
+        }
+    }
 
-        uint32_t index_within_node = i % LEAF_NODE_LEFT_SPLIT_COUNT; // 无论是那个节点，都是放在 容量中的上一部分
-        void *destination = leaf_node_cell(destination_node, index_within_node);
+    // 新节点插入到旧节点和它原来的右兄弟之间
+    *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_copy);
+    *leaf_node_next_leaf(old_node) = new_page_num;
+
+    // 按顺序把单元格放进左右两个节点, 旧节点从空页开始重新排列
+    leaf_node_clear(old_node);
+    for (uint32_t i = 0; i <= num_cells; i++) {
+        void *destination_node = i < left_count ? old_node : new_node;
+        uint32_t index_within_node = i < left_count ? i : i - left_count;
 
-        // 遇到比游标所指位置下标小的则相对位置不动，大的向下移动一格为节点空出空间
         if (i == cursor->cell_num) {
-            serialize_row(value, destination);
-        }else if (i > cursor->cell_num) {
-            memcpy(destination, leaf_node_cell(old_node, i - 1), LEAF_NODE_CELL_SIZE);
+            leaf_node_insert_cell(destination_node, index_within_node, key, new_cell, new_cell_size);
         }else {
-            memcpy(destination, leaf_node_cell(old_node, i), LEAF_NODE_CELL_SIZE);
+            uint32_t source = i - (i > cursor->cell_num);
+            leaf_node_insert_cell(destination_node, index_within_node, *leaf_node_key(old_copy, source),
+                                  leaf_node_cell(old_copy, source), leaf_node_cell_size(old_copy, source));
         }
     }
-
-    *leaf_node_num_cells(old_node) = LEAF_NODE_LEFT_SPLIT_COUNT;
-    *leaf_node_num_cells(new_node) = LEAF_NODE_RIGHT_SPLIT_COUNT;
+    free(old_copy);
+    pager_mark_dirty(pager, cursor->page_num);
+    pager_mark_dirty(pager, new_page_num);
 
     // 然后我们需要更新节点的父节点。如果原来的节点是根节点，它就没有父节点。
-    // 在这种情况下，创建一个新的根节点来作为父节点。我现在就把另一个分支存根出来。
+    // 在这种情况下，创建一个新的根节点来作为父节点。
+    // 否则在父节点中旧节点的后面插入新节点, 旧节点在父节点中的键变为它现在的最大键
+    uint64_t left_max_key = *leaf_node_key(old_node, left_count - 1);
     if (is_node_root(old_node)) {
-        return create_new_root(cursor->table, new_page_num);
+        create_new_root(cursor->table, new_page_num, left_max_key);
     }else {
-        printf("Need to implement updtaing parent after split\n");
-        exit(EXIT_FAILURE);
+        internal_node_insert(cursor->table, *node_parent(old_node), cursor->page_num,
+                             left_max_key, new_page_num);
     }
 }
 
-//在我们开始回收空闲页面之前，新的页面将总是
-//指向数据库文件的末尾
+// 优先从空闲页链表中取一个页面, 链表为空时新的页面在数据库文件的末尾
 uint32_t
 get_unused_page_num(Pager *pager){
-    return pager->num_pages;
+    void *header = get_page(pager, HEADER_PAGE_NUM);
+    uint32_t page_num = *header_free_head(header);
+    if (page_num == 0) {
+        pager_unpin(pager, HEADER_PAGE_NUM);
+        return pager->num_pages;
+    }
+
+    void *page = get_page(pager, page_num);
+    *header_free_head(header) = *free_page_next(page);
+    (*header_free_count(header))--;
+    pager_mark_dirty(pager, HEADER_PAGE_NUM);
+    pager_unpin(pager, page_num);
+    pager_unpin(pager, HEADER_PAGE_NUM);
+    return page_num;
+}
+
+// 把不再使用的页面放到空闲页链表的头部, 链表保存在文件中, 重新打开后继续使用
+void
+free_page(Table *table, uint32_t page_num){
+    Pager *pager = table->pager;
+    void *header = get_page(pager, HEADER_PAGE_NUM);
+    void *page = get_page(pager, page_num);
+
+    set_node_type(page, NODE_FREE);
+    set_node_root(page, false);
+    *free_page_next(page) = *header_free_head(header);
+    *header_free_head(header) = page_num;
+    (*header_free_count(header))++;
+    pager_mark_dirty(pager, page_num);
+    pager_mark_dirty(pager, HEADER_PAGE_NUM);
+    pager_unpin(pager, page_num);
+    pager_unpin(pager, HEADER_PAGE_NUM);
+
+    if (table->append_page_num == page_num) {
+        table->append_page_num = INVALID_PAGE_NUM;
+    }
+}
+
+uint32_t*
+header_magic(void *header){
+    return header + HEADER_MAGIC_OFFSET;
+}
+
+uint32_t*
+header_root_page(void *header){
+    return header + HEADER_ROOT_PAGE_OFFSET;
+}
+
+uint32_t*
+header_free_head(void *header){
+    return header + HEADER_FREE_HEAD_OFFSET;
+}
+
+uint32_t*
+header_free_count(void *header){
+    return header + HEADER_FREE_COUNT_OFFSET;
+}
+
+uint32_t*
+header_version(void *header){
+    return header + HEADER_VERSION_OFFSET;
+}
+
+uint32_t*
+header_page_size(void *header){
+    return header + HEADER_PAGE_SIZE_OFFSET;
+}
+
+uint32_t*
+header_page_count(void *header){
+    return header + HEADER_PAGE_COUNT_OFFSET;
+}
+
+uint32_t*
+header_index_root(void *header, Column column){
+    return header + HEADER_INDEX_ROOTS_OFFSET + column * sizeof(uint32_t);
+}
+
+// 数据库头中的页数跟着文件增长, 在写出脏页之前更新
+void
+pager_update_page_count(Pager *pager){
+    if (pager->num_pages == 0) {
+        return;
+    }
+    void *header = get_page(pager, HEADER_PAGE_NUM);
+    if (*header_page_count(header) != pager->num_pages) {
+        *header_page_count(header) = pager->num_pages;
+        pager_mark_dirty(pager, HEADER_PAGE_NUM);
+    }
+    pager_unpin(pager, HEADER_PAGE_NUM);
+}
+
+// 设置页大小, 重新计算由它决定的节点布局
+void
+layout_init(uint32_t page_size){
+    PAGE_SIZE = page_size;
+    LEAF_NODE_SPACE_FOR_CELLS = PAGE_SIZE - LEAF_NODE_HEADER_SIZE;
+    INTERNAL_NODE_SPACE_FOR_CELLS = PAGE_SIZE - INTERNAL_NODE_HEADER_SIZE;
+    INTERNAL_NODE_MAX_KEYS = INTERNAL_NODE_SPACE_FOR_CELLS / INTERNAL_NODE_CELL_SIZE;
+    INTERNAL_NODE_CHILDREN_OFFSET = INTERNAL_NODE_KEYS_OFFSET + INTERNAL_NODE_MAX_KEYS * INTERNAL_NODE_KEY_SIZE;
+    LEAF_NODE_MIN_BYTES = LEAF_NODE_SPACE_FOR_CELLS / 2;
+    INTERNAL_NODE_MIN_KEYS = INTERNAL_NODE_MAX_KEYS / 2;
+}
+
+bool
+page_size_valid(uint32_t page_size){
+    return page_size >= MIN_PAGE_SIZE && page_size <= MAX_PAGE_SIZE && (page_size & (page_size - 1)) == 0;
+}
+
+// 打开之前确定页大小: 已有的数据库以文件头为准, 格式版本是 0 的旧文件是 4096(db_open 会拒绝打开它);
+// 数据库文件是空的但 WAL 中有帧时, 上次在第一次检查点之前崩溃了, 以 WAL 头为准; 否则是新建数据库时的 page_size
+uint32_t
+db_read_page_size(const char *filename, uint32_t page_size){
+    uint8_t header[HEADER_SIZE];
+    int fd = open(filename, O_RDONLY);
+    if (fd != -1) {
+        ssize_t bytes_read = pread(fd, header, HEADER_SIZE, 0);
+        close(fd);
+        if (bytes_read == (ssize_t)HEADER_SIZE && *header_magic(header) == DB_MAGIC) {
+            if (*header_version(header) == 0) {
+                return DEFAULT_PAGE_SIZE;
+            }
+            if (!page_size_valid(*header_page_size(header))) {
+                printf("Invalid page size %d in database header. Corrupt file.\n", *header_page_size(header));
+                exit(EXIT_FAILURE);
+            }
+            return *header_page_size(header);
+        }
+        if (bytes_read > 0) {
+            return page_size;
+        }
+    }
+
+    char wal_filename[strlen(filename) + 5];
+    sprintf(wal_filename, "%s-wal", filename);
+    WalHeader wal_header;
+    fd = open(wal_filename, O_RDONLY);
+    if (fd != -1) {
+        off_t wal_length = lseek(fd, 0, SEEK_END);
+        ssize_t bytes_read = pread(fd, &wal_header, sizeof(WalHeader), 0);
+        close(fd);
+        if (bytes_read == sizeof(WalHeader) && wal_length > (off_t)sizeof(WalHeader)
+                && wal_header.magic == WAL_MAGIC && wal_header.version == WAL_VERSION
+                && page_size_valid(wal_header.page_size)) {
+            return wal_header.page_size;
+        }
+    }
+    return page_size;
+}
+
+uint32_t*
+free_page_next(void *page){
+    return page + FREE_PAGE_NEXT_OFFSET;
 }
 
 void
@@ -644,26 +4804,155 @@ initialize_internal_node(void *node){
     set_node_type(node, NODE_INTERNAL);
     set_node_root(node, false);
     *internal_node_num_keys(node) = 0;
+    *internal_node_right_child(node) = INVALID_PAGE_NUM;
 }
 
+// 根节点分裂后, 根节点(左半部分)被移到新的页面中, 根节点变成只有两个孩子的内部节点
+// 这样根节点的页号保持不变
 void
-create_new_root(Table *table, uint32_t right_child_page_num){
-    void *root = get_page(table->pager, table->root_page_num);
-    void *right_child = get_page(table->pager, right_child_page_num);
-    uint32_t left_child_page_num = get_unused_page_num(table->pager);
-    void *left_child = get_page(table->pager, left_child_page_num);
+create_new_root(Table *table, uint32_t right_child_page_num, uint64_t left_max_key){
+    Pager *pager = table->pager;
+    void *root = get_page(pager, table->root_page_num);
+    void *right_child = get_page(pager, right_child_page_num);
+    uint32_t left_child_page_num = get_unused_page_num(pager);
+    void *left_child = get_page(pager, left_child_page_num);
 
     // 将根节点的数据拷贝到左孩子中
     memcpy(left_child, root, PAGE_SIZE);
     set_node_root(left_child, false);
 
+    // 左孩子是内部节点时, 它的孩子的父节点也要随之改变
+    if (get_node_type(left_child) == NODE_INTERNAL) {
+        for (uint32_t i = 0; i <= *internal_node_num_keys(left_child); i++) {
+            set_node_parent(pager, *internal_node_child(left_child, i), left_child_page_num);
+        }
+    }
+
     // 现在的根节点是一个内部节点，有一个key 和两个children
     initialize_internal_node(root);
     set_node_root(root, true);
     *internal_node_num_keys(root) = 1;
     *internal_node_child(root, 0) = left_child_page_num; // 设置左孩子在pager中的下标
-    *internal_node_key(root, 0) = get_node_max_key(left_child); // 设置root中的key为左孩子索引中的最大值
+    *internal_node_key(root, 0) = left_max_key; // 设置root中的key为左孩子索引中的最大值
     *internal_node_right_child(root) = right_child_page_num;
+    *node_parent(left_child) = table->root_page_num;
+    *node_parent(right_child) = table->root_page_num;
+    pager_mark_dirty(pager, table->root_page_num);
+    pager_mark_dirty(pager, left_child_page_num);
+    pager_mark_dirty(pager, right_child_page_num);
+}
+
+// 父节点的孩子 left_child 分裂成了 left_child 和 right_child:
+// left_child 的键改为 left_max_key, right_child 紧跟在它后面, 继承 left_child 原来的键
+void
+internal_node_insert(Table *table, uint32_t parent_page_num, uint32_t left_child_page_num,
+                     uint64_t left_max_key, uint32_t right_child_page_num){
+    Pager *pager = table->pager;
+    void *parent = get_page(pager, parent_page_num);
+    uint32_t num_keys = *internal_node_num_keys(parent);
+
+    if (num_keys >= INTERNAL_NODE_MAX_KEYS) {
+        internal_node_split_and_insert(table, parent_page_num, left_child_page_num,
+                                       left_max_key, right_child_page_num);
+        return;
+    }
+
+    uint32_t index = internal_node_find_child(parent, left_max_key);
+    if (index == num_keys) {
+        // 分裂的是最右边的孩子, 新节点成为新的右孩子
+        *internal_node_cell(parent, num_keys) = left_child_page_num;
+        *internal_node_key(parent, num_keys) = left_max_key;
+        *internal_node_right_child(parent) = right_child_page_num;
+    }else {
+        // 将 index 及之后的孩子和键后移一格
+        memmove(internal_node_cell(parent, index + 1), internal_node_cell(parent, index),
+                (num_keys - index) * INTERNAL_NODE_CHILD_SIZE);
+        memmove(internal_node_key(parent, index + 1), internal_node_key(parent, index),
+                (num_keys - index) * INTERNAL_NODE_KEY_SIZE);
+        *internal_node_key(parent, index) = left_max_key;
+        *internal_node_cell(parent, index + 1) = right_child_page_num;
+    }
+    (*internal_node_num_keys(parent))++;
+    pager_mark_dirty(pager, parent_page_num);
+    set_node_parent(pager, right_child_page_num, parent_page_num);
+}
+
+// 内部节点已满时分裂: 插入后的孩子一半留在原节点, 一半移到新节点, 中间的键上移到父节点
+void
+internal_node_split_and_insert(Table *table, uint32_t page_num, uint32_t left_child_page_num,
+                               uint64_t left_max_key, uint32_t right_child_page_num){
+    Pager *pager = table->pager;
+    pager->stats.internal_splits++;
+    void *node = get_page(pager, page_num);
+    uint32_t num_keys = *internal_node_num_keys(node);
+    uint32_t index = internal_node_find_child(node, left_max_key);
+
+    // 插入之后共有 num_keys + 2 个孩子和 num_keys + 1 个键
+    uint32_t *children = malloc((num_keys + 2) * sizeof(uint32_t));
+    uint64_t *keys = malloc((num_keys + 1) * sizeof(uint64_t));
+    uint32_t num_children = 0;
+    for (uint32_t i = 0; i <= num_keys; i++) {
+        children[num_children] = *internal_node_child(node, i);
+        if (i == index) {
+            keys[num_children++] = left_max_key;
+            children[num_children] = right_child_page_num;
+        }
+        if (i < num_keys) {
+            keys[num_children] = *internal_node_key(node, i);
+        }
+        num_children++;
+    }
+
+    uint32_t new_page_num = get_unused_page_num(pager);
+    void *new_node = get_page(pager, new_page_num);
+    initialize_internal_node(new_node);
+    *node_parent(new_node) = *node_parent(node);
+
+    // 左半部分留在原节点
+    uint32_t left_count = num_children / 2;
+    *internal_node_num_keys(node) = left_count - 1;
+    for (uint32_t i = 0; i < left_count - 1; i++) {
+        *internal_node_cell(node, i) = children[i];
+        *internal_node_key(node, i) = keys[i];
+    }
+    *internal_node_right_child(node) = children[left_count - 1];
+
+    // 右半部分移到新节点
+    uint32_t right_count = num_children - left_count;
+    *internal_node_num_keys(new_node) = right_count - 1;
+    for (uint32_t i = 0; i < right_count - 1; i++) {
+        *internal_node_cell(new_node, i) = children[left_count + i];
+        *internal_node_key(new_node, i) = keys[left_count + i];
+    }
+    *internal_node_right_child(new_node) = children[num_children - 1];
+    pager_mark_dirty(pager, page_num);
+    pager_mark_dirty(pager, new_page_num);
+
+    for (uint32_t i = left_count; i < num_children; i++) {
+        set_node_parent(pager, children[i], new_page_num);
+    }
+    if (index + 1 < left_count) {
+        set_node_parent(pager, right_child_page_num, page_num);
+    }
+
+    uint64_t separator = keys[left_count - 1];
+    free(children);
+    free(keys);
+
+    if (is_node_root(node)) {
+        create_new_root(table, new_page_num, separator);
+    }else {
+        internal_node_insert(table, *node_parent(node), page_num, separator, new_page_num);
+    }
+}
+
+// 修改页面的父节点指针
+void
+set_node_parent(Pager *pager, uint32_t page_num, uint32_t parent_page_num){
+    void *node = get_page(pager, page_num);
+    *node_parent(node) = parent_page_num;
+    pager_mark_dirty(pager, page_num);
+    pager_unpin(pager, page_num);
 }
 
 uint32_t *
@@ -676,9 +4965,10 @@ uint32_t
     return node + INTERNAL_NODE_RIGHT_CHILD_OFFSET;
 };
 
+// 第 cell_num 个孩子的页号, 孩子数组在键数组之后
 uint32_t 
 *internal_node_cell(void *node, uint32_t cell_num){
-    return node + INTERNAL_NODE_HEADER_SIZE + cell_num * INTERNAL_NODE_CELL_SIZE;
+    return node + INTERNAL_NODE_CHILDREN_OFFSET + cell_num * INTERNAL_NODE_CHILD_SIZE;
 }
 
 uint32_t 
@@ -694,22 +4984,25 @@ uint32_t
     }
 }
 
-uint32_t 
+uint64_t 
 *internal_node_key(void *node, uint32_t key_num){
-    return internal_node_cell(node, key_num) + INTERNAL_NODE_CHILD_SIZE;
+    return node + INTERNAL_NODE_KEYS_OFFSET + key_num * INTERNAL_NODE_KEY_SIZE;
 }
 
 // 获得给定节点的最大key
-// 对于内部节点，该值是其最右边的键，对于叶节点，该值是其最大索引
-uint32_t
-get_node_max_key(void *node){
-    switch (get_node_type(node)) {
-        case NODE_LEAF:
-            return *leaf_node_key(node, *leaf_node_num_cells(node) - 1);
-            break;
-        case NODE_INTERNAL:
-            return *internal_node_key(node, *internal_node_num_keys(node) - 1);
+// 对于叶节点，该值是其最大索引，对于内部节点，该值是其右孩子的最大key
+uint64_t
+get_node_max_key(Pager *pager, void *node){
+    if (get_node_type(node) == NODE_LEAF) {
+        return *leaf_node_key(node, *leaf_node_num_cells(node) - 1);
     }
+    void *right_child = get_page(pager, *internal_node_right_child(node));
+    return get_node_max_key(pager, right_child);
+}
+
+uint32_t*
+node_parent(void *node){
+    return node + PARENT_POINTER_OFFSET;
 }
 
 bool
@@ -722,3 +5015,261 @@ void
 set_node_root(void *node, bool is_root){
     *(uint8_t*)(node + IS_ROOT_OFFSET) = is_root;
 }
+
+// 删除之后检查节点是否低于最小占用, 低于时和一个兄弟一起调整
+// 根节点没有最小占用, 只在它是只剩一个孩子的内部节点时降低树的高度
+void
+node_rebalance(Table *table, uint32_t page_num){
+    Pager *pager = table->pager;
+    void *node = get_page(pager, page_num);
+    NodeType type = get_node_type(node);
+    if (is_node_root(node)) {
+        bool collapse = type == NODE_INTERNAL && *internal_node_num_keys(node) == 0;
+        pager_unpin(pager, page_num);
+        if (collapse) {
+            root_collapse(table);
+        }
+        return;
+    }
+
+    bool underflow;
+    if (type == NODE_LEAF) {
+        underflow = leaf_node_used_bytes(node) < LEAF_NODE_MIN_BYTES;
+    }else {
+        underflow = *internal_node_num_keys(node) < INTERNAL_NODE_MIN_KEYS;
+    }
+    uint32_t parent_page_num = *node_parent(node);
+    pager_unpin(pager, page_num);
+    if (!underflow) {
+        return;
+    }
+
+    void *parent = get_page(pager, parent_page_num);
+    uint32_t index = internal_node_child_index(parent, page_num);
+    uint32_t num_keys = *internal_node_num_keys(parent);
+    pager_unpin(pager, parent_page_num);
+    if (num_keys == 0) {
+        return;
+    }
+
+    // 和左兄弟一起调整, 最左边的孩子和右兄弟一起调整; key_num 是两个节点之间的键
+    uint32_t key_num = index > 0 ? index - 1 : 0;
+    if (type == NODE_LEAF) {
+        leaf_node_rebalance(table, parent_page_num, key_num);
+    }else {
+        internal_node_rebalance(table, parent_page_num, key_num);
+    }
+}
+
+// 父节点第 key_num 个键两边的两个叶节点: 放得下时合并成一个, 否则按字节数平分它们的单元格
+void
+leaf_node_rebalance(Table *table, uint32_t parent_page_num, uint32_t key_num){
+    Pager *pager = table->pager;
+    void *parent = get_page(pager, parent_page_num);
+    uint32_t left_page_num = *internal_node_child(parent, key_num);
+    uint32_t right_page_num = *internal_node_child(parent, key_num + 1);
+    void *left = get_page(pager, left_page_num);
+    void *right = get_page(pager, right_page_num);
+    uint32_t left_cells = *leaf_node_num_cells(left);
+    uint32_t right_cells = *leaf_node_num_cells(right);
+    uint32_t total = leaf_node_used_bytes(left) + leaf_node_used_bytes(right);
+
+    if (total <= LEAF_NODE_SPACE_FOR_CELLS) {
+        // 右节点的单元格全部移到左节点, 右节点从兄弟链表和父节点中去掉
+        for (uint32_t i = 0; i < right_cells; i++) {
+            uint32_t cell_size = leaf_node_cell_size(right, i);
+            leaf_node_reserve(left, cell_size);
+            leaf_node_insert_cell(left, left_cells + i, *leaf_node_key(right, i),
+                                  leaf_node_cell(right, i), cell_size);
+        }
+        *leaf_node_next_leaf(left) = *leaf_node_next_leaf(right);
+        internal_node_remove(parent, key_num);
+        pager_mark_dirty(pager, left_page_num);
+        pager_mark_dirty(pager, parent_page_num);
+        pager_unpin(pager, left_page_num);
+        pager_unpin(pager, right_page_num);
+        pager_unpin(pager, parent_page_num);
+
+        free_page(table, right_page_num);
+        node_rebalance(table, parent_page_num);
+        return;
+    }
+
+    void *left_copy = malloc(PAGE_SIZE);
+    void *right_copy = malloc(PAGE_SIZE);
+    memcpy(left_copy, left, PAGE_SIZE);
+    memcpy(right_copy, right, PAGE_SIZE);
+
+    // 左节点放到一半的字节数为止, 两边都至少留一个单元格
+    uint32_t num_cells = left_cells + right_cells;
+    uint32_t left_count = 0, left_bytes = 0;
+    while (left_count < num_cells - 1 && left_bytes < total / 2) {
+        void *source = left_count < left_cells ? left_copy : right_copy;
+        uint32_t index = left_count < left_cells ? left_count : left_count - left_cells;
+        left_bytes += leaf_node_cell_size(source, index) + LEAF_NODE_SLOT_SIZE;
+        left_count++;
+    }
+    if (left_count == 0) {
+        left_count = 1;
+    }
+
+    leaf_node_clear(left);
+    leaf_node_clear(right);
+    for (uint32_t i = 0; i < num_cells; i++) {
+        void *source = i < left_cells ? left_copy : right_copy;
+        uint32_t index = i < left_cells ? i : i - left_cells;
+        void *destination = i < left_count ? left : right;
+        uint32_t index_within_node = i < left_count ? i : i - left_count;
+        leaf_node_insert_cell(destination, index_within_node, *leaf_node_key(source, index),
+                              leaf_node_cell(source, index), leaf_node_cell_size(source, index));
+    }
+    free(left_copy);
+    free(right_copy);
+
+    *internal_node_key(parent, key_num) = *leaf_node_key(left, left_count - 1);
+    pager_mark_dirty(pager, left_page_num);
+    pager_mark_dirty(pager, right_page_num);
+    pager_mark_dirty(pager, parent_page_num);
+    pager_unpin(pager, left_page_num);
+    pager_unpin(pager, right_page_num);
+    pager_unpin(pager, parent_page_num);
+}
+
+// 父节点第 key_num 个键两边的两个内部节点: 放得下时连同父节点中的键合并成一个, 否则平分它们的孩子
+void
+internal_node_rebalance(Table *table, uint32_t parent_page_num, uint32_t key_num){
+    Pager *pager = table->pager;
+    void *parent = get_page(pager, parent_page_num);
+    uint32_t left_page_num = *internal_node_child(parent, key_num);
+    uint32_t right_page_num = *internal_node_child(parent, key_num + 1);
+    void *left = get_page(pager, left_page_num);
+    void *right = get_page(pager, right_page_num);
+    uint32_t left_keys = *internal_node_num_keys(left);
+    uint32_t right_keys = *internal_node_num_keys(right);
+    uint64_t separator = *internal_node_key(parent, key_num);
+
+    if (left_keys + right_keys + 1 <= INTERNAL_NODE_MAX_KEYS) {
+        // 父节点中的键下移, 成为左节点原来的右孩子的键, 右节点的孩子和键接在后面
+        *internal_node_cell(left, left_keys) = *internal_node_right_child(left);
+        *internal_node_key(left, left_keys) = separator;
+        memcpy(internal_node_cell(left, left_keys + 1), internal_node_cell(right, 0),
+               right_keys * INTERNAL_NODE_CHILD_SIZE);
+        memcpy(internal_node_key(left, left_keys + 1), internal_node_key(right, 0),
+               right_keys * INTERNAL_NODE_KEY_SIZE);
+        *internal_node_right_child(left) = *internal_node_right_child(right);
+        *internal_node_num_keys(left) = left_keys + right_keys + 1;
+        internal_node_remove(parent, key_num);
+        pager_mark_dirty(pager, left_page_num);
+        pager_mark_dirty(pager, parent_page_num);
+
+        for (uint32_t i = 0; i <= right_keys; i++) {
+            set_node_parent(pager, *internal_node_child(right, i), left_page_num);
+        }
+        pager_unpin(pager, left_page_num);
+        pager_unpin(pager, right_page_num);
+        pager_unpin(pager, parent_page_num);
+
+        free_page(table, right_page_num);
+        node_rebalance(table, parent_page_num);
+        return;
+    }
+
+    // 两个节点的孩子连同父节点中的键排成一列, 左半部分留在左节点, 中间的键上移到父节点
+    uint32_t num_children = left_keys + right_keys + 2;
+    uint32_t *children = malloc(num_children * sizeof(uint32_t));
+    uint64_t *keys = malloc((num_children - 1) * sizeof(uint64_t));
+    for (uint32_t i = 0; i <= left_keys; i++) {
+        children[i] = *internal_node_child(left, i);
+        keys[i] = i < left_keys ? *internal_node_key(left, i) : separator;
+    }
+    for (uint32_t i = 0; i <= right_keys; i++) {
+        children[left_keys + 1 + i] = *internal_node_child(right, i);
+        if (i < right_keys) {
+            keys[left_keys + 1 + i] = *internal_node_key(right, i);
+        }
+    }
+
+    uint32_t left_count = num_children / 2;
+    *internal_node_num_keys(left) = left_count - 1;
+    for (uint32_t i = 0; i < left_count - 1; i++) {
+        *internal_node_cell(left, i) = children[i];
+        *internal_node_key(left, i) = keys[i];
+    }
+    *internal_node_right_child(left) = children[left_count - 1];
+
+    uint32_t right_count = num_children - left_count;
+    *internal_node_num_keys(right) = right_count - 1;
+    for (uint32_t i = 0; i < right_count - 1; i++) {
+        *internal_node_cell(right, i) = children[left_count + i];
+        *internal_node_key(right, i) = keys[left_count + i];
+    }
+    *internal_node_right_child(right) = children[num_children - 1];
+    *internal_node_key(parent, key_num) = keys[left_count - 1];
+    pager_mark_dirty(pager, left_page_num);
+    pager_mark_dirty(pager, right_page_num);
+    pager_mark_dirty(pager, parent_page_num);
+    pager_unpin(pager, left_page_num);
+    pager_unpin(pager, right_page_num);
+    pager_unpin(pager, parent_page_num);
+
+    // 只有换了父节点的孩子需要更新
+    for (uint32_t i = 0; i < num_children; i++) {
+        bool was_left = i <= left_keys;
+        bool is_left = i < left_count;
+        if (was_left != is_left) {
+            set_node_parent(pager, children[i], is_left ? left_page_num : right_page_num);
+        }
+    }
+    free(children);
+    free(keys);
+}
+
+// 根节点是只剩一个孩子的内部节点: 把孩子拷贝到根节点所在的页面, 树的高度减一
+void
+root_collapse(Table *table){
+    Pager *pager = table->pager;
+    uint32_t root_page_num = table->root_page_num;
+    void *root = get_page(pager, root_page_num);
+    uint32_t child_page_num = *internal_node_right_child(root);
+    void *child = get_page(pager, child_page_num);
+
+    memcpy(root, child, PAGE_SIZE);
+    set_node_root(root, true);
+    if (get_node_type(root) == NODE_INTERNAL) {
+        for (uint32_t i = 0; i <= *internal_node_num_keys(root); i++) {
+            set_node_parent(pager, *internal_node_child(root, i), root_page_num);
+        }
+    }
+    pager_mark_dirty(pager, root_page_num);
+    pager_unpin(pager, child_page_num);
+    pager_unpin(pager, root_page_num);
+    free_page(table, child_page_num);
+}
+
+// 孩子 child_page_num 在节点中的下标
+uint32_t
+internal_node_child_index(void *node, uint32_t child_page_num){
+    uint32_t num_keys = *internal_node_num_keys(node);
+    for (uint32_t i = 0; i <= num_keys; i++) {
+        if (*internal_node_child(node, i) == child_page_num) {
+            return i;
+        }
+    }
+    printf("Page %d is not a child of its parent.\n", child_page_num);
+    exit(EXIT_FAILURE);
+}
+
+// 删除第 key_num 个键和它右边的孩子, 左边的孩子接管两者的范围
+void
+internal_node_remove(void *node, uint32_t key_num){
+    uint32_t num_keys = *internal_node_num_keys(node);
+    if (key_num + 1 == num_keys) {
+        *internal_node_right_child(node) = *internal_node_cell(node, key_num);
+    }else {
+        memmove(internal_node_key(node, key_num), internal_node_key(node, key_num + 1),
+                (num_keys - key_num - 1) * INTERNAL_NODE_KEY_SIZE);
+        memmove(internal_node_cell(node, key_num + 1), internal_node_cell(node, key_num + 2),
+                (num_keys - key_num - 2) * INTERNAL_NODE_CHILD_SIZE);
+    }
+    *internal_node_num_keys(node) = num_keys - 1;
+}
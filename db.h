@@ -1,19 +1,63 @@
 #ifndef _REPL_H
 #define _REPL_H
 
+#define _GNU_SOURCE // O_DIRECT
 #include <stdio.h>
+#include <stdio_ext.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <stddef.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #define COLUMN_USERNAME_SIZE 32
 #define COLUMN_EMAIL_SIZE 255
 #define size_of_attribute(Struct, Attribute) sizeof(((Struct*)0)->Attribute)
-#define TABLE_MAX_PAGES 100
+#define PAGER_DEFAULT_FRAMES 1024 // 缓冲池默认的帧数
+#define PAGER_MIN_FRAMES 16
+#define PAGER_MAX_IOV 1024     // 一次 pwritev 最多合并的页数 (Linux 的 UIO_MAXIOV)
+#define INVALID_PAGE_NUM UINT32_MAX // 空的内部节点没有右孩子
+#define IMPORT_SORT_BUFFER_BYTES (64 << 20) // 批量导入在内存中排序的上限, 超过后做外部排序
+#define IMPORT_FLUSH_PAGES 256  // 批量导入每生成多少个页面写回一次
+#define IMPORT_DEFAULT_FILL 100 // 批量导入默认的填充率(百分比)
+#define MAX_TREE_HEIGHT 32
+#define INPUT_BUFFER_SIZE (1 << 20)  // 每次从标准输入读取的字节数
+#define OUTPUT_BUFFER_SIZE (1 << 20) // 批处理模式下标准输出的缓冲区大小
+#define OUTPUT_ACK_MAX 256 // 写语句除了回显的输入以外最多输出多少字节 (确认, 错误, 计时, 提示符)
+#define SLOW_LOG_DEFAULT_MS 100 // 慢语句日志默认的阈值(毫秒)
+#define MAX_AGGREGATES 8       // 一条 select 最多的聚合函数个数
+#define ROW_LINE_MAX (COLUMN_COUNT * (COLUMN_EMAIL_SIZE + 2) + 2) // 输出的一行最长的字节数
+#define MAX_SCAN_THREADS 64
+#define MMAP_RESERVE_BYTES (1ULL << 40) // 映射模式预留的地址空间, 数据库不能超过这么大
+#define MMAP_EXTENT_PAGES 16384 // 映射模式每次扩展可访问区域的页数(64MB)
+#define READAHEAD_PAGES 32     // 顺序扫描时提前通知内核读入的叶节点数
+#define PARALLEL_MORSELS_PER_THREAD 8 // 并行扫描时每个线程平均分到的子树数, 多一些才能均衡负载
+#define PARALLEL_OUTPUT_MORSELS_PER_THREAD 64 // 输出行的并行扫描分得更细, 每个单元缓冲的输出少一些
+#define PARALLEL_OUTPUT_WINDOW 4 // 输出行的并行扫描中, 每个线程平均最多领先已写出的位置几个单元
+#define TOKEN_MAX_LENGTH COLUMN_EMAIL_SIZE // 最长的值是 email
+#define KEY_SEARCH_WINDOW 16   // 向量化查找在剩下多少个键时停止二分, 改为一次比较整个窗口
+#define DB_MAGIC 0x42444341    // "ACDB"
+#define DB_FORMAT_VERSION 3    // 数据库头中的格式版本: 0 没有记录页大小, 1 的键是 32 位的, 2 的键是 64 位的, 3 可以有二级索引
+#define DEFAULT_PAGE_SIZE 4096
+#define MIN_PAGE_SIZE 4096
+#define MAX_PAGE_SIZE 65536    // 叶节点的槽是 16 位的页内偏移
+#define WAL_MAGIC 0x4c415741   // "AWAL"
+#define WAL_VERSION 1
+#define WAL_NO_PAGE UINT32_MAX   // 只携带提交标记、不对应任何页面的帧
+#define WAL_CHECKPOINT_FRAMES 1000 // WAL 中的帧数超过该值时做检查点
+#define WAL_GROUP_COMMIT_MAX 64  // FULL 模式下最多多少个提交共享一次 fdatasync
 
 // 元命令识别结果
 typedef enum{
@@ -25,6 +69,11 @@ typedef enum{
 typedef enum {
     INSERT,
     SELECT,
+    DELETE,
+    UPDATE,
+    BEGIN,
+    COMMIT,
+    CREATE_INDEX,
 }StatementType;
 
 typedef enum {
@@ -39,79 +88,566 @@ typedef enum {
     EXECUTE_SUCCESS,
     EXECUTE_TABLE_FLL,
     EXECUTE_DUPLICATE_KEY,
+    EXECUTE_IN_TRANSACTION,  // begin 时已经在事务中
+    EXECUTE_NO_TRANSACTION,  // commit 时不在事务中
+    EXECUTE_INDEX_EXISTS,    // create index 的列上已经有索引
+    EXECUTE_NOT_FOUND,       // delete/update 没有匹配的行
 }ExecuteResult;
 
+// 标准输入按大块读入 data, 再从中一行一行地取出
 typedef struct {
-    char *buffer;
-    size_t buffer_length;
+    char *buffer;         // 当前的一行, 指向 data 内部, 以 '\0' 结尾
     ssize_t input_length;
+    char *data;
+    size_t data_capacity;
+    size_t data_start;    // 还没有处理的输入是 data[data_start, data_end)
+    size_t data_end;
 }InputBuffer;
 
 typedef struct{
-    uint32_t id;
+    uint64_t id;
     char username[COLUMN_USERNAME_SIZE + 1];
     char email[COLUMN_EMAIL_SIZE + 1];
 } Row;
 
+// 行的只读视图, 字符串直接指向页面中的单元格, 没有结尾的 '\0'
+// 只在单元格所在的页面被固定期间有效
+typedef struct {
+    uint64_t id;
+    const char *username;
+    uint32_t username_length;
+    const char *email;
+    uint32_t email_length;
+} RowView;
+
+// 表的列, select 的投影按这里的编号记录
+typedef enum {
+    COLUMN_ID,
+    COLUMN_USERNAME,
+    COLUMN_EMAIL,
+    COLUMN_COUNT
+} Column;
+
+// select 中的聚合函数, 都只作用在主键上(count 不区分列)
+typedef enum {
+    AGGREGATE_COUNT,
+    AGGREGATE_MIN,
+    AGGREGATE_MAX,
+    AGGREGATE_SUM,
+    AGGREGATE_AVG,
+    AGGREGATE_KINDS
+} Aggregate;
+
+// 词法单元类型
+typedef enum {
+    TOKEN_END,    // 输入结束
+    TOKEN_WORD,   // 关键字、数字或者不带引号的值, 到空白或者符号为止
+    TOKEN_STRING, // 单引号括起来的字符串, 两个连续的单引号表示一个单引号
+    TOKEN_SYMBOL, // ( ) , = ; * 之一
+    TOKEN_ERROR,  // 没有结束的字符串
+}TokenType;
+
+typedef struct {
+    TokenType type;
+    uint32_t length;                // 实际长度, 可能超过 TOKEN_MAX_LENGTH
+    char text[TOKEN_MAX_LENGTH + 1]; // 去掉引号和转义之后的内容, 超长的部分被截断
+} Token;
+
+// 词法分析器, token 是当前还没有被消耗的词法单元
+typedef struct {
+    const char *input;
+    uint32_t position;
+    Token token;
+} Tokenizer;
+
 // 语句
 typedef struct{
     StatementType type; // 语句类型
-    Row row_to_insert; // 插入语句
+    Row *rows;         // insert 的所有行
+    uint32_t num_rows;
+    uint32_t rows_capacity;
+    Row row_to_update; // update 的新值
+    bool set_username; // update 要修改的列
+    bool set_email;
+    uint64_t key_low;  // select/delete/update 的主键范围 [key_low, key_high]
+    uint64_t key_high;
+    Column where_column; // select 的 where 是 username/email = X 时是这一列, 值在 where_value 中; 否则是 COLUMN_ID
+    char where_value[COLUMN_EMAIL_SIZE + 1];
+    Column index_column; // create index 的列
+    uint32_t limit;    // select 最多返回的行数
+    Column columns[COLUMN_COUNT]; // select 输出的列, 按输出的顺序
+    uint32_t num_columns;
+    Aggregate aggregates[MAX_AGGREGATES]; // select 输出的聚合, 不为空时没有普通的列
+    uint32_t num_aggregates;
 } Statement;
 
+// 持久化级别
+typedef enum {
+    DURABILITY_OFF,    // 不写 WAL, 只在淘汰页面和关闭数据库时写回文件
+    DURABILITY_NORMAL, // 每条语句提交时写 WAL, 只在检查点时 fdatasync
+    DURABILITY_FULL,   // 提交在 fdatasync 之后才算完成, 连续到达的语句共享一次 fdatasync
+}Durability;
+
+// 打开数据库时的配置
+typedef struct {
+    uint32_t cache_pages; // 缓冲池的帧数
+    Durability durability;
+    bool batch;           // 批处理模式: 没有提示符和 "Executed.", 输出整块写出, 输入结束时正常关闭
+    uint32_t scan_threads; // 全表扫描和聚合使用的线程数, 1 表示不并行
+    bool mmap;            // 映射模式: 不使用缓冲池, 页面直接位于文件的私有映射中
+    bool direct;          // 用 O_DIRECT 打开数据库文件, 缓冲池是唯一的缓存
+    uint32_t page_size;   // 新建数据库时的页大小, 已有的数据库以文件头为准
+    bool timer;           // .timer on: 每条语句之后打印耗时和访问的页数
+    char *slow_log;       // 慢语句日志的文件名, NULL 表示不记录
+    uint32_t slow_ms;     // 耗时不少于该值(毫秒)的语句写入慢语句日志
+    FILE *slow_log_file;
+} DbConfig;
+
+// 缓冲池中的一个帧, 帧的数据在 Pager.arena 中的同一下标处
+typedef struct {
+    uint32_t page_num;  // 帧中缓存的页号
+    uint32_t pin_count; // 正在使用该帧的次数, 不为0时不能被淘汰
+    bool in_use;        // 帧中是否装有页面
+    bool referenced;    // CLOCK 算法的访问位
+    bool dirty;         // 页面被修改过, 还没有写回文件
+    int32_t hash_next;  // 同一哈希桶中的下一个帧, -1 表示结束
+} Frame;
+
+// 引擎的统计计数器, 一直开启, .stats reset 清零
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t pages_read;    // 从数据库文件或 WAL 读入的页面
+    uint64_t pages_written;
+    uint64_t write_calls;
+    uint64_t bytes_read;    // 所有文件读写的字节数, 包括 WAL 和检查点
+    uint64_t bytes_written;
+    uint64_t wal_frames;
+    uint64_t commits;
+    uint64_t syncs;
+    uint64_t checkpoints;
+    uint64_t leaf_splits;
+    uint64_t internal_splits;
+    uint64_t rows_scanned;  // select 访问过的行, 包括超出范围而停止的那一行
+    uint64_t rows_returned;
+    uint64_t prefetches;    // 预读通知的页数; O_DIRECT 模式下是批量读进缓冲池的页数
+    uint64_t io_ns;         // 读写文件和 fdatasync 的时间
+    uint64_t busy_ns;       // 执行语句和提交的总时间, 减去 io_ns 就是 CPU 时间
+} PagerStats;
+
+/*
+ * WAL 文件格式: 一个 WalHeader, 之后是若干帧, 每帧是 WalFrameHeader 加一整页的页面镜像。
+ * 帧的校验和从头部的 salt 开始链式计算, 所以一个帧只有在它之前的帧都完整时才有效。
+ * db_pages 不为 0 的帧是提交帧, 恢复时只重放到最后一个完整的提交帧为止。
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t page_size;
+    uint32_t salt;
+} WalHeader;
+
+typedef struct {
+    uint32_t page_num;
+    uint32_t db_pages; // 提交帧中为提交后数据库的页数, 其他帧为 0
+    uint32_t salt;
+    uint32_t checksum;
+} WalFrameHeader;
+
+// WAL 索引中的一项: 页面最新的镜像在 WAL 的第几帧
+typedef struct {
+    uint32_t page_num;
+    uint32_t frame_num;
+} WalIndexEntry;
+
 typedef struct {
     int file_descriptor;
-    uint32_t file_length;
+    char *filename;
+    uint32_t salt;
+    uint32_t checksum;         // 最后一帧的校验和
+    uint32_t num_frames;       // 包括还没有提交的帧(淘汰时溢出的脏页)
+    uint32_t uncommitted_frames;
+    uint32_t pending_syncs;    // 已经提交但还没有 fdatasync 的提交数
+    WalIndexEntry *index;      // 开放寻址哈希表, page_num 为 WAL_NO_PAGE 表示空位
+    uint32_t index_capacity;
+    uint32_t index_count;
+} Wal;
+
+// 写回时按页号排序的脏页
+typedef struct {
+    uint32_t page_num;
+    uint32_t frame_num;
+} DirtyPage;
+
+typedef struct {
+    int file_descriptor;
+    off_t file_length;
     uint32_t num_pages;
-    void *pages[TABLE_MAX_PAGES];
+    uint32_t num_frames;
+    void *arena;         // 所有帧的连续内存, 按页对齐
+    Frame *frames;
+    int32_t *buckets;    // 页号 -> 帧号 的哈希表, -1 表示空桶
+    uint32_t num_buckets;
+    uint32_t frames_used; // 已经分配出去的帧数, 用完之后才开始淘汰
+    uint32_t clock_hand;
+    uint32_t *pinned;     // 上次 pager_unpin_all 之后被固定过的帧
+    uint32_t num_pinned;
+    bool pinned_overflow; // pinned 放不下了, pager_unpin_all 要扫描所有的帧
+    Durability durability;
+    Wal *wal;            // DURABILITY_OFF 时为 NULL
+    bool in_transaction; // begin 之后、commit 之前不提交
+    PagerStats stats;
+    pthread_rwlock_t lock; // 并行扫描时 get_page_shared 命中持读锁, 未命中持写锁; 单线程的路径不加锁
+    // 映射模式: map 是预留的一段地址空间, 开头按 MAP_PRIVATE 映射文件, 之后是匿名内存。
+    // 修改页面只会写时复制出私有的副本, 不会绕过 WAL 改到文件; 提交和检查点照常用 pwrite 写出脏页。
+    // 页号就是帧号, pager_frame_data 不需要改变
+    bool mmap;
+    void *map;
+    uint32_t map_pages;    // 可以访问的页数, 按 MMAP_EXTENT_PAGES 扩展
+    uint8_t *dirty_map;    // 每页一个字节的脏标记
+    uint32_t *dirty_list;  // 脏页的页号, 提交时不需要扫描整个映射
+    uint32_t num_dirty;
+    uint32_t dirty_capacity;
+    // O_DIRECT 模式: 读写绕过内核的页缓存, 帧按 io_align 对齐; 预读直接把相邻的页面批量读进缓冲池
+    bool direct;
+    uint32_t io_align;
 } Pager;
 
 typedef struct {
     uint32_t root_page_num;
+    uint32_t append_page_num; // 最右边的叶节点, 顺序插入时跳过从根节点的下降; INVALID_PAGE_NUM 表示未知
+    uint32_t scan_threads;    // 并行扫描的线程数
+    uint32_t index_roots[COLUMN_COUNT]; // 每一列上二级索引的根节点页号, 0 表示没有索引; id 是主键, 总是 0
     Pager *pager;
 } Table;
+
+// 并行扫描的一个工作单元: 一棵子树。行按单元的顺序写出, 聚合的部分结果最后合并
+typedef struct {
+    uint32_t page_num;
+    char *output;
+    size_t output_length;
+    size_t output_capacity;
+    uint64_t count;      // 范围内的行数
+    unsigned __int128 sum; // 64 位的键求和会溢出 64 位
+    uint64_t min_key;
+    uint64_t max_key;
+    bool done;
+} Morsel;
+
+// 每个线程的工作队列, 是 morsels 中的一段 [head, tail): 自己从头部按键的顺序取, 别的线程从尾部偷
+typedef struct {
+    pthread_mutex_t lock;
+    uint32_t head;
+    uint32_t tail;
+} MorselQueue;
+
+typedef struct {
+    Table *table;
+    Statement *statement;
+    bool aggregate;    // 聚合时不输出行, 单元之间没有顺序
+    bool need_value;   // 投影了 id 之外的列, 需要访问单元格
+    bool need_sum;
+    Morsel *morsels;
+    uint32_t num_morsels;
+    MorselQueue *queues;
+    uint32_t num_threads;
+    pthread_mutex_t lock; // 保护 Morsel.done 和下面的两个位置
+    pthread_cond_t done_cond;
+    // 输出行时按顺序领取单元: 领取的单元不能领先 written (已写出的单元数) window 个以上, 缓冲的输出有上限
+    uint32_t next_morsel;
+    uint32_t written;
+    uint32_t window;
+    pthread_cond_t written_cond;
+} ParallelScan;
+
+typedef struct {
+    ParallelScan *scan;
+    uint32_t worker;
+} ScanWorker;
     
 // 节点类型
 typedef enum {
     NODE_INTERNAL,
     NODE_LEAF,
+    NODE_FREE,     // 在空闲页链表中的页面
+    NODE_INDEX_INTERNAL, // 二级索引的内部节点
+    NODE_INDEX_LEAF,     // 二级索引的叶节点
 }NodeType;
 
+// 批量导入时排序的一行, seq 是它在输入中的行号, 重复的键只保留第一次出现的那一行
+typedef struct {
+    uint64_t seq;
+    Row row;
+} ImportRow;
+
+// 外部排序时写到临时文件中的一个有序段
+typedef struct {
+    FILE *file;
+    ImportRow current;
+} ImportRun;
+
+// 先在内存中排序, 超过 IMPORT_SORT_BUFFER_BYTES 时把有序段写到临时文件, 最后多路归并
+typedef struct {
+    ImportRow *rows;
+    uint64_t num_rows;
+    uint64_t capacity;
+    uint64_t next;       // 内存中下一个要输出的行
+    ImportRun *runs;
+    uint32_t num_runs;
+    uint32_t *heap;      // 归并时按当前行排序的有序段下标
+    uint32_t heap_size;
+} ImportSorter;
+
+// 自底向上构建B+树时, 每一层正在填充的节点
+typedef struct {
+    uint32_t page_num;       // INVALID_PAGE_NUM 表示这一层还没有节点
+    void *node;
+    uint32_t prev_page_num;  // 这一层上一个已经完成的节点
+    uint32_t count;          // 叶节点中的单元格数, 或内部节点中的孩子数
+    uint64_t last_max_key;   // 最后一个单元格或最后一个孩子的最大键
+} BuildLevel;
+
+typedef struct {
+    Table *table;
+    BuildLevel levels[MAX_TREE_HEIGHT];
+    uint32_t num_levels;
+    uint32_t leaf_fill;      // 每个叶节点使用的字节数
+    uint32_t internal_fill;  // 每个内部节点的孩子数
+    uint32_t pages_since_flush;
+} TreeBuilder;
+
+// 顺序扫描的预读窗口: 已经通知过父节点 parent_page_num 中下标小于 end 的孩子
+typedef struct {
+    uint32_t parent_page_num;
+    uint32_t end;
+    uint32_t window; // O_DIRECT 模式下的窗口大小, 从 0 开始每进入一个叶节点翻倍
+} Readahead;
+
 // 现在它是一棵树，我们通过节点的页码和该节点中的单元格编号来确定一个位置。
 typedef struct {
     Table *table;
     uint32_t page_num;
     uint32_t cell_num;
     bool end_of_table; // 表示超过最后一个元素的一个位置
+    Readahead readahead;
 } Cursor;
     
 InputBuffer* new_input_buffer();
 void print_prompt();
-void read_input(InputBuffer *input_buffer);
+bool read_input(InputBuffer *input_buffer);
 void close_input_buffer(InputBuffer *input_buffer);
-MetaResult do_meta_command(InputBuffer *input_buffer, Table *table);
+MetaResult do_meta_command(InputBuffer *input_buffer, Table **current, DbConfig *config);
+MetaResult do_open(Table **table, DbConfig *config, char *args);
 PreapareResult preapare_statement(InputBuffer *input_buffer, Statement *statement);
+void statement_free(Statement *statement);
+void tokenizer_init(Tokenizer *tokenizer, const char *input);
+void tokenizer_advance(Tokenizer *tokenizer);
+bool token_is(Token *token, const char *keyword);
+bool token_is_symbol(Token *token, char symbol);
+bool parser_accept(Tokenizer *tokenizer, const char *keyword);
+bool parser_accept_symbol(Tokenizer *tokenizer, char symbol);
+PreapareResult parser_uint32(Tokenizer *tokenizer, uint32_t *value);
+PreapareResult parser_uint64(Tokenizer *tokenizer, uint64_t *value);
+PreapareResult parser_string(Tokenizer *tokenizer, char *destination, uint32_t max_length);
+PreapareResult parser_row(Tokenizer *tokenizer, Row *row, bool parenthesized);
+Row* statement_add_row(Statement *statement);
 ExecuteResult execute_statement(Statement statement, Table *table);
-void serialize_row(Row *source, void *destination);
+uint32_t serialize_row(Row *source, void *destination);
 void deserialize_row( void* source, Row *destination);
-void print_row(Row *row);
+uint32_t row_size(void *source);
+void print_row_view(RowView *view, Column *columns, uint32_t num_columns);
+uint32_t format_row_view(char *line, RowView *view, Column *columns, uint32_t num_columns);
+void print_aggregates(Statement *statement, bool found, uint64_t count, unsigned __int128 sum, uint64_t min_key, uint64_t max_key);
+bool execute_parallel_scan(Statement *statement, Table *table);
+uint32_t parallel_scan_collect(Table *table, Statement *statement, uint32_t target, uint32_t **pages);
+void* parallel_scan_worker(void *arg);
+int32_t parallel_scan_next(ParallelScan *scan, uint32_t worker);
+void parallel_scan_subtree(ParallelScan *scan, Morsel *morsel, uint32_t page_num);
+void parallel_scan_leaf(ParallelScan *scan, Morsel *morsel, void *node);
+void* get_page_shared(Pager *pager, uint32_t page_num);
+void pager_unpin_shared(Pager *pager, uint32_t page_num);
+void pager_prefetch(Pager *pager, uint32_t *pages, uint32_t num_pages);
+void pager_prefetch_direct(Pager *pager, uint32_t *pages, uint32_t num_pages);
+void pager_load_run(Pager *pager, uint32_t *pages, uint32_t num_pages);
+void pager_map_open(Pager *pager);
+void pager_map_extend(Pager *pager, uint32_t num_pages);
+void pager_map_refresh(Pager *pager);
+void pager_clear_dirty(Pager *pager, uint32_t frame_num);
+bool pager_page_location(Pager *pager, uint32_t page_num, int *fd, off_t *offset);
+void leaf_readahead(Pager *pager, uint32_t page_num, Readahead *readahead);
+void row_view(void *cell, RowView *view);
+void cursor_row_view(Cursor *cursor, RowView *view);
+PreapareResult preapare_columns(Tokenizer *tokenizer, Statement *statement);
+PreapareResult preapare_aggregate(Tokenizer *tokenizer, Statement *statement, Aggregate aggregate);
+ExecuteResult execute_aggregate(Statement statement, Table *table);
+bool table_max_key(Table *table, uint32_t page_num, uint64_t key_high, uint64_t *max_key);
+uint32_t leaf_node_upper_bound(void *node, uint64_t key);
 void print_tree(Pager *pager, uint32_t page_num, uint32_t indentation_level);
 void free_table(Table *table);
-PreapareResult preapare_insert(InputBuffer *input_buffer, Statement *statement);
-Pager* pager_open(const char *filename);
+PreapareResult preapare_insert(Tokenizer *tokenizer, Statement *statement);
+PreapareResult preapare_select(Tokenizer *tokenizer, Statement *statement);
+PreapareResult preapare_delete(Tokenizer *tokenizer, Statement *statement);
+PreapareResult preapare_update(Tokenizer *tokenizer, Statement *statement);
+PreapareResult preapare_where(Tokenizer *tokenizer, Statement *statement);
+bool parse_uint32(const char *str, uint32_t *value);
+bool parse_uint64(const char *str, uint64_t *value);
+PreapareResult preapare_create_index(Tokenizer *tokenizer, Statement *statement);
+
+// 二级索引
+ExecuteResult execute_create_index(Statement statement, Table *table);
+ExecuteResult execute_value_select(Statement *statement, Table *table);
+bool statement_covered(Statement *statement);
+bool table_has_index(Table *table);
+const char* row_view_value(RowView *view, Column column, uint32_t *length);
+void index_build(Table *table, Column column);
+int compare_index_cell(const void *a, const void *b);
+void index_insert_row(Table *table, RowView *view);
+void index_delete_row(Table *table, RowView *view);
+void index_update_row(Table *table, RowView *old_view, RowView *new_view);
+void index_insert(Table *table, Column column, const char *value, uint32_t length, uint64_t id);
+void index_delete(Table *table, Column column, const char *value, uint32_t length, uint64_t id);
+void index_unlink_leaf(Table *table, uint32_t *path, uint32_t depth, const char *value, uint32_t length, uint64_t id);
+void index_node_remove_child(Table *table, uint32_t *path, uint32_t level, const char *value, uint32_t length,
+                             uint64_t id);
+void index_root_collapse(Table *table, uint32_t root_page_num);
+uint32_t index_descend(Table *table, Column column, const char *value, uint32_t length, uint64_t id, uint32_t *path);
+void index_node_insert(Table *table, uint32_t *path, uint32_t depth, uint32_t cell_num, void *cell, uint32_t cell_size);
+void index_node_split_and_insert(Table *table, uint32_t *path, uint32_t depth, uint32_t cell_num,
+                                 void *cell, uint32_t cell_size);
+void initialize_index_node(void *node, NodeType type);
+uint32_t* index_node_right_child(void *node);
+uint32_t index_node_child(void *node, uint32_t child_num);
+uint32_t index_node_lower_bound(void *node, const char *value, uint32_t length, uint64_t id);
+uint64_t index_prefix(const char *value, uint32_t length);
+uint32_t index_make_cell(void *cell, const char *value, uint32_t length, uint64_t id, bool internal,
+                         uint32_t child_page_num);
+uint32_t index_cell_size(void *node, void *cell);
+uint32_t index_cell_length(void *cell);
+const char* index_cell_value(void *cell);
+uint64_t index_cell_id(void *cell);
+uint32_t index_cell_child(void *cell);
+void index_cell_set_child(void *cell, uint32_t child_page_num);
+int index_compare(void *cell, const char *value, uint32_t length, uint64_t id);
+void index_node_stats(Pager *pager, uint32_t page_num, void *buffer, uint64_t *leaves, uint64_t *internal,
+                      uint64_t *entries);
+void print_index_stats(Table *table, Column column, void *buffer, uint64_t *pages);
+
+// 批量导入
+MetaResult do_import(Table *table, char *args);
+bool import_read_file(const char *filename, ImportSorter *sorter);
+void sorter_add(ImportSorter *sorter, ImportRow *row);
+void sorter_spill(ImportSorter *sorter);
+void sorter_finish(ImportSorter *sorter);
+bool sorter_next(ImportSorter *sorter, ImportRow *row);
+void sorter_free(ImportSorter *sorter);
+void sorter_sift_down(ImportSorter *sorter, uint32_t index);
+int compare_import_row(const void *a, const void *b);
+void builder_init(TreeBuilder *builder, Table *table, uint32_t fill_percent);
+void builder_add_row(TreeBuilder *builder, Row *row);
+void builder_add_child(TreeBuilder *builder, uint32_t level, uint32_t child_page_num,
+                       void *child, uint64_t child_max_key);
+void builder_start_node(TreeBuilder *builder, uint32_t level);
+void builder_close_node(TreeBuilder *builder, uint32_t level);
+void builder_finish(TreeBuilder *builder);
+void pager_write_back(Pager *pager);
+char* parse_args(int argc, char *argv[], DbConfig *config);
+Pager* pager_open(const char *filename, DbConfig *config);
 void* get_page(Pager *pager, uint32_t page_num);
-Table* db_open(const char *filename);
+Table* db_open(const char *filename, DbConfig *config);
 void db_close(Table *table);
 void pager_flush(Pager *pager, uint32_t page_num);
+
+// 缓冲池
+void* pager_frame_data(Pager *pager, uint32_t frame_num);
+int32_t pager_lookup(Pager *pager, uint32_t page_num);
+uint32_t pager_hash(Pager *pager, uint32_t page_num);
+void pager_hash_remove(Pager *pager, uint32_t frame_num);
+uint32_t pager_find_victim(Pager *pager);
+int32_t pager_evict(Pager *pager);
+void pager_write_frame(Pager *pager, uint32_t frame_num);
+void pager_mark_dirty(Pager *pager, uint32_t page_num);
+void pager_flush_all(Pager *pager);
+void pager_write_run(Pager *pager, DirtyPage *run, uint32_t run_length);
+int compare_dirty_page(const void *a, const void *b);
+uint32_t pager_collect_dirty(Pager *pager, DirtyPage **dirty_pages);
+void* pager_peek_page(Pager *pager, uint32_t page_num, void *buffer);
+void pager_read_page(Pager *pager, uint32_t page_num, void *page);
+void pager_commit(Pager *pager, bool sync_now);
+void pager_sync(Pager *pager);
+void output_reserve(Pager *pager, size_t upcoming);
+void pager_checkpoint(Pager *pager);
+void print_wal_stats(Pager *pager);
+bool input_pending(InputBuffer *input_buffer);
+uint32_t format_uint64(char *destination, uint64_t value);
+uint32_t format_uint128(char *destination, unsigned __int128 value);
+
+// 预写日志
+Wal* wal_open(const char *filename, Pager *pager);
+void wal_close(Wal *wal);
+void wal_reset(Wal *wal);
+void wal_recover(Wal *wal, Pager *pager);
+void wal_write_frames(Pager *pager, DirtyPage *pages, uint32_t num_pages, bool commit);
+off_t wal_frame_offset(uint32_t frame_num);
+int32_t wal_find_frame(Wal *wal, uint32_t page_num);
+void wal_index_put(Wal *wal, uint32_t page_num, uint32_t frame_num);
+void wal_index_clear(Wal *wal);
+uint32_t wal_checksum(uint32_t seed, const void *data, size_t length);
+void pager_unpin(Pager *pager, uint32_t page_num);
+void pager_unpin_all(Pager *pager);
+void pager_pin(Pager *pager, int32_t frame_num);
+void print_pager_stats(Pager *pager);
+void print_stats(Table *table);
+void statement_report(DbConfig *config, const char *text, Statement *statement, Table *table,
+                      PagerStats *before, PagerStats *after, uint64_t elapsed_ns);
+const char* statement_plan(Statement *statement, Table *table);
+uint64_t clock_ns();
 Cursor* table_start(Table *table);
-Cursor* table_find(Table *table, uint32_t key);
+Cursor* table_find(Table *table, uint64_t key);
+Cursor* table_seek(Table *table, uint64_t key);
+uint64_t cursor_key(Cursor *cursor);
 void cursor_advance(Cursor *cursor);
 void* cursor_value(Cursor *cursor);
 ExecuteResult execute_insert(Statement statement, Table *table);
+ExecuteResult table_insert(Table *table, Row *row);
+Cursor* table_append_cursor(Table *table, uint64_t key);
 ExecuteResult execute_select(Statement statement, Table *table);
-void leaf_node_split_and_insert(Cursor *cursor, uint32_t key, Row *value);
+ExecuteResult execute_delete(Statement statement, Table *table);
+ExecuteResult execute_update(Statement statement, Table *table);
+ExecuteResult execute_begin(Statement statement, Table *table);
+ExecuteResult execute_commit(Statement statement, Table *table);
+uint32_t table_delete(Table *table, uint64_t key_low, uint64_t key_high);
+bool table_update(Table *table, uint64_t key, Statement *statement);
+void leaf_node_split_and_insert(Cursor *cursor, uint64_t key, Row *value);
 uint32_t get_unused_page_num(Pager *pager);
-void create_new_root(Table *table, uint32_t pright_child_page_num);
+void free_page(Table *table, uint32_t page_num);
+uint32_t* header_magic(void *header);
+uint32_t* header_root_page(void *header);
+uint32_t* header_free_head(void *header);
+uint32_t* header_free_count(void *header);
+uint32_t* header_version(void *header);
+uint32_t* header_page_size(void *header);
+uint32_t* header_page_count(void *header);
+uint32_t* header_index_root(void *header, Column column);
+void pager_update_page_count(Pager *pager);
+void layout_init(uint32_t page_size);
+bool page_size_valid(uint32_t page_size);
+uint32_t db_read_page_size(const char *filename, uint32_t page_size);
+uint32_t* free_page_next(void *page);
+// 删除后节点低于最小占用时, 向兄弟借或者与兄弟合并, 必要时一直向上处理到根节点
+void node_rebalance(Table *table, uint32_t page_num);
+void leaf_node_rebalance(Table *table, uint32_t parent_page_num, uint32_t key_num);
+void internal_node_rebalance(Table *table, uint32_t parent_page_num, uint32_t key_num);
+void root_collapse(Table *table);
+uint32_t internal_node_child_index(void *node, uint32_t child_page_num);
+void internal_node_remove(void *node, uint32_t key_num);
+void create_new_root(Table *table, uint32_t right_child_page_num, uint64_t left_max_key);
+void internal_node_insert(Table *table, uint32_t parent_page_num, uint32_t left_child_page_num,
+                          uint64_t left_max_key, uint32_t right_child_page_num);
+void internal_node_split_and_insert(Table *table, uint32_t page_num, uint32_t left_child_page_num,
+                                    uint64_t left_max_key, uint32_t right_child_page_num);
+void initialize_internal_node(void *node);
+void set_node_parent(Pager *pager, uint32_t page_num, uint32_t parent_page_num);
 
 // 获得给定节点的类型
 NodeType get_node_type(void *node);
@@ -119,41 +655,76 @@ NodeType get_node_type(void *node);
 void set_node_type(void *node, NodeType type);
 // 根据叶节点的首地址，得到该节点的 num_cells 信息
 uint32_t* leaf_node_num_cells(void *node);
+// 得到叶节点右边兄弟的页号的地址
+uint32_t* leaf_node_next_leaf(void *node);
 // 得到 node节点的第 cell_num 个cell(键值信息) 的地址
 void* leaf_node_cell(void *node, uint32_t cell_num);
+// 得到 node节点的第 cell_num 个槽的地址
+uint16_t* leaf_node_slot(void *node, uint32_t cell_num);
+uint32_t* leaf_node_content_start(void *node);
+uint32_t* leaf_node_fragmented(void *node);
+uint32_t leaf_node_cell_size(void *node, uint32_t cell_num);
+// 槽目录和内容区之间连续的空闲字节数
+uint32_t leaf_node_free_space(void *node);
+bool leaf_node_reserve(void *node, uint32_t cell_size);
+void leaf_node_insert_cell(void *node, uint32_t cell_num, uint64_t key, void *cell, uint32_t cell_size);
+void leaf_node_defragment(void *node);
+void leaf_node_remove_cells(void *node, uint32_t cell_num, uint32_t count);
+uint32_t leaf_node_used_bytes(void *node);
+void leaf_node_clear(void *node);
 // 得到 node节点的第 cell_num 个key 的地址
-uint32_t* leaf_node_key(void *node, uint32_t cell_num);
+uint64_t* leaf_node_key(void *node, uint32_t cell_num);
 // 得到 node节点的第 cell_num 个value 的地址
 uint32_t* leaf_node_value(void *node, uint32_t cell_num);
 // 初始化一个节点，即将该节点的num_cells值置为0
 void initialize_leaf_node(void *node);
 // 在当前游标下插入一条数据
-void leaf_node_insert(Cursor *cursor, uint32_t key, Row *value);
-Cursor *leaf_node_find(Table *table, uint32_t page_num, uint32_t key);
-Cursor *internal_node_find(Table *table, uint32_t page_num, uint32_t key);
+void leaf_node_insert(Cursor *cursor, uint64_t key, Row *value);
+Cursor *leaf_node_find(Table *table, uint32_t page_num, uint64_t key);
+Cursor *internal_node_find(Table *table, uint32_t page_num, uint64_t key);
 
 // 打印当前的常量
 void print_constants();
 void indent(uint32_t level);
 bool is_node_root(void *node);
 void set_node_root(void *node, bool is_root);
-uint32_t get_node_max_key(void *node);
+uint64_t get_node_max_key(Pager *pager, void *node);
+uint32_t *node_parent(void *node);
 
 uint32_t *internal_node_num_keys(void *node);
 uint32_t *internal_node_right_child(void *node);
 uint32_t *internal_node_cell(void *node, uint32_t cell_num);
 uint32_t *internal_node_child(void *node, uint32_t child_num);
-uint32_t *internal_node_key(void *node, uint32_t key_num);
+uint64_t *internal_node_key(void *node, uint32_t key_num);
+uint32_t internal_node_find_child(void *node, uint64_t key);
 
-const uint32_t PAGE_SIZE = 4096;
+// 在有序的键数组中查找第一个不小于 key 的键的下标
+typedef uint32_t (*KeySearch)(const uint64_t *keys, uint32_t num_keys, uint64_t key);
+extern KeySearch key_search;
+void key_search_init();
+const char* key_search_name();
+uint32_t key_lower_bound_scalar(const uint64_t *keys, uint32_t num_keys, uint64_t key);
+#if defined(__x86_64__) || defined(__i386__)
+uint32_t key_lower_bound_sse42(const uint64_t *keys, uint32_t num_keys, uint64_t key);
+uint32_t key_lower_bound_avx2(const uint64_t *keys, uint32_t num_keys, uint64_t key);
+#endif
+
+/*
+ * 页大小在打开数据库时由 layout_init 设置, 下面标明"由页大小决定"的布局常量也随之重新计算
+ */
+uint32_t PAGE_SIZE = DEFAULT_PAGE_SIZE;
 const uint32_t ID_SIZE = size_of_attribute(Row, id);
 const uint32_t USERNAME_SIZE = size_of_attribute(Row, username) - 1;
 const uint32_t EMAIL_SIZE = size_of_attribute(Row,email) - 1;
-const uint32_t ROW_SIZE = ID_SIZE + USERNAME_SIZE + EMAIL_SIZE;
+const char *COLUMN_NAMES[COLUMN_COUNT] = {"id", "username", "email"};
 
-const uint32_t ID_OFFSET = 0;
-const uint32_t USERNAME_OFFSET = ID_OFFSET + ID_SIZE;
-const uint32_t EMAIL_OFFSET = USERNAME_OFFSET + USERNAME_SIZE;
+/*
+ * 序列化的行: 两个字符串的长度, 然后是字符串本身, 不保存填充。id 就是键, 保存在叶节点的键数组中
+ */
+const uint32_t USERNAME_LENGTH_OFFSET = 0;
+const uint32_t EMAIL_LENGTH_OFFSET = USERNAME_LENGTH_OFFSET + sizeof(uint8_t);
+const uint32_t ROW_STRINGS_OFFSET = EMAIL_LENGTH_OFFSET + sizeof(uint8_t);
+const uint32_t ROW_MAX_SIZE = ROW_STRINGS_OFFSET + USERNAME_SIZE + EMAIL_SIZE;
 
 /*
  * 公共节点头布局
@@ -171,20 +742,25 @@ const uint32_t COMMON_NODE_HEADER_SIZE = NODE_TYPE_SIZE + IS_ROOT_SIZE + PARENT_
  */
 const uint32_t LEAF_NODE_NUM_CELLS_SIZE = sizeof(uint32_t);
 const uint32_t LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
-const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_CELLS_SIZE;
+const uint32_t LEAF_NODE_NEXT_LEAF_SIZE = sizeof(uint32_t); // 右边兄弟叶节点的页号, 0 表示最右边的叶节点
+const uint32_t LEAF_NODE_NEXT_LEAF_OFFSET = LEAF_NODE_NUM_CELLS_OFFSET + LEAF_NODE_NUM_CELLS_SIZE;
+const uint32_t LEAF_NODE_CONTENT_START_SIZE = sizeof(uint32_t); // 单元格内容区的起始偏移, 内容区从页尾向前增长
+const uint32_t LEAF_NODE_CONTENT_START_OFFSET = LEAF_NODE_NEXT_LEAF_OFFSET + LEAF_NODE_NEXT_LEAF_SIZE;
+const uint32_t LEAF_NODE_FRAGMENTED_SIZE = sizeof(uint32_t); // 内容区中已经不再使用的字节数
+const uint32_t LEAF_NODE_FRAGMENTED_OFFSET = LEAF_NODE_CONTENT_START_OFFSET + LEAF_NODE_CONTENT_START_SIZE;
+const uint32_t LEAF_NODE_PADDING_SIZE = 2; // 让键数组按 8 字节对齐
+const uint32_t LEAF_NODE_HEADER_SIZE = LEAF_NODE_FRAGMENTED_OFFSET + LEAF_NODE_FRAGMENTED_SIZE + LEAF_NODE_PADDING_SIZE;
 
-// 叶子节点的主体是一个单元格的数组。每个单元格是一个键，后面是一个值（一个序列化的行）。
-// 叶子节点的主体布局
-const uint32_t LEAF_NODE_KEY_SIZE = sizeof(uint32_t);
-const uint32_t LEAF_NODE_KEY_OFFSET = 0;
-const uint32_t LEAF_NODE_VALUE_SIZE = ROW_SIZE;
-const uint32_t LEAF_NODE_VALUE_OFFSET = LEAF_NODE_KEY_OFFSET + LEAF_NODE_KEY_SIZE;
-const uint32_t LEAF_NODE_CELL_SIZE = LEAF_NODE_KEY_SIZE + LEAF_NODE_VALUE_SIZE;
-const uint32_t LEAF_NODE_SPACE_FOR_CELLS = PAGE_SIZE - LEAF_NODE_HEADER_SIZE;
-const uint32_t LEAF_NODE_MAX_CELLS = LEAF_NODE_SPACE_FOR_CELLS / LEAF_NODE_CELL_SIZE;
-
-const uint32_t LEAF_NODE_RIGHT_SPLIT_COUNT = (LEAF_NODE_MAX_CELLS + 1) / 2;
-const uint32_t LEAF_NODE_LEFT_SPLIT_COUNT = (LEAF_NODE_MAX_CELLS + 1) - LEAF_NODE_RIGHT_SPLIT_COUNT;
+/*
+ * 叶子节点的主体是一个分槽页:
+ * 头部之后是连续的有序键数组, 然后是同样顺序的槽数组, 每个槽是单元格在页内的偏移;
+ * 单元格(序列化的行)从页尾向前存放。槽数组和内容区之间是空闲空间。
+ * 键连续存放, 查找时只访问键数组所在的几个缓存行
+ */
+const uint32_t LEAF_NODE_KEY_SIZE = sizeof(uint64_t);
+const uint32_t LEAF_NODE_OFFSET_SIZE = sizeof(uint16_t);
+const uint32_t LEAF_NODE_SLOT_SIZE = LEAF_NODE_KEY_SIZE + LEAF_NODE_OFFSET_SIZE; // 每个单元格在目录中占用的字节数
+uint32_t LEAF_NODE_SPACE_FOR_CELLS = DEFAULT_PAGE_SIZE - LEAF_NODE_HEADER_SIZE; // 由页大小决定
 
 /*
  * 内部节点头布局
@@ -193,15 +769,71 @@ const uint32_t INTERNAL_NODE_NUM_KEYS_SIZE = sizeof(uint32_t);
 const uint32_t INTERNAL_NODE_NUM_KEYS_OFFSET = COMMON_NODE_HEADER_SIZE;
 const uint32_t INTERNAL_NODE_RIGHT_CHILD_SIZE = sizeof(uint32_t);
 const uint32_t INTERNAL_NODE_RIGHT_CHILD_OFFSET = INTERNAL_NODE_NUM_KEYS_OFFSET + INTERNAL_NODE_NUM_KEYS_SIZE;
-const uint32_t INTERNAL_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + INTERNAL_NODE_NUM_KEYS_SIZE + INTERNAL_NODE_RIGHT_CHILD_SIZE;
+const uint32_t INTERNAL_NODE_PADDING_SIZE = 2; // 让键数组按 8 字节对齐
+const uint32_t INTERNAL_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + INTERNAL_NODE_NUM_KEYS_SIZE + INTERNAL_NODE_RIGHT_CHILD_SIZE
+    + INTERNAL_NODE_PADDING_SIZE;
 
 /*
  * 内部节点的主体布局
- * 主体是一个单元格数组，其中每个单元格包含一个子指针和一个键。每个键都应该是其左侧子项中包含的最大键
+ * 主体是两个定长数组: 先是连续的键数组, 然后是同样下标的子指针数组。每个键都应该是其左侧子项中包含的最大键
  */
 
-const uint32_t INTERNAL_NODE_KEY_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_KEY_SIZE = sizeof(uint64_t);
 const uint32_t INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t);
-const uint32_t INTERNAL_NODE_CELL_SIZE = INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_CHILD_SIZE;
+const uint32_t INTERNAL_NODE_CELL_SIZE = INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE;
+const uint32_t INTERNAL_NODE_KEYS_OFFSET = INTERNAL_NODE_HEADER_SIZE;
+// 由页大小决定
+uint32_t INTERNAL_NODE_SPACE_FOR_CELLS = DEFAULT_PAGE_SIZE - INTERNAL_NODE_HEADER_SIZE;
+uint32_t INTERNAL_NODE_MAX_KEYS = (DEFAULT_PAGE_SIZE - INTERNAL_NODE_HEADER_SIZE) / INTERNAL_NODE_CELL_SIZE;
+uint32_t INTERNAL_NODE_CHILDREN_OFFSET = INTERNAL_NODE_KEYS_OFFSET
+    + (DEFAULT_PAGE_SIZE - INTERNAL_NODE_HEADER_SIZE) / INTERNAL_NODE_CELL_SIZE * INTERNAL_NODE_KEY_SIZE;
+
+/*
+ * 二级索引的节点也是分槽页, 和叶节点共用节点头和分槽的函数, 单元格按 (值, id) 排序, 值相同的项可以有多个。
+ * 键数组中是值的前 8 个字节(大端, 不足的补 0), 整数的顺序就是字符串的顺序: 查找先用 key_search 在键数组上
+ * 找到前缀相同的一段, 只在这一段中二分比较完整的值。
+ * 单元格: 值的长度, id, 值; 内部节点的单元格之后还有孩子的页号, 孩子中所有的项都不大于这个单元格,
+ * 大于最后一个单元格的项在右孩子中, 右孩子的页号放在叶节点头中右兄弟的位置
+ */
+const uint32_t INDEX_CELL_LENGTH_OFFSET = 0;
+const uint32_t INDEX_CELL_ID_OFFSET = INDEX_CELL_LENGTH_OFFSET + sizeof(uint8_t);
+const uint32_t INDEX_CELL_VALUE_OFFSET = INDEX_CELL_ID_OFFSET + sizeof(uint64_t);
+const uint32_t INDEX_CELL_CHILD_SIZE = sizeof(uint32_t);
+const uint32_t INDEX_CELL_MAX_SIZE = INDEX_CELL_VALUE_OFFSET + COLUMN_EMAIL_SIZE + INDEX_CELL_CHILD_SIZE;
+
+/*
+ * 最小占用: 删除后低于它的非根节点要向兄弟借或者与兄弟合并
+ */
+uint32_t LEAF_NODE_MIN_BYTES = (DEFAULT_PAGE_SIZE - LEAF_NODE_HEADER_SIZE) / 2; // 由页大小决定
+uint32_t INTERNAL_NODE_MIN_KEYS = (DEFAULT_PAGE_SIZE - INTERNAL_NODE_HEADER_SIZE) / INTERNAL_NODE_CELL_SIZE / 2; // 由页大小决定
+
+/*
+ * 数据库头, 在第 0 页: 魔数, 根节点的页号, 空闲页链表的头和长度, 格式版本, 页大小和页数, 每一列上二级索引的根节点
+ * 格式版本是 0 的旧文件没有页大小和页数, 页大小是 4096; 版本 0 和 1 的键是 32 位的, 不能再打开;
+ * 版本 2 的文件没有索引, 索引根节点的位置是 0, 建立第一个索引时升到版本 3
+ */
+const uint32_t HEADER_PAGE_NUM = 0;
+const uint32_t HEADER_MAGIC_SIZE = sizeof(uint32_t);
+const uint32_t HEADER_MAGIC_OFFSET = 0;
+const uint32_t HEADER_ROOT_PAGE_SIZE = sizeof(uint32_t);
+const uint32_t HEADER_ROOT_PAGE_OFFSET = HEADER_MAGIC_OFFSET + HEADER_MAGIC_SIZE;
+const uint32_t HEADER_FREE_HEAD_SIZE = sizeof(uint32_t); // 第一个空闲页, 0 表示没有空闲页
+const uint32_t HEADER_FREE_HEAD_OFFSET = HEADER_ROOT_PAGE_OFFSET + HEADER_ROOT_PAGE_SIZE;
+const uint32_t HEADER_FREE_COUNT_SIZE = sizeof(uint32_t);
+const uint32_t HEADER_FREE_COUNT_OFFSET = HEADER_FREE_HEAD_OFFSET + HEADER_FREE_HEAD_SIZE;
+const uint32_t HEADER_VERSION_SIZE = sizeof(uint32_t);
+const uint32_t HEADER_VERSION_OFFSET = HEADER_FREE_COUNT_OFFSET + HEADER_FREE_COUNT_SIZE;
+const uint32_t HEADER_PAGE_SIZE_SIZE = sizeof(uint32_t);
+const uint32_t HEADER_PAGE_SIZE_OFFSET = HEADER_VERSION_OFFSET + HEADER_VERSION_SIZE;
+const uint32_t HEADER_PAGE_COUNT_SIZE = sizeof(uint32_t);
+const uint32_t HEADER_PAGE_COUNT_OFFSET = HEADER_PAGE_SIZE_OFFSET + HEADER_PAGE_SIZE_SIZE;
+const uint32_t HEADER_INDEX_ROOTS_SIZE = COLUMN_COUNT * sizeof(uint32_t); // 按列编号, 0 表示没有索引
+const uint32_t HEADER_INDEX_ROOTS_OFFSET = HEADER_PAGE_COUNT_OFFSET + HEADER_PAGE_COUNT_SIZE;
+const uint32_t HEADER_SIZE = HEADER_INDEX_ROOTS_OFFSET + HEADER_INDEX_ROOTS_SIZE;
+
+/*
+ * 空闲页: 节点类型是 NODE_FREE, 公共头之后是链表中下一个空闲页的页号
+ */
+const uint32_t FREE_PAGE_NEXT_OFFSET = COMMON_NODE_HEADER_SIZE;
 
 #endif
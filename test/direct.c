@@ -0,0 +1,174 @@
+/*
+ * O_DIRECT 模式的回归测试:
+ *  - 缓冲池的每个帧按 io_align 对齐, 数据库文件的每次读写的缓冲区、偏移和长度都按块对齐
+ *  - 小缓冲池下经过淘汰、预读和检查点之后数据不变, 重新打开后和缓冲池模式的输出相同
+ * 用法: test/direct
+ *
+ * 数据库文件的读写换成下面的包装, 以 O_DIRECT 打开的文件上没有对齐的读写记为错误。
+ * 有的文件系统(比如 tmpfs)不检查对齐, 没对齐的读写也能成功, 所以要在这里检查
+ */
+#define pread test_pread
+#define pwrite test_pwrite
+#define preadv test_preadv
+#define pwritev test_pwritev
+#include "test.h"
+#undef pread
+#undef pwrite
+#undef preadv
+#undef pwritev
+
+#define TEST_DB "/tmp/acdb-test-direct.db"
+#define TEST_ROWS 20000
+// 页大小的最小值, 也是常见设备块大小的倍数
+#define TEST_DIRECT_ALIGN 4096
+
+ssize_t pread(int fd, void *buffer, size_t length, off_t offset);
+ssize_t pwrite(int fd, const void *buffer, size_t length, off_t offset);
+ssize_t preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+ssize_t pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+
+uint64_t direct_ios = 0;
+uint64_t unaligned_ios = 0;
+
+// 记录一次读写; 只检查以 O_DIRECT 打开的文件
+void
+record_io(int fd, const struct iovec *iov, int iovcnt, off_t offset){
+    if (!(fcntl(fd, F_GETFL) & O_DIRECT)) {
+        return;
+    }
+    direct_ios++;
+    bool aligned = offset % TEST_DIRECT_ALIGN == 0;
+    for (int i = 0; i < iovcnt; i++) {
+        aligned = aligned && (uintptr_t)iov[i].iov_base % TEST_DIRECT_ALIGN == 0
+                  && iov[i].iov_len % TEST_DIRECT_ALIGN == 0;
+    }
+    unaligned_ios += !aligned;
+}
+
+ssize_t
+test_pread(int fd, void *buffer, size_t length, off_t offset){
+    struct iovec iov = {buffer, length};
+    record_io(fd, &iov, 1, offset);
+    return pread(fd, buffer, length, offset);
+}
+
+ssize_t
+test_pwrite(int fd, const void *buffer, size_t length, off_t offset){
+    struct iovec iov = {(void *)buffer, length};
+    record_io(fd, &iov, 1, offset);
+    return pwrite(fd, buffer, length, offset);
+}
+
+ssize_t
+test_preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset){
+    record_io(fd, iov, iovcnt, offset);
+    return preadv(fd, iov, iovcnt, offset);
+}
+
+ssize_t
+test_pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset){
+    record_io(fd, iov, iovcnt, offset);
+    return pwritev(fd, iov, iovcnt, offset);
+}
+
+// 文件系统不支持 O_DIRECT 时 db_open 会报错退出, 测试跳过
+bool
+direct_supported(){
+    int fd = open(TEST_DB, O_RDWR | O_CREAT | O_DIRECT, S_IWUSR | S_IRUSR);
+    if (fd == -1) {
+        return false;
+    }
+    close(fd);
+    unlink(TEST_DB);
+    return true;
+}
+
+bool
+frames_aligned(Pager *pager){
+    bool aligned = pager->io_align % TEST_DIRECT_ALIGN == 0 && (fcntl(pager->file_descriptor, F_GETFL) & O_DIRECT);
+    for (uint32_t i = 0; i < pager->num_frames; i++) {
+        aligned = aligned && (uintptr_t)pager_frame_data(pager, i) % pager->io_align == 0;
+    }
+    return aligned;
+}
+
+bool
+rows_match(Table *table, uint32_t rows){
+    bool ok = true;
+    uint32_t expected_id = 1;
+    Cursor *cursor = table_start(table);
+    while (!cursor->end_of_table && ok) {
+        Row stored, expected;
+        deserialize_row(cursor_value(cursor), &stored);
+        bench_make_row(&expected, expected_id, expected_id % 97);
+        ok = cursor_key(cursor) == expected_id && !strcmp(stored.username, expected.username)
+             && !strcmp(stored.email, expected.email);
+        expected_id++;
+        cursor_advance(cursor);
+    }
+    free(cursor);
+    pager_unpin_all(table->pager);
+    return ok && expected_id == rows + 1;
+}
+
+// 缓冲池只有 32 页, 插入和扫描都要不断淘汰和读回页面; 每行提交一次, 中间有多次检查点
+void
+test_direct_io(uint32_t page_size){
+    direct_ios = 0;
+    unaligned_ios = 0;
+    Table *table = bench_open_table(TEST_DB, 32, DURABILITY_NORMAL, "direct", page_size);
+    Row row;
+    for (uint32_t i = 1; i <= TEST_ROWS; i++) {
+        bench_make_row(&row, i, i % 97);
+        table_insert(table, &row);
+        pager_unpin_all(table->pager);
+        pager_commit(table->pager, false);
+    }
+    bool ok = frames_aligned(table->pager) && table->pager->stats.checkpoints > 0 && rows_match(table, TEST_ROWS)
+              && table->pager->stats.prefetches > 0;
+    db_close(table);
+
+    DbConfig config = {32, DURABILITY_NORMAL, true};
+    config.direct = true;
+    table = db_open(TEST_DB, &config);
+    ok = ok && frames_aligned(table->pager) && rows_match(table, TEST_ROWS);
+    db_close(table);
+
+    char name[64];
+    snprintf(name, sizeof(name), "direct: %uK pages read and write aligned", page_size / 1024);
+    check(ok && direct_ios > 0 && unaligned_ios == 0, name);
+}
+
+// 同一个文件用 --direct 和缓冲池模式打开, 查询(包括并行扫描和 .stats 遍历整棵树)的输出相同
+void
+test_direct_output(){
+    const char *queries = "select *\nselect count(*), sum(id) where id between 100 and 15000\n";
+    char *cache_argv[] = {"db", TEST_DB, "--batch", "--cache-pages", "32", NULL};
+    char *direct_argv[] = {"db", TEST_DB, "--batch", "--cache-pages", "32", "--direct", NULL};
+    char *parallel_argv[] = {"db", TEST_DB, "--batch", "--direct", "--threads", "4", NULL};
+    char *cached = test_run(cache_argv, queries);
+    char *direct = test_run(direct_argv, queries);
+    char *parallel = test_run(parallel_argv, queries);
+    char *stats = test_run(direct_argv, ".stats\n");
+    char rows_line[64];
+    snprintf(rows_line, sizeof(rows_line), "rows in table: %u\n", TEST_ROWS);
+    check(count_occurrences(cached, "\n") == TEST_ROWS + 1 && !strcmp(cached, direct) && !strcmp(cached, parallel)
+          && strstr(stats, rows_line), "direct: output identical to the buffer pool");
+    free(cached);
+    free(direct);
+    free(parallel);
+    free(stats);
+}
+
+int
+main(){
+    if (!direct_supported()) {
+        printf("skip direct: the file system does not support O_DIRECT\n");
+        return EXIT_SUCCESS;
+    }
+    test_direct_io(DEFAULT_PAGE_SIZE);
+    test_direct_io(4 * DEFAULT_PAGE_SIZE);
+    test_direct_output();
+    test_remove_database(TEST_DB);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
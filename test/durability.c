@@ -0,0 +1,221 @@
+/*
+ * 持久性的回归测试, 每项一行 "ok"/"FAIL", 有失败时返回非零
+ *  - 组提交: FULL 模式下 "Executed." 被写出时, 它对应的提交必须已经 fdatasync
+ *  - 恢复: 没做检查点就崩溃的数据库, 重新打开时重放 WAL 中已提交的帧, 丢掉未提交和写了一半的帧
+ * 用法: test/durability
+ *
+ * WAL 的写入和 fdatasync 换成下面的包装, 记录有没有写进 WAL 但还没落盘的帧
+ */
+#define fdatasync test_fdatasync
+#define pwritev test_pwritev
+#include "test.h"
+#undef fdatasync
+#undef pwritev
+
+#define TEST_DB "/tmp/acdb-test-durability.db"
+#define TEST_INSERTS 300
+#define TEST_LONG_LINES 48
+#define TEST_LONG_LINE_LENGTH (32 * 1024)
+#define TEST_REPLAY_ROWS 1500
+
+int fdatasync(int fd);
+ssize_t pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+
+bool wal_unsynced = false;
+uint32_t wal_syncs = 0;
+int output_fd = -1;
+
+bool
+is_wal(int fd){
+    char link[64];
+    char path[512];
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+    ssize_t length = readlink(link, path, sizeof(path) - 1);
+    if (length < 4) {
+        return false;
+    }
+    path[length] = '\0';
+    return !strcmp(path + length - 4, "-wal");
+}
+
+int
+test_fdatasync(int fd){
+    int result = fdatasync(fd);
+    if (result == 0 && is_wal(fd)) {
+        wal_unsynced = false;
+        wal_syncs++;
+    }
+    return result;
+}
+
+ssize_t
+test_pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset){
+    if (is_wal(fd)) {
+        wal_unsynced = true;
+    }
+    return pwritev(fd, iov, iovcnt, offset);
+}
+
+// 标准输出真正写出的地方; 写出时还有没落盘的提交就在输出中插入一行标记
+ssize_t
+test_output_write(void *cookie, const char *data, size_t size){
+    if (wal_unsynced) {
+        write(output_fd, "UNSYNCED\n", 9);
+    }
+    for (size_t written = 0; written < size; ) {
+        ssize_t n = write(output_fd, data + written, size - written);
+        if (n <= 0) {
+            return -1;
+        }
+        written += n;
+    }
+    return size;
+}
+
+// 子进程退出时把 WAL 的 fdatasync 次数写到输出的最后
+void
+report_syncs(){
+    char line[32];
+    write(output_fd, line, snprintf(line, sizeof(line), "syncs %u\n", wal_syncs));
+}
+
+// 输入一次全部到达, 后面的语句都可以共享前面的 fdatasync;
+// 一串很长的错误语句让输出在两次 fdatasync 之间就填满缓冲区, 中间的查询需要立即写出
+void
+test_group_commit_acks(){
+    const char *input_filename = TEST_DB ".in";
+    const char *output_filename = TEST_DB ".out";
+    FILE *input = fopen(input_filename, "w");
+    for (uint32_t i = 1; i <= TEST_INSERTS; i++) {
+        fprintf(input, "insert %u user%u person%u@example.com\n", i, i, i);
+        if (i == TEST_INSERTS / 2) {
+            fprintf(input, "select\n");
+            for (uint32_t j = 0; j < TEST_LONG_LINES; j++) {
+                for (uint32_t k = 0; k < TEST_LONG_LINE_LENGTH; k++) {
+                    fputc('x', input);
+                }
+                fputc('\n', input);
+            }
+        }
+    }
+    fprintf(input, ".exit\n");
+    fclose(input);
+
+    test_remove_database(TEST_DB);
+    pid_t pid = fork();
+    if (pid == 0) {
+        int input_fd = open(input_filename, O_RDONLY);
+        dup2(input_fd, STDIN_FILENO);
+        output_fd = open(output_filename, O_WRONLY | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+        cookie_io_functions_t functions = {NULL, test_output_write, NULL, NULL};
+        stdout = fopencookie(NULL, "w", functions);
+        atexit(report_syncs);
+
+        char *argv[] = {"db", TEST_DB, "--durability", "full", NULL};
+        db_main(4, argv);
+        _exit(EXIT_FAILURE);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    check(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS, "group commit: exit status");
+
+    char *output = read_file(output_filename);
+    check(count_occurrences(output, "Executed.") == TEST_INSERTS + 1, "group commit: every statement acknowledged");
+    check(count_occurrences(output, "Unrecognized command") == TEST_LONG_LINES, "group commit: errors reported");
+    check(count_occurrences(output, "UNSYNCED") == 0, "group commit: acks written only after fdatasync");
+    char *syncs = strstr(output, "syncs ");
+    check(syncs && atoi(syncs + 6) < TEST_INSERTS / 4, "group commit: commits share fdatasync");
+    free(output);
+
+    // 另起一个进程确认提交的行都在
+    pid = fork();
+    if (pid == 0) {
+        DbConfig config = {PAGER_DEFAULT_FRAMES, DURABILITY_FULL, true};
+        Table *table = db_open(TEST_DB, &config);
+        uint32_t rows = 0;
+        Cursor *cursor = table_start(table);
+        while (!cursor->end_of_table) {
+            rows++;
+            cursor_advance(cursor);
+        }
+        free(cursor);
+        pager_unpin_all(table->pager);
+        _exit(rows == TEST_INSERTS ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    waitpid(pid, &status, 0);
+    check(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS, "group commit: rows durable");
+
+    unlink(input_filename);
+    unlink(output_filename);
+    test_remove_database(TEST_DB);
+}
+
+// 子进程逐条提交后开一个事务, 小缓冲池在事务中换出的页写成未提交的帧, 然后不关闭数据库直接退出;
+// WAL 末尾再追加半个帧的垃圾, 模拟写到一半时断电
+void
+test_wal_replay(){
+    test_remove_database(TEST_DB);
+    pid_t pid = fork();
+    if (pid == 0) {
+        Table *table = bench_open_table(TEST_DB, 16, DURABILITY_FULL, "cache", DEFAULT_PAGE_SIZE);
+        Row row;
+        for (uint32_t i = 1; i <= TEST_REPLAY_ROWS; i++) {
+            bench_make_row(&row, i, 24);
+            table_insert(table, &row);
+            pager_unpin_all(table->pager);
+            pager_commit(table->pager, true);
+        }
+        uint32_t committed_frames = table->pager->wal->num_frames;
+
+        table->pager->in_transaction = true;
+        for (uint32_t i = TEST_REPLAY_ROWS + 1; i <= 2 * TEST_REPLAY_ROWS; i++) {
+            bench_make_row(&row, i, 24);
+            table_insert(table, &row);
+            pager_unpin_all(table->pager);
+        }
+        bool uncommitted = table->pager->wal->uncommitted_frames > 0;
+        _exit(committed_frames > 0 && uncommitted ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    check(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS,
+          "wal replay: crash leaves committed and uncommitted frames");
+
+    int wal_fd = open(TEST_DB "-wal", O_WRONLY | O_APPEND);
+    char garbage[DEFAULT_PAGE_SIZE / 2];
+    memset(garbage, 0xab, sizeof(garbage));
+    write(wal_fd, garbage, sizeof(garbage));
+    close(wal_fd);
+
+    DbConfig config = {16, DURABILITY_FULL, true};
+    Table *table = db_open(TEST_DB, &config);
+    bool found = true;
+    for (uint32_t i = 1; i <= TEST_REPLAY_ROWS; i++) {
+        Cursor *cursor = table_find(table, i);
+        void *node = get_page(table->pager, cursor->page_num);
+        found = found && cursor->cell_num < *leaf_node_num_cells(node) && *leaf_node_key(node, cursor->cell_num) == i;
+        free(cursor);
+        pager_unpin_all(table->pager);
+    }
+    check(found, "wal replay: committed rows recovered");
+
+    uint32_t rows = 0;
+    Cursor *cursor = table_start(table);
+    while (!cursor->end_of_table) {
+        rows++;
+        cursor_advance(cursor);
+    }
+    free(cursor);
+    pager_unpin_all(table->pager);
+    check(rows == TEST_REPLAY_ROWS, "wal replay: uncommitted rows dropped");
+
+    db_close(table);
+    test_remove_database(TEST_DB);
+}
+
+int
+main(){
+    test_group_commit_acks();
+    test_wal_replay();
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,156 @@
+/*
+ * 二级索引的回归测试, 每一步都在新的进程中重新打开数据库:
+ *  - 在已有数据的表上 create index 之后, 按 username/email 查找的结果和全表扫描过滤的结果一致
+ *  - 删除一段 id 让索引的叶节点变空, 叶节点被释放, 之后的插入重新使用空闲页
+ *  - update 修改 email 之后旧的值查不到, 新的值能查到
+ * 用法: test/index
+ */
+#include "test.h"
+
+#define TEST_DB "/tmp/acdb-test-index.db"
+#define TEST_ROWS 6000
+#define TEST_USERNAMES 37
+
+char *db_argv[] = {"db", TEST_DB, "--batch", "--cache-pages", "32", NULL};
+
+// 第 i 行: username 有重复, email 按 id 的顺序排列, 删除一段 id 就会删空 email 索引中连续的叶节点
+char*
+make_rows(uint32_t first, uint32_t last){
+    char *input = malloc((last - first + 1) * 64 + 1);
+    uint32_t length = 0;
+    for (uint32_t i = first; i <= last; i++) {
+        length += sprintf(input + length, "insert %u user%u m%06u@example.com\n", i, i % TEST_USERNAMES, i);
+    }
+    return input;
+}
+
+void
+run_rows(uint32_t first, uint32_t last){
+    char *input = make_rows(first, last);
+    free(test_run(db_argv, input));
+    free(input);
+}
+
+// 全表扫描的输出中第 field 列(1 是 username, 2 是 email)等于 value 的行
+char*
+filter_scan(const char *scan, uint32_t field, const char *value){
+    char *result = malloc(strlen(scan) + 1);
+    uint32_t length = 0;
+    for (const char *line = scan; *line; ) {
+        const char *end = strchr(line, '\n') + 1;
+        const char *start = line;
+        for (uint32_t i = 0; i < field; i++) {
+            start = strstr(start, ", ") + 2;
+        }
+        uint32_t value_length = strlen(value);
+        char terminator = field == 2 ? ')' : ',';
+        if (!strncmp(start, value, value_length) && start[value_length] == terminator) {
+            memcpy(result + length, line, end - line);
+            length += end - line;
+        }
+        line = end;
+    }
+    result[length] = '\0';
+    return result;
+}
+
+// 按 column 查找 value 的输出是否和全表扫描过滤的结果相同
+bool
+lookup_matches(const char *scan, const char *column, const char *value){
+    char input[128];
+    snprintf(input, sizeof(input), "select * where %s = '%s'\n", column, value);
+    char *output = test_run(db_argv, input);
+    char *expected = filter_scan(scan, strcmp(column, "username") ? 2 : 1, value);
+    bool matches = !strcmp(output, expected);
+    free(output);
+    free(expected);
+    return matches;
+}
+
+// 抽查一些 username 和 email (包括不存在的值)
+bool
+lookups_match(){
+    char *scan = test_run(db_argv, "select *\n");
+    bool matches = true;
+    char value[64];
+    for (uint32_t i = 0; i <= TEST_USERNAMES; i += 3) {
+        snprintf(value, sizeof(value), "user%u", i);
+        matches = lookup_matches(scan, "username", value) && matches;
+    }
+    for (uint32_t i = 1; i <= 2 * TEST_ROWS; i += 997) {
+        snprintf(value, sizeof(value), "m%06u@example.com", i);
+        matches = lookup_matches(scan, "email", value) && matches;
+    }
+    free(scan);
+    return matches;
+}
+
+typedef struct {
+    uint64_t total;
+    uint64_t index;
+    uint64_t free;
+    uint64_t email_pages;
+} PageCounts;
+
+PageCounts
+page_counts(){
+    PageCounts counts = {0};
+    char *output = test_run(db_argv, ".stats\n");
+    char *email = strstr(output, "index on email:");
+    char *pages = strstr(output, "\npages: ");
+    if (email) {
+        sscanf(email, "index on email: %*u entries, height %*u, %lu pages", &counts.email_pages);
+    }
+    if (pages) {
+        sscanf(pages, "\npages: %lu (%*u leaf, %*u internal, %lu index, %lu free)", &counts.total, &counts.index,
+               &counts.free);
+    }
+    free(output);
+    return counts;
+}
+
+void
+test_secondary_index(){
+    test_remove_database(TEST_DB);
+    run_rows(1, TEST_ROWS);
+    free(test_run(db_argv, "create index on username\ncreate index on email\n"));
+    check(lookups_match(), "index: lookups after create index match a full scan");
+
+    PageCounts built = page_counts();
+    free(test_run(db_argv, "delete where id between 1000 and 5000\n"));
+    PageCounts deleted = page_counts();
+    check(deleted.email_pages < built.email_pages / 2 && deleted.free > built.free,
+          "index: leaves emptied by a range delete are freed");
+    check(lookups_match(), "index: lookups after range delete match a full scan");
+
+    free(test_run(db_argv, "delete\n"));
+    PageCounts empty = page_counts();
+    check(empty.index == 2 && empty.email_pages == 1, "index: deleting every row leaves only the index roots");
+
+    run_rows(1, TEST_ROWS);
+    PageCounts refilled = page_counts();
+    // 逐行插入的索引比 create index 建立的稀疏, 文件可以变大, 但只能在空闲页用完之后
+    check(refilled.free < empty.free && (refilled.free == 0 || refilled.total == empty.total),
+          "index: freed pages are reused by later inserts");
+    check(lookups_match(), "index: lookups after reinsert match a full scan");
+
+    char *output = test_run(db_argv, "update set email = moved@example.com where id = 77\n"
+                                     "select * where email = m000077@example.com\n"
+                                     "select * where email = moved@example.com\n");
+    check(!strcmp(output, "(77, user3, moved@example.com)\n"), "index: update moves the email entry");
+    free(output);
+
+    output = test_run(db_argv, "select id where email = m000077@example.com\n"
+                               "select id where email = moved@example.com\n"
+                               "select count(*) where username = user3\n");
+    check(!strcmp(output, "(77)\n(163)\n"), "index: update is visible after reopening");
+    free(output);
+    check(lookups_match(), "index: lookups after update match a full scan");
+    test_remove_database(TEST_DB);
+}
+
+int
+main(){
+    test_secondary_index();
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
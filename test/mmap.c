@@ -0,0 +1,144 @@
+/*
+ * 映射模式的回归测试:
+ *  - 提交的修改只在私有副本和 WAL 中, 检查点之前数据库文件不变
+ *  - 检查点之后重新映射: 映射中的每一页和文件相同, 私有副本被丢弃, 之后读到的是页缓存中的文件内容
+ *  - 插入足够多的行, 经过多次检查点之后数据不变, 用映射模式和缓冲池重新打开都能读出
+ * 用法: test/mmap
+ */
+#include "test.h"
+
+#define TEST_DB "/tmp/acdb-test-mmap.db"
+// 每行提交一次, 这么多行会触发多次检查点(WAL_CHECKPOINT_FRAMES)
+#define TEST_ROWS 20000
+
+void*
+map_page(Pager *pager, uint32_t page_num){
+    return (uint8_t *)pager->map + (size_t)page_num * PAGE_SIZE;
+}
+
+// 映射中的前 num_pages 页和文件中的内容逐字节相同
+bool
+map_matches_file(Pager *pager){
+    void *buffer = malloc(PAGE_SIZE);
+    bool ok = pager->file_length == (uint64_t)pager->num_pages * PAGE_SIZE;
+    for (uint32_t i = 0; i < pager->num_pages && ok; i++) {
+        ok = pread(pager->file_descriptor, buffer, PAGE_SIZE, (off_t)i * PAGE_SIZE) == PAGE_SIZE
+             && !memcmp(buffer, map_page(pager, i), PAGE_SIZE);
+    }
+    free(buffer);
+    return ok;
+}
+
+// 从另一个文件描述符改写 page_num 的最后一个字节, 映射中是否能看到; 检查之后恢复原来的内容。
+// 映射中还是私有副本的页面看不到文件的变化, 只有和页缓存共享的页面才能看到
+bool
+map_shares_file(Pager *pager, uint32_t page_num){
+    int fd = open(TEST_DB, O_RDWR);
+    off_t offset = (off_t)(page_num + 1) * PAGE_SIZE - 1;
+    uint8_t original, changed;
+    pread(fd, &original, 1, offset);
+    changed = original ^ 0xff;
+    pwrite(fd, &changed, 1, offset);
+    bool shared = *((uint8_t *)map_page(pager, page_num + 1) - 1) == changed;
+    pwrite(fd, &original, 1, offset);
+    close(fd);
+    return shared;
+}
+
+bool
+rows_match(Table *table, uint32_t rows){
+    bool ok = true;
+    uint32_t expected_id = 1;
+    Cursor *cursor = table_start(table);
+    while (!cursor->end_of_table && ok) {
+        Row stored, expected;
+        deserialize_row(cursor_value(cursor), &stored);
+        bench_make_row(&expected, expected_id, expected_id % 97);
+        ok = cursor_key(cursor) == expected_id && !strcmp(stored.username, expected.username)
+             && !strcmp(stored.email, expected.email);
+        expected_id++;
+        cursor_advance(cursor);
+    }
+    free(cursor);
+    pager_unpin_all(table->pager);
+    return ok && expected_id == rows + 1;
+}
+
+void
+test_checkpoint_remap(){
+    Table *table = bench_open_table(TEST_DB, PAGER_DEFAULT_FRAMES, DURABILITY_NORMAL, "mmap", DEFAULT_PAGE_SIZE);
+    Pager *pager = table->pager;
+    Row row;
+    for (uint32_t i = 1; i <= TEST_ROWS; i++) {
+        bench_make_row(&row, i, i % 97);
+        table_insert(table, &row);
+        pager_unpin_all(pager);
+        pager_commit(pager, false);
+    }
+    check(pager->stats.checkpoints >= 2 && rows_match(table, TEST_ROWS),
+          "mmap: rows readable through the mapping across checkpoints");
+
+    pager_checkpoint(pager);
+    Cursor *cursor = table_find(table, TEST_ROWS);
+    uint32_t last_leaf = cursor->page_num;
+    free(cursor);
+    pager_unpin_all(pager);
+    check(map_matches_file(pager) && map_shares_file(pager, last_leaf),
+          "mmap: checkpoint remaps the file and drops private copies");
+
+    // 删除最后一行并提交: 修改写进 WAL, 最右边的叶节点在映射中变成私有副本, 文件中还是旧的内容
+    void *before = malloc(PAGE_SIZE);
+    memcpy(before, map_page(pager, last_leaf), PAGE_SIZE);
+    table_delete(table, TEST_ROWS, TEST_ROWS);
+    pager_unpin_all(pager);
+    pager_commit(pager, true);
+    void *file_page = malloc(PAGE_SIZE);
+    pread(pager->file_descriptor, file_page, PAGE_SIZE, (off_t)last_leaf * PAGE_SIZE);
+    check(pager->wal->num_frames > 0 && !memcmp(file_page, before, PAGE_SIZE)
+          && memcmp(map_page(pager, last_leaf), before, PAGE_SIZE) && !map_shares_file(pager, last_leaf),
+          "mmap: committed changes stay out of the file until a checkpoint");
+    free(before);
+    free(file_page);
+
+    bench_make_row(&row, TEST_ROWS, TEST_ROWS % 97);
+    table_insert(table, &row);
+    pager_unpin_all(pager);
+    pager_commit(pager, true);
+    db_close(table);
+
+    // 关闭时做了检查点, 两种方式重新打开都能读出所有的行
+    DbConfig config = {PAGER_DEFAULT_FRAMES, DURABILITY_NORMAL, true};
+    config.mmap = true;
+    table = db_open(TEST_DB, &config);
+    check(rows_match(table, TEST_ROWS) && map_matches_file(table->pager), "mmap: rows survive reopening mapped");
+    db_close(table);
+    config.mmap = false;
+    table = db_open(TEST_DB, &config);
+    check(rows_match(table, TEST_ROWS), "mmap: rows survive reopening with the buffer pool");
+    db_close(table);
+    test_remove_database(TEST_DB);
+}
+
+// 没有 WAL 时每次提交直接写回文件, 写回之后立即重新映射
+void
+test_durability_off(){
+    Table *table = bench_open_table(TEST_DB, PAGER_DEFAULT_FRAMES, DURABILITY_OFF, "mmap", DEFAULT_PAGE_SIZE);
+    Row row;
+    for (uint32_t i = 1; i <= TEST_ROWS / 4; i++) {
+        bench_make_row(&row, i, i % 97);
+        table_insert(table, &row);
+        pager_unpin_all(table->pager);
+    }
+    pager_flush_all(table->pager);
+    check(rows_match(table, TEST_ROWS / 4) && map_matches_file(table->pager)
+          && map_shares_file(table->pager, table->root_page_num), "mmap: flush without a WAL remaps the file");
+    db_close(table);
+    test_remove_database(TEST_DB);
+}
+
+int
+main(){
+    test_checkpoint_remap();
+    test_durability_off();
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,231 @@
+/*
+ * 节点布局的回归测试
+ *  - 分槽叶节点: 随机插入和删除变长的行, 每一步和模型比较键、单元格的内容和空间的记账
+ *  - 变长的行经过分裂、关闭和重新打开后逐字节不变, 短的行比原来定长的 291 字节占用的页少
+ *  - 向量化的键查找(SSE4.2/AVX2, CPU 支持时)和标量的无分支二分、逐个比较的结果相同
+ * 用法: test/node
+ */
+#include "test.h"
+
+#define TEST_DB "/tmp/acdb-test-node.db"
+#define TEST_LEAF_OPS 20000
+#define TEST_ROWS 5000
+#define TEST_SEARCH_ARRAYS 2000
+#define TEST_SEARCH_MAX_KEYS 600
+
+// 长度随 seed 变化的行, username 和 email 的长度覆盖 0 到最大值
+void
+make_variable_row(Row *row, uint64_t id, uint64_t seed){
+    uint32_t username_length = seed % (COLUMN_USERNAME_SIZE + 1);
+    uint32_t email_length = (seed >> 8) % (COLUMN_EMAIL_SIZE + 1);
+    row->id = id;
+    for (uint32_t i = 0; i < username_length; i++) {
+        row->username[i] = 'a' + (id + i) % 26;
+    }
+    row->username[username_length] = '\0';
+    for (uint32_t i = 0; i < email_length; i++) {
+        row->email[i] = 'A' + (id * 7 + i) % 26;
+    }
+    row->email[email_length] = '\0';
+}
+
+bool
+rows_equal(Row *a, Row *b){
+    return !strcmp(a->username, b->username) && !strcmp(a->email, b->email);
+}
+
+// 节点的键和单元格是否和模型一致, 空间是否记账正确
+bool
+leaf_matches(void *node, uint64_t *keys, Row *rows, uint32_t num_cells){
+    if (*leaf_node_num_cells(node) != num_cells) {
+        return false;
+    }
+    uint32_t cell_bytes = 0;
+    for (uint32_t i = 0; i < num_cells; i++) {
+        uint32_t offset = *leaf_node_slot(node, i);
+        if (*leaf_node_key(node, i) != keys[i] || offset < *leaf_node_content_start(node)
+                || offset + leaf_node_cell_size(node, i) > PAGE_SIZE) {
+            return false;
+        }
+        Row row;
+        deserialize_row(leaf_node_value(node, i), &row);
+        if (!rows_equal(&row, &rows[i])) {
+            return false;
+        }
+        cell_bytes += leaf_node_cell_size(node, i);
+    }
+    // 内容区 = 单元格 + 碎片
+    return PAGE_SIZE - *leaf_node_content_start(node) == cell_bytes + *leaf_node_fragmented(node)
+           && leaf_node_used_bytes(node) == cell_bytes + num_cells * LEAF_NODE_SLOT_SIZE;
+}
+
+void
+test_slotted_leaf(){
+    void *node = malloc(PAGE_SIZE);
+    initialize_leaf_node(node);
+    uint64_t keys[PAGE_SIZE / LEAF_NODE_SLOT_SIZE];
+    Row *rows = malloc(PAGE_SIZE / LEAF_NODE_SLOT_SIZE * sizeof(Row));
+    uint32_t num_cells = 0;
+    uint64_t state = 42;
+    bool ok = true;
+    uint32_t inserts = 0, removes = 0, defragments = 0;
+
+    for (uint32_t op = 0; op < TEST_LEAF_OPS && ok; op++) {
+        uint64_t random = bench_random(&state);
+        // 快满时多删一些, 删除留下的碎片在之后的插入中被整理
+        bool insert = random % 100 < (num_cells < 8 ? 100 : 60);
+        if (insert) {
+            Row row;
+            uint64_t key = bench_random(&state) % 100000;
+            make_variable_row(&row, key, bench_random(&state));
+            uint32_t cell_num = key_lower_bound_scalar(keys, num_cells, key);
+            if (cell_num < num_cells && keys[cell_num] == key) {
+                continue;
+            }
+            uint8_t cell[ROW_MAX_SIZE];
+            uint32_t cell_size = serialize_row(&row, cell);
+            uint32_t fragmented = *leaf_node_fragmented(node);
+            if (!leaf_node_reserve(node, cell_size)) {
+                ok = leaf_node_free_space(node) + fragmented < cell_size + LEAF_NODE_SLOT_SIZE;
+                continue;
+            }
+            defragments += fragmented > 0 && *leaf_node_fragmented(node) == 0;
+            leaf_node_insert_cell(node, cell_num, key, cell, cell_size);
+            memmove(keys + cell_num + 1, keys + cell_num, (num_cells - cell_num) * sizeof(uint64_t));
+            memmove(rows + cell_num + 1, rows + cell_num, (num_cells - cell_num) * sizeof(Row));
+            keys[cell_num] = key;
+            rows[cell_num] = row;
+            num_cells++;
+            inserts++;
+        }else if (num_cells > 0) {
+            uint32_t cell_num = bench_random(&state) % num_cells;
+            uint32_t count = 1 + bench_random(&state) % 3;
+            if (cell_num + count > num_cells) {
+                count = num_cells - cell_num;
+            }
+            leaf_node_remove_cells(node, cell_num, count);
+            memmove(keys + cell_num, keys + cell_num + count, (num_cells - cell_num - count) * sizeof(uint64_t));
+            memmove(rows + cell_num, rows + cell_num + count, (num_cells - cell_num - count) * sizeof(Row));
+            num_cells -= count;
+            removes++;
+        }
+        ok = ok && leaf_matches(node, keys, rows, num_cells);
+    }
+    check(ok && inserts > 1000 && removes > 1000 && defragments > 10,
+          "node: slotted leaf matches the model under random inserts and removes");
+
+    leaf_node_defragment(node);
+    check(*leaf_node_fragmented(node) == 0 && leaf_matches(node, keys, rows, num_cells),
+          "node: defragment keeps every cell");
+    free(rows);
+    free(node);
+}
+
+void
+test_variable_rows(){
+    Table *table = bench_open_table(TEST_DB, 32, DURABILITY_NORMAL, "cache", DEFAULT_PAGE_SIZE);
+    Row row;
+    // 随机的顺序插入, 分裂发生在叶节点的各个位置
+    for (uint32_t i = 0; i < TEST_ROWS; i++) {
+        uint64_t id = (uint64_t)i * 2654435761u % TEST_ROWS + 1;
+        make_variable_row(&row, id, id * 0x9E3779B97F4A7C15ULL);
+        table_insert(table, &row);
+        pager_unpin_all(table->pager);
+        pager_commit(table->pager, true);
+    }
+    db_close(table);
+
+    DbConfig config = {32, DURABILITY_NORMAL, true};
+    table = db_open(TEST_DB, &config);
+    bool ok = true;
+    uint64_t expected_id = 1;
+    Cursor *cursor = table_start(table);
+    while (!cursor->end_of_table) {
+        Row stored, expected;
+        deserialize_row(cursor_value(cursor), &stored);
+        make_variable_row(&expected, expected_id, expected_id * 0x9E3779B97F4A7C15ULL);
+        ok = ok && cursor_key(cursor) == expected_id && rows_equal(&stored, &expected);
+        expected_id++;
+        cursor_advance(cursor);
+    }
+    free(cursor);
+    pager_unpin_all(table->pager);
+    check(ok && expected_id == TEST_ROWS + 1, "node: variable-length rows survive splits and reopen");
+    db_close(table);
+
+    // 很短的行: 定长格式每个叶节点只能放 13 行
+    table = bench_open_table(TEST_DB, 32, DURABILITY_OFF, "cache", DEFAULT_PAGE_SIZE);
+    for (uint32_t i = 1; i <= TEST_ROWS; i++) {
+        bench_make_row(&row, i, 8);
+        table_insert(table, &row);
+        pager_unpin_all(table->pager);
+    }
+    check(table->pager->num_pages < TEST_ROWS / 13 / 4, "node: short rows pack densely");
+    db_close(table);
+    test_remove_database(TEST_DB);
+}
+
+// 逐个比较得到的下界, 作为各个实现的参照
+uint32_t
+lower_bound_reference(const uint64_t *keys, uint32_t num_keys, uint64_t key){
+    uint32_t count = 0;
+    while (count < num_keys && keys[count] < key) {
+        count++;
+    }
+    return count;
+}
+
+// 随机长度的有序数组(有重复的键, 也有符号位为 1 的键), 查找每个键、它的前后两个值和两个极端值
+bool
+key_search_matches(KeySearch search){
+    uint64_t *keys = malloc(TEST_SEARCH_MAX_KEYS * sizeof(uint64_t));
+    uint64_t state = 11;
+    bool ok = true;
+    for (uint32_t array = 0; array < TEST_SEARCH_ARRAYS && ok; array++) {
+        uint32_t num_keys = bench_random(&state) % (TEST_SEARCH_MAX_KEYS + 1);
+        // 间隔很小时有重复的键并且围绕 2^63, 间隔很大时键分布在整个 64 位的范围
+        uint64_t step = array % 2 ? 3 : UINT64_MAX / (num_keys + 1);
+        uint64_t key = array % 2 ? (1ULL << 63) - step * (num_keys / 2) : 0;
+        for (uint32_t i = 0; i < num_keys; i++) {
+            key += bench_random(&state) % step;
+            keys[i] = key;
+        }
+        uint64_t probes[] = {0, UINT64_MAX, 1ULL << 63, (1ULL << 63) - 1};
+        for (uint32_t i = 0; i < sizeof(probes) / sizeof(probes[0]); i++) {
+            ok = ok && search(keys, num_keys, probes[i]) == lower_bound_reference(keys, num_keys, probes[i]);
+        }
+        for (uint32_t i = 0; i < num_keys && ok; i++) {
+            for (uint64_t probe = keys[i] - 1; probe != keys[i] + 2; probe++) {
+                ok = ok && search(keys, num_keys, probe) == lower_bound_reference(keys, num_keys, probe);
+            }
+        }
+    }
+    free(keys);
+    return ok;
+}
+
+void
+test_key_search(){
+    check(key_search_matches(key_lower_bound_scalar), "node: scalar key search matches a linear scan");
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        check(key_search_matches(key_lower_bound_sse42), "node: sse4.2 key search matches a linear scan");
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        check(key_search_matches(key_lower_bound_avx2), "node: avx2 key search matches a linear scan");
+    }
+#endif
+    key_search_init();
+    char name[64];
+    snprintf(name, sizeof(name), "node: selected key search (%s) matches a linear scan", key_search_name());
+    check(key_search_matches(key_search), name);
+}
+
+int
+main(){
+    test_slotted_leaf();
+    test_variable_rows();
+    test_key_search();
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
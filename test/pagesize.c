@@ -0,0 +1,113 @@
+/*
+ * 页大小的回归测试:
+ *  - 用 --page-size 新建 4K 到 64K 的数据库, 不带参数重新打开时页大小以文件头为准, 数据不变
+ *  - 新建的数据库在第一次检查点之前崩溃时文件还是空的, 重新打开时从 WAL 头读出页大小并重放
+ * 用法: test/pagesize
+ */
+#include "test.h"
+
+#define TEST_DB "/tmp/acdb-test-pagesize.db"
+// 64K 的叶节点能放几百行, 这么多行才会在每种页大小下都分裂出内部节点
+#define TEST_ROWS 3000
+#define TEST_CRASH_ROWS 200
+
+// 插入 rows 行的输入和对应的 select * 的输出; email 的长度从 0 到最大值变化
+void
+make_rows(uint32_t rows, char **input, char **expected){
+    *input = malloc(rows * (COLUMN_EMAIL_SIZE + 64));
+    *expected = malloc(rows * (COLUMN_EMAIL_SIZE + 64));
+    uint32_t input_length = 0, expected_length = 0;
+    Row row;
+    for (uint32_t i = 1; i <= rows; i++) {
+        bench_make_row(&row, i, i % (COLUMN_EMAIL_SIZE + 1));
+        input_length += sprintf(*input + input_length, "insert %u %s '%s'\n", i, row.username, row.email);
+        expected_length += sprintf(*expected + expected_length, "(%u, %s, %s)\n", i, row.username, row.email);
+    }
+}
+
+// 重新打开后 .stats 报告的页大小
+uint32_t
+reported_page_size(char **argv){
+    char *output = test_run(argv, ".stats\n");
+    char *line = strstr(output, "page size: ");
+    uint32_t page_size = 0;
+    if (line) {
+        sscanf(line, "page size: %u", &page_size);
+    }
+    free(output);
+    return page_size;
+}
+
+bool
+scan_matches(char **argv, const char *expected){
+    char *output = test_run(argv, "select *\n");
+    bool matches = !strcmp(output, expected);
+    free(output);
+    return matches;
+}
+
+void
+test_reopen(){
+    char *input, *expected;
+    make_rows(TEST_ROWS, &input, &expected);
+    char *plain_argv[] = {"db", TEST_DB, "--batch", NULL};
+    for (uint32_t page_size = MIN_PAGE_SIZE; page_size <= MAX_PAGE_SIZE; page_size *= 2) {
+        test_remove_database(TEST_DB);
+        char size[16];
+        snprintf(size, sizeof(size), "%u", page_size);
+        char *create_argv[] = {"db", TEST_DB, "--batch", "--page-size", size, NULL};
+        free(test_run(create_argv, input));
+
+        // 新建之后 --page-size 被忽略, 换一个不同的值也一样
+        char other_size[16];
+        snprintf(other_size, sizeof(other_size), "%u", page_size == MIN_PAGE_SIZE ? MAX_PAGE_SIZE : MIN_PAGE_SIZE);
+        char *other_argv[] = {"db", TEST_DB, "--batch", "--page-size", other_size, NULL};
+        char name[64];
+        snprintf(name, sizeof(name), "pagesize: %uK survives reopening", page_size / 1024);
+        check(reported_page_size(plain_argv) == page_size && reported_page_size(other_argv) == page_size
+              && scan_matches(plain_argv, expected) && scan_matches(other_argv, expected), name);
+    }
+    free(input);
+    free(expected);
+    test_remove_database(TEST_DB);
+}
+
+// 子进程逐条提交后不关闭数据库直接退出, 提交的帧都还在 WAL 中
+void
+test_wal_page_size(){
+    test_remove_database(TEST_DB);
+    uint32_t page_size = 4 * DEFAULT_PAGE_SIZE;
+    pid_t pid = fork();
+    if (pid == 0) {
+        Table *table = bench_open_table(TEST_DB, 64, DURABILITY_FULL, "cache", page_size);
+        Row row;
+        for (uint32_t i = 1; i <= TEST_CRASH_ROWS; i++) {
+            bench_make_row(&row, i, i % (COLUMN_EMAIL_SIZE + 1));
+            table_insert(table, &row);
+            pager_unpin_all(table->pager);
+            pager_commit(table->pager, true);
+        }
+        _exit(table->pager->stats.checkpoints == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    struct stat db_stat;
+    check(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS && stat(TEST_DB, &db_stat) == 0
+          && db_stat.st_size == 0, "pagesize: crash before the first checkpoint leaves an empty file");
+
+    char *input, *expected;
+    make_rows(TEST_CRASH_ROWS, &input, &expected);
+    char *plain_argv[] = {"db", TEST_DB, "--batch", NULL};
+    check(db_read_page_size(TEST_DB, DEFAULT_PAGE_SIZE) == page_size && reported_page_size(plain_argv) == page_size
+          && scan_matches(plain_argv, expected), "pagesize: page size is read from the WAL header");
+    free(input);
+    free(expected);
+    test_remove_database(TEST_DB);
+}
+
+int
+main(){
+    test_reopen();
+    test_wal_page_size();
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,62 @@
+/*
+ * 并行扫描的回归测试: --threads 4 和单线程的输出逐字节相同
+ * 覆盖全表、范围、投影和聚合, 以及缓冲池很小(线程数被压低)和映射模式
+ * 用法: test/parallel
+ */
+#include "test.h"
+
+#define TEST_DB "/tmp/acdb-test-parallel.db"
+#define TEST_ROWS 200000
+
+const char *queries =
+    "select *\n"
+    "select id\n"
+    "select email, id\n"
+    "select * where id between 1234 and 187654\n"
+    "select username where id between 50000 and 50001\n"
+    "select count(*)\n"
+    "select count(*), sum(id), min(id), max(id), avg(id)\n"
+    "select count(*), sum(id) where id between 777 and 155555\n"
+    "select min(id), max(id) where id between 300000 and 400000\n";
+
+// 行数足够多, 扫描才会分成多个单元; email 的长度不同, 每个单元的输出大小不一样
+void
+load_table(){
+    Table *table = bench_open_table(TEST_DB, PAGER_DEFAULT_FRAMES, DURABILITY_OFF, "cache", DEFAULT_PAGE_SIZE);
+    Row row;
+    for (uint32_t i = 1; i <= TEST_ROWS; i++) {
+        bench_make_row(&row, (uint64_t)i * 2, i % 53);
+        table_insert(table, &row);
+        pager_unpin_all(table->pager);
+    }
+    db_close(table);
+}
+
+// 同样的选项下分别用单线程和 --threads 4 执行所有的查询, 比较输出
+void
+compare_outputs(char **options, uint32_t num_options, const char *name){
+    char *serial_argv[8] = {"db", TEST_DB, "--batch"};
+    char *parallel_argv[8] = {"db", TEST_DB, "--batch", "--threads", "4"};
+    for (uint32_t i = 0; i < num_options; i++) {
+        serial_argv[3 + i] = options[i];
+        parallel_argv[5 + i] = options[i];
+    }
+    char *serial = test_run(serial_argv, queries);
+    char *parallel = test_run(parallel_argv, queries);
+    check(strlen(serial) > TEST_ROWS * 10 && !strcmp(serial, parallel), name);
+    free(serial);
+    free(parallel);
+}
+
+int
+main(){
+    load_table();
+    compare_outputs(NULL, 0, "parallel: output identical to serial scan");
+    char *mapped[] = {"--mmap"};
+    compare_outputs(mapped, 1, "parallel: output identical to serial scan (mmap)");
+    // 缓冲池很小时线程数被压低
+    char *small_cache[] = {"--cache-pages", "24"};
+    compare_outputs(small_cache, 2, "parallel: output identical to serial scan (small cache)");
+    test_remove_database(TEST_DB);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,89 @@
+/*
+ * 语句执行结果的回归测试: 在子进程中运行 db_main, 比较交互模式下的输出
+ * 包括没有匹配的行时 delete/update 的错误, 以及词法分析、语法错误和多行 insert
+ * 用法: test/statements
+ */
+#include "test.h"
+
+#define TEST_DB "/tmp/acdb-test-statements.db"
+
+char *db_argv[] = {"db", TEST_DB, NULL};
+
+// 执行 input (末尾加上 .exit), 输出是否和 expected 相同; 每条语句前面有一个提示符
+void
+check_output(const char *input, const char *expected, const char *name){
+    char *full_input = malloc(strlen(input) + 7);
+    sprintf(full_input, "%s.exit\n", input);
+    char *output = test_run(db_argv, full_input);
+    bool ok = !strcmp(output, expected);
+    if (!ok) {
+        printf("expected:\n%sgot:\n%s", expected, output);
+    }
+    check(ok, name);
+    free(output);
+    free(full_input);
+}
+
+// 没有匹配的行时 delete 和 update 报告错误, 不再和真正修改了行一样输出 "Executed."
+void
+test_not_found(){
+    test_remove_database(TEST_DB);
+    check_output("insert 1 alice alice@example.com\ninsert 5 bob bob@example.com\n",
+                 "acdb >Executed. \nacdb >Executed. \nacdb >", "statements: insert");
+    check_output("update set email = carol@example.com where id = 3\n",
+                 "acdb >Error: No matching rows.\nacdb >", "statements: update of a missing id");
+    check_output("update set email = carol@example.com where id = 5\nselect where id = 5\n",
+                 "acdb >Executed. \nacdb >(5, bob, carol@example.com)\nExecuted. \nacdb >",
+                 "statements: update of an existing id");
+    check_output("delete where id between 2 and 4\ndelete where id = 7\n",
+                 "acdb >Error: No matching rows.\nacdb >Error: No matching rows.\nacdb >",
+                 "statements: delete of an empty range");
+    check_output("delete where id between 1 and 4\nselect\n",
+                 "acdb >Executed. \nacdb >(5, bob, carol@example.com)\nExecuted. \nacdb >",
+                 "statements: delete of a non-empty range");
+    check_output("delete\ndelete\n", "acdb >Executed. \nacdb >Error: No matching rows.\nacdb >",
+                 "statements: delete from an empty table");
+    test_remove_database(TEST_DB);
+}
+
+// 词法分析和多行 insert: 引号中的空格和 '' 转义, 关键字不区分大小写, 结尾的分号, 各种语法错误
+void
+test_tokenizer(){
+    test_remove_database(TEST_DB);
+    check_output("INSERT 1 'alice smith' 'a@x.com';\n"
+                 "insert values (2, 'it''s', 'b@x.com'), (3,'c','c@x.com') ;\n"
+                 "Select * Where id Between 1 And 3\n",
+                 "acdb >Executed. \nacdb >Executed. \n"
+                 "acdb >(1, alice smith, a@x.com)\n(2, it's, b@x.com)\n(3, c, c@x.com)\nExecuted. \nacdb >",
+                 "statements: quoted values, escapes and keyword case");
+    check_output("insert 1x a b\ninsert 18446744073709551616 a b\ninsert -4 a b\n",
+                 "acdb >syntax serror 'insert 1x a b' \n"
+                 "acdb >syntax serror 'insert 18446744073709551616 a b' \n"
+                 "acdb >ID must be positive.\nacdb >",
+                 "statements: ids that are not numbers, overflow or are negative");
+    check_output("insert values (5,'e','e@x.com'\ninsert 6 'unterminated e\ninsert 7 a b extra\n"
+                 "insert 8 abcdefghijabcdefghijabcdefghijabc e\n",
+                 "acdb >syntax serror 'insert values (5,'e','e@x.com'' \n"
+                 "acdb >syntax serror 'insert 6 'unterminated e' \n"
+                 "acdb >syntax serror 'insert 7 a b extra' \n"
+                 "acdb >String is too long.\nacdb >",
+                 "statements: unbalanced parentheses, unterminated strings, trailing tokens");
+    // 多行 insert 遇到重复的键时停止, 之前的行保留; 最大的 64 位主键也能插入
+    check_output("insert 18446744073709551615 max m\ninsert values (4,'d','d@x.com'),(2,'dup','e'),(5,'f','f')\n"
+                 "select id\n",
+                 "acdb >Executed. \nacdb >Error: Duplicate key. \n"
+                 "acdb >(1)\n(2)\n(3)\n(4)\n(18446744073709551615)\nExecuted. \nacdb >",
+                 "statements: multi-row insert stops at a duplicate key");
+    check_output("begin\ninsert values (9,'i','i'),(10,'j','j')\ncommit\ncommit\nselect id where id between 9 and 10\n",
+                 "acdb >Executed. \nacdb >Executed. \nacdb >Executed. \nacdb >Error: No transaction is active.\n"
+                 "acdb >(9)\n(10)\nExecuted. \nacdb >",
+                 "statements: multi-row insert inside a transaction");
+    test_remove_database(TEST_DB);
+}
+
+int
+main(){
+    test_not_found();
+    test_tokenizer();
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
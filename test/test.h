@@ -0,0 +1,89 @@
+#ifndef _TEST_H
+#define _TEST_H
+
+/*
+ * 回归测试和基准一样把 db.c 整个包含进来(bench/bench.h), 直接调用引擎内部的函数,
+ * 或者在子进程中运行 db_main 检查它的输出。每项检查输出一行 "ok"/"FAIL", 有失败时返回非零
+ */
+#include "../bench/bench.h"
+#include <sys/wait.h>
+
+int failures = 0;
+
+void
+check(bool ok, const char *name){
+    printf("%s %s\n", ok ? "ok" : "FAIL", name);
+    if (!ok) {
+        failures++;
+    }
+}
+
+// 删除数据库文件和它的 WAL
+void
+test_remove_database(const char *filename){
+    char wal_filename[512];
+    snprintf(wal_filename, sizeof(wal_filename), "%s-wal", filename);
+    unlink(filename);
+    unlink(wal_filename);
+}
+
+// 读出整个文件, 以 '\0' 结尾
+char*
+read_file(const char *filename){
+    FILE *file = fopen(filename, "r");
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    rewind(file);
+    char *data = malloc(length + 1);
+    data[fread(data, 1, length, file)] = '\0';
+    fclose(file);
+    return data;
+}
+
+uint32_t
+count_occurrences(const char *data, const char *needle){
+    uint32_t count = 0;
+    for (const char *p = strstr(data, needle); p; p = strstr(p + 1, needle)) {
+        count++;
+    }
+    return count;
+}
+
+// 在子进程中运行 db_main: input 是标准输入, 返回标准输出的全部内容(调用者释放)
+// 每次运行都重新打开数据库, 前一次的修改要经过关闭和重新打开才能看到
+char*
+test_run(char **argv, const char *input){
+    char input_filename[64], output_filename[64];
+    snprintf(input_filename, sizeof(input_filename), "/tmp/acdb-test-%d.in", getpid());
+    snprintf(output_filename, sizeof(output_filename), "/tmp/acdb-test-%d.out", getpid());
+    FILE *file = fopen(input_filename, "w");
+    fputs(input, file);
+    fclose(file);
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        int input_fd = open(input_filename, O_RDONLY);
+        int output_fd = open(output_filename, O_WRONLY | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+        dup2(input_fd, STDIN_FILENO);
+        dup2(output_fd, STDOUT_FILENO);
+        int argc = 0;
+        while (argv[argc]) {
+            argc++;
+        }
+        db_main(argc, argv);
+        _exit(EXIT_FAILURE);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    char *output = read_file(output_filename);
+    unlink(input_filename);
+    unlink(output_filename);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+        printf("db exited abnormally: %s\n", output);
+        failures++;
+    }
+    return output;
+}
+
+#endif
@@ -0,0 +1,241 @@
+/*
+ * 删除后 B+ 树调整的回归测试:
+ *  - 随机删除和范围删除之后, 每个非根节点不低于最小占用, 键有序, 父节点指针和叶节点链表正确
+ *  - 合并释放的页面进入空闲页链表, 树中的页、空闲页和文件头加起来正好是文件的页数
+ *  - 之后的插入先用空闲页, 全部删除后树退回只有一个根叶节点, 重新打开后空闲页链表仍然有效
+ * 用法: test/tree
+ */
+#include "test.h"
+
+#define TEST_DB "/tmp/acdb-test-tree.db"
+// 长的行每个叶节点只能放十几行, 这么多行才会有几十个内部节点, 内部节点的合并和借用也会发生
+#define TEST_ROWS 60000
+
+typedef struct {
+    uint64_t rows;
+    uint32_t pages;
+    uint32_t leaf_depth;
+    uint32_t next_leaf;       // 前一个叶节点记录的右兄弟, 应该是下一个访问到的叶节点
+    uint64_t min_leaf_bytes;  // 非根叶节点中最小的已用字节数
+    uint32_t min_internal_keys;
+} TreeShape;
+
+// 检查以 page_num 为根的子树: 键都在 (low, high] 中(has_low 为 false 时没有下界)
+bool
+subtree_valid(Table *table, uint32_t page_num, uint32_t parent_page_num, bool has_low, uint64_t low,
+              uint64_t high, uint32_t depth, TreeShape *shape){
+    Pager *pager = table->pager;
+    void *node = malloc(PAGE_SIZE);
+    memcpy(node, get_page(pager, page_num), PAGE_SIZE);
+    pager_unpin(pager, page_num);
+    shape->pages++;
+
+    bool root = page_num == table->root_page_num;
+    bool ok = is_node_root(node) == root && (root || *node_parent(node) == parent_page_num);
+    if (get_node_type(node) == NODE_LEAF) {
+        uint32_t num_cells = *leaf_node_num_cells(node);
+        for (uint32_t i = 0; i < num_cells; i++) {
+            uint64_t key = *leaf_node_key(node, i);
+            ok = ok && (has_low ? key > low : true) && key <= high;
+            low = key;
+            has_low = true;
+        }
+        if (!root && leaf_node_used_bytes(node) < shape->min_leaf_bytes) {
+            shape->min_leaf_bytes = leaf_node_used_bytes(node);
+        }
+        ok = ok && shape->next_leaf == page_num && (shape->leaf_depth == 0 || shape->leaf_depth == depth);
+        shape->next_leaf = *leaf_node_next_leaf(node);
+        shape->leaf_depth = depth;
+        shape->rows += num_cells;
+    }else if (get_node_type(node) == NODE_INTERNAL) {
+        uint32_t num_keys = *internal_node_num_keys(node);
+        if (!root && num_keys < shape->min_internal_keys) {
+            shape->min_internal_keys = num_keys;
+        }
+        for (uint32_t i = 0; i <= num_keys && ok; i++) {
+            uint64_t child_high = i < num_keys ? *internal_node_key(node, i) : high;
+            ok = child_high <= high && (!has_low || child_high > low)
+                 && subtree_valid(table, *internal_node_child(node, i), page_num, has_low, low, child_high,
+                                  depth + 1, shape);
+            low = child_high;
+            has_low = true;
+        }
+    }else {
+        ok = false;
+    }
+    free(node);
+    return ok;
+}
+
+// 空闲页链表的长度和文件头中的计数一致, 链表上都是空闲页
+uint32_t
+free_list_length(Pager *pager, bool *ok){
+    void *header = get_page(pager, HEADER_PAGE_NUM);
+    uint32_t page_num = *header_free_head(header);
+    uint32_t count = *header_free_count(header);
+    pager_unpin(pager, HEADER_PAGE_NUM);
+    uint32_t length = 0;
+    while (page_num != 0 && length <= pager->num_pages) {
+        void *page = get_page(pager, page_num);
+        *ok = *ok && get_node_type(page) == NODE_FREE;
+        uint32_t next_page_num = *free_page_next(page);
+        pager_unpin(pager, page_num);
+        page_num = next_page_num;
+        length++;
+    }
+    *ok = *ok && length == count;
+    return length;
+}
+
+// 整棵树有效, 行数是 rows, 每一页要么在树中要么在空闲页链表上
+bool
+tree_valid(Table *table, uint64_t rows, TreeShape *shape){
+    memset(shape, 0, sizeof(*shape));
+    void *root = get_page(table->pager, table->root_page_num);
+    uint32_t first_leaf = table->root_page_num;
+    while (get_node_type(root) == NODE_INTERNAL) {
+        uint32_t child = *internal_node_child(root, 0);
+        pager_unpin(table->pager, first_leaf);
+        first_leaf = child;
+        root = get_page(table->pager, first_leaf);
+    }
+    pager_unpin(table->pager, first_leaf);
+    shape->next_leaf = first_leaf;
+    shape->min_leaf_bytes = UINT64_MAX;
+    shape->min_internal_keys = UINT32_MAX;
+
+    bool ok = subtree_valid(table, table->root_page_num, 0, false, 0, UINT64_MAX, 1, shape);
+    uint32_t free_pages = free_list_length(table->pager, &ok);
+    return ok && shape->next_leaf == 0 && shape->rows == rows
+           && 1 + shape->pages + free_pages == table->pager->num_pages;
+}
+
+// 调整之后的叶节点最多比一半少一个最长的单元格(按字节平分时最后一个单元格放在左边)
+bool
+shape_balanced(TreeShape *shape){
+    return shape->min_leaf_bytes + ROW_MAX_SIZE + LEAF_NODE_SLOT_SIZE >= LEAF_NODE_MIN_BYTES
+           && shape->min_internal_keys >= INTERNAL_NODE_MIN_KEYS;
+}
+
+uint32_t
+free_count(Table *table){
+    uint32_t count = *header_free_count(get_page(table->pager, HEADER_PAGE_NUM));
+    pager_unpin(table->pager, HEADER_PAGE_NUM);
+    return count;
+}
+
+void
+insert_rows(Table *table, bool *present, uint32_t first, uint32_t last){
+    Row row;
+    for (uint32_t i = first; i <= last; i++) {
+        if (!present[i]) {
+            bench_make_row(&row, i, 200 + i % 56);
+            table_insert(table, &row);
+            pager_unpin_all(table->pager);
+            present[i] = true;
+        }
+    }
+}
+
+// 表中的键和模型相同
+bool
+keys_match(Table *table, bool *present){
+    bool ok = true;
+    uint64_t expected = 0;
+    Cursor *cursor = table_start(table);
+    while (!cursor->end_of_table && ok) {
+        do {
+            expected++;
+        } while (expected <= TEST_ROWS && !present[expected]);
+        ok = cursor_key(cursor) == expected;
+        cursor_advance(cursor);
+    }
+    do {
+        expected++;
+    } while (expected <= TEST_ROWS && !present[expected]);
+    ok = ok && cursor->end_of_table && expected == TEST_ROWS + 1;
+    free(cursor);
+    pager_unpin_all(table->pager);
+    return ok;
+}
+
+void
+test_delete_rebalance(){
+    Table *table = bench_open_table(TEST_DB, 64, DURABILITY_OFF, "cache", DEFAULT_PAGE_SIZE);
+    bool *present = calloc(TEST_ROWS + 1, sizeof(bool));
+    uint64_t rows = TEST_ROWS;
+    insert_rows(table, present, 1, TEST_ROWS);
+    TreeShape shape;
+    check(tree_valid(table, rows, &shape) && shape.leaf_depth == 3, "tree: inserted tree is valid");
+    uint32_t pages_built = table->pager->num_pages;
+
+    // 随机删除三分之二的行: 叶节点向兄弟借或者合并, 内部节点跟着变少
+    uint64_t state = 3;
+    bool ok = true;
+    for (uint32_t i = 0; i < TEST_ROWS * 2; i++) {
+        uint64_t key = bench_random(&state) % TEST_ROWS + 1;
+        if (rows > TEST_ROWS / 3 && present[key]) {
+            ok = ok && table_delete(table, key, key) == 1;
+            pager_unpin_all(table->pager);
+            present[key] = false;
+            rows--;
+        }
+        if (i % 20000 == 0) {
+            ok = ok && tree_valid(table, rows, &shape) && shape_balanced(&shape);
+        }
+    }
+    uint32_t freed = free_count(table);
+    check(ok && tree_valid(table, rows, &shape) && shape_balanced(&shape) && keys_match(table, present)
+          && freed > pages_built / 3, "tree: random deletes merge and redistribute nodes");
+
+    // 范围删除: 中间一大段叶节点连同它们的父节点被释放
+    uint32_t deleted = table_delete(table, TEST_ROWS / 4, TEST_ROWS * 3 / 4);
+    pager_unpin_all(table->pager);
+    for (uint32_t i = TEST_ROWS / 4; i <= TEST_ROWS * 3 / 4; i++) {
+        deleted -= present[i];
+        rows -= present[i];
+        present[i] = false;
+    }
+    check(deleted == 0 && tree_valid(table, rows, &shape) && shape_balanced(&shape) && keys_match(table, present)
+          && free_count(table) > freed, "tree: range delete frees the emptied pages");
+
+    // 重新插入: 空闲页用完之前文件不变大
+    uint32_t pages_before = table->pager->num_pages;
+    uint32_t free_before = free_count(table);
+    insert_rows(table, present, 1, TEST_ROWS / 2);
+    uint32_t free_after = free_count(table);
+    rows = 0;
+    for (uint32_t i = 1; i <= TEST_ROWS; i++) {
+        rows += present[i];
+    }
+    check(free_after < free_before && (free_after == 0 || table->pager->num_pages == pages_before)
+          && tree_valid(table, rows, &shape) && keys_match(table, present),
+          "tree: inserts reuse free pages before growing the file");
+
+    // 全部删除: 只剩文件头和根叶节点, 其余的页都在空闲页链表上
+    check(table_delete(table, 0, UINT64_MAX) == rows && tree_valid(table, 0, &shape) && shape.leaf_depth == 1
+          && free_count(table) == table->pager->num_pages - 2, "tree: deleting every row collapses the root");
+    pager_unpin_all(table->pager);
+    pager_commit(table->pager, true);
+    uint32_t num_pages = table->pager->num_pages;
+    db_close(table);
+
+    // 重新打开之后空闲页链表仍然完整, 插入从链表上取页
+    DbConfig config = {64, DURABILITY_OFF, true};
+    table = db_open(TEST_DB, &config);
+    memset(present, 0, (TEST_ROWS + 1) * sizeof(bool));
+    check(tree_valid(table, 0, &shape) && free_count(table) == num_pages - 2,
+          "tree: free list survives reopening");
+    insert_rows(table, present, 1, TEST_ROWS / 10);
+    check(table->pager->num_pages == num_pages && tree_valid(table, TEST_ROWS / 10, &shape)
+          && keys_match(table, present), "tree: inserts after reopening reuse free pages");
+    db_close(table);
+    free(present);
+    test_remove_database(TEST_DB);
+}
+
+int
+main(){
+    test_delete_rebalance();
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}